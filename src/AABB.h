@@ -1,17 +1,23 @@
 #ifndef AABB_H
 #define AABB_H
 
-class AABB {
+// an axis-aligned box over scalar type T; AABB is the one over the build's Real (see global.h).
+template <typename T>
+class AABBT {
     public:
+        using Interval = IntervalT<T>;
+        using Point3d = Vector3<T>;
+        using Ray = RayT<T>;
+
         Interval x, y, z;
 
-        AABB() {}
-        AABB(const Interval &x, const Interval &y, const Interval &z) : x(x), y(y), z(z) {
+        AABBT() {}
+        AABBT(const Interval &x, const Interval &y, const Interval &z) : x(x), y(y), z(z) {
             pad_to_minimum();
         }
 
         // given two extremas, construct the AABB.
-        AABB(const Point3d &p1, const Point3d &p2) {
+        AABBT(const Point3d &p1, const Point3d &p2) {
             x = (p1[0] < p2[0]) ? Interval(p1[0], p2[0]) : Interval(p2[0], p1[0]);
             y = (p1[1] < p2[1]) ? Interval(p1[1], p2[1]) : Interval(p2[1], p1[1]);
             z = (p1[2] < p2[2]) ? Interval(p1[2], p2[2]) : Interval(p2[2], p1[2]);
@@ -20,13 +26,13 @@ class AABB {
         }
 
         // construct the union of two AABBs.
-        AABB(const AABB &aabb1, const AABB &aabb2) {
+        AABBT(const AABBT &aabb1, const AABBT &aabb2) {
             x = Interval(aabb1.x, aabb2.x);
             y = Interval(aabb1.y, aabb2.y);
             z = Interval(aabb1.z, aabb2.z);
         }
 
-        Vector3d Centriod() { return Vector3d((x.max + x.min) / 2, (y.max + y.min) / 2, (z.max + z.min) / 2); }
+        Point3d Centriod() const { return Point3d((x.max + x.min) / 2, (y.max + y.min) / 2, (z.max + z.min) / 2); }
 
         const Interval& axis_interval(int i) const {
             if (i == 0) return x;
@@ -35,15 +41,16 @@ class AABB {
         }
 
         bool intersectP(const Ray &ri, Interval t_interval) const {
+            RT_STAT(BoxTests);
             const Point3d &ray_orig = ri.origin();
-            const Vector3d ray_dir = ri.direction();
-            const Vector3d invDir = Vector3d(1/ray_dir[0], 1/ray_dir[1], 1/ray_dir[2]);
+            const Point3d ray_dir = ri.direction();
+            const Point3d invDir = Point3d(1/ray_dir[0], 1/ray_dir[1], 1/ray_dir[2]);
             
             for (int i = 0; i < 3; i++) {
                 const Interval &axis = axis_interval(i);
 
-                double t0 = (axis.min - ray_orig[i]) * invDir[i];
-                double t1 = (axis.max - ray_orig[i]) * invDir[i];
+                T t0 = (axis.min - ray_orig[i]) * invDir[i];
+                T t1 = (axis.max - ray_orig[i]) * invDir[i];
 
                 if (t0 < t1) {
                     if (t0 > t_interval.min) t_interval.min = t0;
@@ -58,33 +65,45 @@ class AABB {
             return true;
         }
 
+        // returns the area of the box's surface (0 for the empty box).
+        T surface_area() const {
+            if (x.size() < 0 || y.size() < 0 || z.size() < 0) return 0.0;
+            return 2 * (x.size()*y.size() + y.size()*z.size() + z.size()*x.size());
+        }
+
         // return the index of axis with maximum spatial span.
-        int longest_axis() {
+        int longest_axis() const {
             if (x.size() > y.size()) 
                 return (x.size() > z.size()) ? 0 : 2;
             else 
                 return (y.size() > z.size()) ? 1 : 2;
         }
 
-        static const AABB empty, universe;
+        static const AABBT empty, universe;
 
     private:
         void pad_to_minimum() {
-            double delta = 1e-4;
+            T delta = T(1e-4);
             if (x.size() < delta) x = x.expand(delta);
             if (y.size() < delta) y = y.expand(delta);
             if (z.size() < delta) z = z.expand(delta);
         }
 };
 
-const AABB AABB::empty = AABB(Interval::empty, Interval::empty, Interval::empty);
-const AABB AABB::universe = AABB(Interval::universe, Interval::universe, Interval::universe);
+template <typename T>
+const AABBT<T> AABBT<T>::empty = AABBT<T>(IntervalT<T>::empty, IntervalT<T>::empty, IntervalT<T>::empty);
+template <typename T>
+const AABBT<T> AABBT<T>::universe = AABBT<T>(IntervalT<T>::universe, IntervalT<T>::universe, IntervalT<T>::universe);
+
+using AABB = AABBT<Real>;
 
-AABB operator+(const AABB &aabb, const Vector3d &offset) {
-    return AABB(aabb.x + offset.x(), aabb.y + offset.y(), aabb.z + offset.z());
+template <typename T>
+AABBT<T> operator+(const AABBT<T> &aabb, const Vector3<T> &offset) {
+    return AABBT<T>(aabb.x + offset.x(), aabb.y + offset.y(), aabb.z + offset.z());
 }
 
-AABB operator+(const Vector3d &offset, const AABB &aabb) {
+template <typename T>
+AABBT<T> operator+(const Vector3<T> &offset, const AABBT<T> &aabb) {
     return aabb + offset;
 }
 
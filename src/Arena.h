@@ -0,0 +1,93 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// a bump allocator: allocations are carved one after another out of large blocks, and nothing is freed
+// until the arena itself is destroyed, which releases every block at once. objects built together end up
+// next to each other in memory, and building or tearing down millions of them costs a handful of mallocs.
+// note: not thread safe; threads that build in parallel use an arena each.
+class Arena {
+    public:
+        explicit Arena(size_t block_size = 1024 * 1024) : block_size(block_size) {}
+
+        Arena(const Arena &) = delete;
+        Arena &operator=(const Arena &) = delete;
+
+        void *allocate(size_t bytes, size_t align) {
+            n_allocations++;
+            bytes_allocated += bytes;
+
+            uintptr_t p = (uintptr_t(current) + align - 1) & ~uintptr_t(align - 1);
+            if (!current || p + bytes > uintptr_t(end)) {
+                // blocks grow up to block_size; a request that's larger still gets a block of its own.
+                size_t size = std::max(bytes + align, next_block_size);
+                next_block_size = std::min(block_size, next_block_size * 2);
+                blocks.emplace_back(new char[size]);
+                bytes_reserved += size;
+                current = blocks.back().get();
+                end = current + size;
+                p = (uintptr_t(current) + align - 1) & ~uintptr_t(align - 1);
+            }
+            current = reinterpret_cast<char*>(p + bytes);
+            return reinterpret_cast<void*>(p);
+        }
+
+        // constructs a T in the arena; its destructor never runs, so T must not own anything.
+        template <typename T, typename... Args>
+        T *create(Args&&... args) {
+            static_assert(std::is_trivially_destructible<T>::value, "Arena::create needs a trivially destructible type");
+            return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        }
+
+        size_t allocations()    const { return n_allocations; }
+        size_t bytes_used()     const { return bytes_allocated; } // sum of the sizes requested.
+        size_t bytes_in_blocks() const { return bytes_reserved; } // memory actually taken from the heap.
+        size_t block_count()    const { return blocks.size(); }
+
+    private:
+        std::vector<std::unique_ptr<char[]>> blocks;
+        char *current = nullptr, *end = nullptr;
+        size_t block_size;
+        size_t next_block_size = 4 * 1024; // doubles up to block_size, so small arenas stay small.
+        size_t n_allocations = 0, bytes_allocated = 0, bytes_reserved = 0;
+};
+
+// a std allocator drawing from an Arena, for std::allocate_shared. every copy (e.g. the one each shared
+// object's control block keeps) holds a reference to the arena, so the arena's blocks are only released
+// once the last object allocated from it is gone. deallocate() does nothing.
+template <typename T>
+class ArenaAllocator {
+    public:
+        using value_type = T;
+
+        explicit ArenaAllocator(std::shared_ptr<Arena> arena) : arena(std::move(arena)) {}
+
+        template <typename U>
+        ArenaAllocator(const ArenaAllocator<U> &other) : arena(other.arena) {}
+
+        T *allocate(size_t n) { return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T))); }
+        void deallocate(T *, size_t) {}
+
+        template <typename U> bool operator==(const ArenaAllocator<U> &other) const { return arena == other.arena; }
+        template <typename U> bool operator!=(const ArenaAllocator<U> &other) const { return arena != other.arena; }
+
+    private:
+        template <typename U> friend class ArenaAllocator;
+        std::shared_ptr<Arena> arena;
+};
+
+// returns a shared T allocated (together with its control block) from arena.
+template <typename T, typename... Args>
+inline std::shared_ptr<T> make_shared_in(const std::shared_ptr<Arena> &arena, Args&&... args) {
+    return std::allocate_shared<T>(ArenaAllocator<T>(arena), std::forward<Args>(args)...);
+}
+
+#endif
@@ -2,76 +2,468 @@
 #define BVH_H
 
 #include "AABB.h"
+#include "Arena.h"
 #include "Object.h"
+#include "RayPacket.h"
+#include "ThreadPool.h"
 
 #include <algorithm>
+#include <cstdint>
+#include <memory>
 
-class BVHNode : public Object {
+// how a BVH builder picks the split of a node's objects.
+enum class BVHSplit {
+    Middle, // median object along the longest axis.
+    SAH     // binned surface area heuristic.
+};
+
+// node layout of the flattened BVHs scenes are traced against.
+// note: only a scene's own BVH (Scene::buildBVH) takes it; pools & meshes always build binary nodes, whose
+// leaves are ranges tested by their own kernels.
+enum class BVHLayout {
+    Binary, // LinearBVH: 32-byte binary nodes.
+    Wide4   // BVH4: 4 children per node, tested together with SIMD.
+};
+
+struct BVHBuildOptions {
+    BVHLayout layout         = BVHLayout::Binary;
+    BVHSplit split           = BVHSplit::Middle;
+    int    sah_bins          = 16;   // bins per axis, i.e. sah_bins - 1 candidate planes.
+    double traversal_cost    = 1.0;  // relative cost of visiting a node.
+    double intersection_cost = 1.0;  // relative cost of intersecting an object.
+    int    max_leaf_size     = 4;    // most objects in one leaf of a flattened BVH.
+    int    build_threads     = 1;    // threads building the tree's subtrees, 0 uses every hardware thread.
+};
+
+// an object's bounding box & centroid, cached once so builders never call the virtual get_AABB() while
+// sorting or binning.
+struct BVHPrimitive {
+    AABB aabb;
+    Point3d centroid;
+    size_t index; // position in the object list the BVH is built over.
+};
+
+inline std::vector<BVHPrimitive> make_bvh_primitives(const std::vector<shared_ptr<Object>> &objects,
+                                                     int n_threads = 1)
+{
+    std::vector<BVHPrimitive> prims(objects.size());
+    const size_t chunk = 4096;
+    ThreadPool pool(n_threads);
+    pool.parallel_for((objects.size() + chunk - 1) / chunk, [&](size_t c, int) {
+        for (size_t i = c * chunk; i < std::min(objects.size(), (c+1) * chunk); i++) {
+            prims[i].aabb = objects[i]->get_AABB();
+            prims[i].centroid = prims[i].aabb.Centriod();
+            prims[i].index = i;
+        }
+    });
+    return prims;
+}
+
+// below this many primitives, a node's scans (bounds, binning) run on one thread: starting the pool's
+// threads would cost more than they save.
+const size_t bvh_parallel_scan = 1 << 15;
+
+// runs scan(first, last, chunk) over [start, end) cut into n_chunks contiguous chunks, on pool when
+// there's more than one.
+template <typename Scan>
+inline void scan_bvh_chunks(size_t start, size_t end, size_t n_chunks, ThreadPool *pool, Scan scan) {
+    if (n_chunks <= 1) { scan(start, end, 0); return; }
+    pool->parallel_for(n_chunks, [&](size_t c, int) {
+        scan(start + (end - start) * c / n_chunks, start + (end - start) * (c+1) / n_chunks, c);
+    });
+}
+
+// chunks a scan over count primitives is split into: one without a pool or for small ranges, else a few
+// per thread so work stealing can even them out.
+inline size_t bvh_scan_chunks(size_t count, ThreadPool *pool) {
+    if (!pool || pool->size() == 1 || count < bvh_parallel_scan) return 1;
+    return std::min(size_t(pool->size()) * 4, count / (bvh_parallel_scan / 8));
+}
+
+// returns the union of box(prims[i]) over [start, end), scanned in parallel on pool for large ranges.
+// unions are exact, so the result doesn't depend on the chunking.
+template <typename Box>
+inline AABB union_bvh_bounds(const std::vector<BVHPrimitive> &prims, size_t start, size_t end, ThreadPool *pool, Box box) {
+    size_t n_chunks = bvh_scan_chunks(end - start, pool);
+    std::vector<AABB> partial(n_chunks, AABB::empty);
+    scan_bvh_chunks(start, end, n_chunks, pool, [&](size_t first, size_t last, size_t c) {
+        AABB acc = AABB::empty;
+        for (size_t i = first; i < last; i++) acc = AABB(acc, box(prims[i]));
+        partial[c] = acc;
+    });
+    AABB total = AABB::empty;
+    for (const AABB &b : partial) total = AABB(total, b);
+    return total;
+}
+
+// the bounds & counts of the primitives in each of n centroid bins per axis (empty for flat axes).
+struct BVHBins {
+    std::vector<AABB> aabb[3];
+    std::vector<size_t> count[3];
+
+    explicit BVHBins(int n_bins) {
+        for (int a = 0; a < 3; a++) {
+            aabb[a].assign(n_bins, AABB::empty);
+            count[a].assign(n_bins, 0);
+        }
+    }
+
+    void add(const BVHBins &other) {
+        for (int a = 0; a < 3; a++) {
+            for (size_t b = 0; b < aabb[a].size(); b++) {
+                aabb[a][b] = AABB(aabb[a][b], other.aabb[a][b]);
+                count[a][b] += other.count[a][b];
+            }
+        }
+    }
+};
+
+// bins prims[start, end) by centroid along every axis centroid_bounds spans, in parallel chunks on pool
+// for large ranges (each chunk bins into its own BVHBins, merged after).
+inline BVHBins bin_bvh_primitives(const std::vector<BVHPrimitive> &prims, size_t start, size_t end,
+                                  const AABB &centroid_bounds, int n_bins, ThreadPool *pool)
+{
+    size_t n_chunks = bvh_scan_chunks(end - start, pool);
+    std::vector<BVHBins> partial(n_chunks, BVHBins(n_bins));
+    scan_bvh_chunks(start, end, n_chunks, pool, [&](size_t first, size_t last, size_t c) {
+        BVHBins &bins = partial[c];
+        for (int axis = 0; axis < 3; axis++) {
+            const Interval &extent = centroid_bounds.axis_interval(axis);
+            if (extent.size() <= 0) continue;
+            double scale = n_bins / extent.size();
+            for (size_t i = first; i < last; i++) {
+                int b = std::min(n_bins-1, int((prims[i].centroid[axis] - extent.min) * scale));
+                bins.aabb[axis][b] = AABB(bins.aabb[axis][b], prims[i].aabb);
+                bins.count[axis][b]++;
+            }
+        }
+    });
+    for (size_t c = 1; c < n_chunks; c++) partial[0].add(partial[c]);
+    return partial[0];
+}
+
+// where a node's primitives were split: the second group begins at middle.
+struct BVHSplitInfo {
+    size_t middle;
+    int axis;
+    double cost; // SAH cost of the split, infinity for median splits.
+};
+
+// reorders prims[start, end) (bounded by aabb) into two groups. with a pool, large ranges are binned in
+// parallel; the split is the same either way.
+// note: the reordering itself (std::partition / std::nth_element) stays serial, a parallel one wouldn't
+//       leave the primitives in the same order, & the tree would depend on the thread count.
+inline BVHSplitInfo partition_bvh_primitives(std::vector<BVHPrimitive> &prims, size_t start, size_t end,
+                                             const AABB &aabb, const BVHBuildOptions &opts,
+                                             ThreadPool *pool = nullptr)
+{
+    size_t middle = start + (end - start)/2;
+
+    if (opts.split == BVHSplit::SAH && end - start > 1) {
+        // bin the centroids along each axis & sweep the bins to find the cheapest plane:
+        // cost = C_trav + C_isect * (A_left * N_left + A_right * N_right) / A_node.
+        AABB centroid_bounds = union_bvh_bounds(prims, start, end, pool,
+            [](const BVHPrimitive &p) { return AABB(p.centroid, p.centroid); });
+
+        const int n_bins = std::max(2, opts.sah_bins);
+        BVHBins bins = bin_bvh_primitives(prims, start, end, centroid_bounds, n_bins, pool);
+        std::vector<AABB> right_aabb(n_bins);
+        std::vector<size_t> right_count(n_bins);
+
+        double best_cost = infinity;
+        int best_axis = -1, best_split = 0;
+        double area = aabb.surface_area();
+
+        for (int axis = 0; axis < 3; axis++) {
+            const Interval &extent = centroid_bounds.axis_interval(axis);
+            if (extent.size() <= 0) continue;
+            const std::vector<AABB> &bin_aabb = bins.aabb[axis];
+            const std::vector<size_t> &bin_count = bins.count[axis];
+
+            // sweep from the right to get the bounds & counts right of every plane.
+            AABB acc = AABB::empty; size_t count = 0;
+            for (int b = n_bins-1; b > 0; b--) {
+                acc = AABB(acc, bin_aabb[b]); count += bin_count[b];
+                right_aabb[b] = acc; right_count[b] = count;
+            }
+
+            acc = AABB::empty; count = 0;
+            for (int b = 1; b < n_bins; b++) {
+                acc = AABB(acc, bin_aabb[b-1]); count += bin_count[b-1];
+                if (count == 0 || right_count[b] == 0) continue;
+                double cost = opts.traversal_cost + opts.intersection_cost *
+                    (acc.surface_area() * count + right_aabb[b].surface_area() * right_count[b]) / area;
+                if (cost < best_cost) {
+                    best_cost = cost; best_axis = axis; best_split = b;
+                }
+            }
+        }
+
+        if (best_axis >= 0) {
+            const Interval &extent = centroid_bounds.axis_interval(best_axis);
+            double scale = n_bins / extent.size();
+            auto mid = std::partition(prims.begin() + start, prims.begin() + end,
+                [&](const BVHPrimitive &p) {
+                    return std::min(n_bins-1, int((p.centroid[best_axis] - extent.min) * scale)) < best_split;
+                });
+            BVHSplitInfo info = { size_t(mid - prims.begin()), best_axis, best_cost };
+            return info;
+        }
+        // all centroids coincide: fall back to the median split.
+    }
+
+    int axis = aabb.longest_axis();
+    std::nth_element(prims.begin() + start, prims.begin() + middle, prims.begin() + end,
+        [axis](const BVHPrimitive &a, const BVHPrimitive &b) { return a.centroid[axis] < b.centroid[axis]; });
+    BVHSplitInfo info = { middle, axis, infinity };
+    return info;
+}
+
+// a node of the intermediate tree that flattened BVHs are built from.
+struct BVHBuildNode {
+    AABB aabb;
+    BVHBuildNode *children[2] = { nullptr, nullptr }; // allocated from the tree's arenas.
+    size_t first = 0, count = 0; // leaf: range of the reordered primitives.
+    int axis = 0;                // interior: axis the children were split along.
+
+    bool is_leaf() const { return !children[0]; }
+};
+
+// conversions to float that never shrink a box.
+inline float round_down_to_float(double x) {
+    float f = float(x);
+    return (double(f) > x) ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+}
+
+inline float round_up_to_float(double x) {
+    float f = float(x);
+    return (double(f) < x) ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+}
+
+// the intermediate tree & the arenas its nodes live in, all released together.
+struct BVHBuildTree {
+    std::vector<std::unique_ptr<Arena>> arenas; // the top of the tree's, then one per parallel task.
+    BVHBuildNode *root = nullptr;
+};
+
+// a subtree whose build is left to a worker thread.
+struct BVHBuildTask {
+    BVHBuildNode *node;
+    size_t start, end;
+    int depth;
+};
+
+// deepest level of a build tree, which the traversal stacks are sized for: a binary traversal keeps at
+// most one entry per level, a BVH4 one at most 3 (+ the root).
+const int bvh_max_depth = 64;
+
+// levels above bvh_max_depth from which nodes are split at the median: halving the count every level,
+// the leaves forced at bvh_max_depth still fit a node's 16-bit count.
+const int bvh_median_levels = 17;
+
+// recursively builds node over prims[start, end), reordering prims so every leaf is contiguous.
+// leaves hold up to opts.max_leaf_size objects; with SAH, small nodes also stay leaves when splitting
+// them wouldn't pay off. if tasks is given, subtrees of at most task_size primitives are recorded there
+// instead of built: they cover disjoint ranges of prims, so they can then be built in parallel. with a
+// pool, the scans of large nodes (the top of the tree, above the tasks) run on it too.
+// note: nodes at bvh_max_depth become leaves whatever their count, so a degenerate run of uneven splits
+//       can't overflow a traversal stack.
+inline void build_bvh_node(BVHBuildNode &node, std::vector<BVHPrimitive> &prims, size_t start, size_t end,
+                           const BVHBuildOptions &opts, Arena &arena, std::vector<BVHBuildTask> *tasks = nullptr,
+                           size_t task_size = 0, ThreadPool *pool = nullptr, int depth = 0)
+{
+    node.aabb = union_bvh_bounds(prims, start, end, pool, [](const BVHPrimitive &p) { return p.aabb; });
+
+    size_t count = end - start;
+    size_t max_leaf = size_t(std::max(1, std::min(opts.max_leaf_size, 0xffff)));
+
+    if (count > 1 && depth < bvh_max_depth) {
+        BVHBuildOptions level_opts = opts;
+        if (depth >= bvh_max_depth - bvh_median_levels) level_opts.split = BVHSplit::Middle;
+        auto split = partition_bvh_primitives(prims, start, end, node.aabb, level_opts, pool);
+
+        if (count > max_leaf || split.cost < opts.intersection_cost * count) {
+            node.axis = split.axis;
+            size_t ranges[2][2] = { { start, split.middle }, { split.middle, end } };
+            for (int c = 0; c < 2; c++) {
+                node.children[c] = arena.create<BVHBuildNode>();
+                if (tasks && ranges[c][1] - ranges[c][0] <= task_size) {
+                    BVHBuildTask task = { node.children[c], ranges[c][0], ranges[c][1], depth + 1 };
+                    tasks->push_back(task);
+                } else {
+                    build_bvh_node(*node.children[c], prims, ranges[c][0], ranges[c][1], opts, arena, tasks, task_size,
+                                   pool, depth + 1);
+                }
+            }
+            return;
+        }
+    }
+
+    node.first = start;
+    node.count = count;
+}
+
+// builds the tree over prims[start, end). with opts.build_threads != 1, the top of the tree is built
+// first, its nodes' bounds & bins gathered by a thread pool, then the subtrees below it are built by
+// the pool, each task into an arena of its own.
+inline BVHBuildTree build_bvh_tree(std::vector<BVHPrimitive> &prims, size_t start, size_t end,
+                                   const BVHBuildOptions &opts)
+{
+    // a tree has at most 2n - 1 nodes; the arena's blocks grow towards that, one malloc per block.
+    BVHBuildTree tree;
+    tree.arenas.emplace_back(new Arena(std::max<size_t>(4096, (end - start) * sizeof(BVHBuildNode))));
+    tree.root = tree.arenas[0]->create<BVHBuildNode>();
+    ThreadPool pool(opts.build_threads);
+
+    // below this, handing subtrees to threads costs more than it saves.
+    const size_t min_parallel = 4096;
+    if (pool.size() == 1 || end - start < min_parallel) {
+        build_bvh_node(*tree.root, prims, start, end, opts, *tree.arenas[0]);
+        return tree;
+    }
+
+    // several subtrees per thread, so the work stealing can even out unbalanced splits.
+    size_t task_size = std::max(min_parallel / 4, (end - start) / (size_t(pool.size()) * 8));
+    std::vector<BVHBuildTask> tasks;
+    build_bvh_node(*tree.root, prims, start, end, opts, *tree.arenas[0], &tasks, task_size, &pool);
+
+    for (const auto &task : tasks)
+        tree.arenas.emplace_back(new Arena(std::max<size_t>(4096, (task.end - task.start) * sizeof(BVHBuildNode))));
+    pool.parallel_for(tasks.size(), [&](size_t i, int) {
+        build_bvh_node(*tasks[i].node, prims, tasks[i].start, tasks[i].end, opts, *tree.arenas[i + 1], nullptr, 0,
+                       nullptr, tasks[i].depth);
+    });
+    return tree;
+}
+
+// base of the flattened BVHs: owns the objects in leaf order, so leaves are just ranges of it.
+class BVHAccel : public Object {
     public:
-        BVHNode(std::vector<shared_ptr<Object>> &objects) : BVHNode(objects, 0, objects.size()) {}
+        AABB get_AABB() const override { return aabb; }
 
-        BVHNode(std::vector<shared_ptr<Object>> &objects, size_t start, size_t end) {
+        virtual size_t node_count() const = 0;
 
-            aabb = AABB::empty;
-            for (size_t obj_index = start; obj_index < end; obj_index++)
-                aabb = AABB(aabb, objects[obj_index]->get_AABB());
-            
-            size_t object_span = end - start;
+        // intersects every ray of the packet within t, storing the results in the packet.
+        // layouts without a packet traversal trace the rays one by one.
+        virtual void intersect_packet(RayPacket &packet, const Interval &t) const {
+            packet.begin(t);
+            for (int k = 0; k < packet.size; k++) {
+                packet.hit[k] = intersect(packet.rays[k], t, packet.isect[k]);
+                if (packet.hit[k]) packet.t_max[k] = packet.isect[k].distance;
+            }
+        }
 
-            if (object_span == 1) {
-                left = right = objects[start];
-            } else if (object_span == 2) {
-                left = objects[start];
-                right = objects[start+1];
-            } else {
-                int axis = aabb.longest_axis();
-                auto comparator = (axis == 0) ? compare_AABB_x
-                                : (axis == 1) ? compare_AABB_y
-                                              : compare_AABB_z;
-                std::sort(std::begin(objects) + start, std::begin(objects) + end, comparator);
-
-                auto middle = start + object_span/2;
-                left = make_shared<BVHNode>(objects, start, middle);
-                right = make_shared<BVHNode>(objects, middle, end);
+        // returns the expected cost of tracing a random ray under the surface area heuristic.
+        virtual double sah_cost(const BVHBuildOptions &opts) const = 0;
+
+        void register_materials(MaterialTable &table) override {
+            for (const auto &obj : owned) obj->register_materials(table);
+        }
+
+    protected:
+        friend class SceneSnapshot;
+
+        std::vector<const Object*> leaf_objects; // raw, so traversal never touches refcounts.
+        std::vector<shared_ptr<Object>> owned;   // keeps leaf_objects alive.
+        AABB aabb = AABB::empty;
+
+        // builds the binary tree over objects and stores them in its leaf order.
+        BVHBuildTree build_tree(const std::vector<shared_ptr<Object>> &objects, const BVHBuildOptions &opts) {
+            auto prims = make_bvh_primitives(objects, opts.build_threads);
+            auto tree = build_bvh_tree(prims, 0, prims.size(), opts);
+
+            owned.reserve(objects.size());
+            for (const auto &p : prims) owned.push_back(objects[p.index]);
+            leaf_objects.reserve(owned.size());
+            for (const auto &obj : owned) leaf_objects.push_back(obj.get());
+
+            aabb = tree.root->aabb;
+            return tree;
+        }
+
+        // intersects the objects of one leaf, shrinking t_interval.max to the closest hit.
+        bool intersect_leaf(uint32_t first, uint32_t count, const Ray &ri, Interval &t_interval,
+                            Intersection &isect) const
+        {
+            bool hit_anything = false;
+            for (uint32_t i = first; i < first + count; i++) {
+                if (leaf_objects[i]->intersect(ri, t_interval, isect)) {
+                    hit_anything = true;
+                    t_interval.max = isect.distance;
+                }
             }
+            return hit_anything;
+        }
+};
+
+class BVHNode : public Object {
+    public:
+        BVHNode(const std::vector<shared_ptr<Object>> &objects, const BVHBuildOptions &opts = BVHBuildOptions()) {
+            auto prims = make_bvh_primitives(objects);
+            build(objects, prims, 0, prims.size(), opts);
+        }
+
+        BVHNode(const std::vector<shared_ptr<Object>> &objects, std::vector<BVHPrimitive> &prims,
+                size_t start, size_t end, const BVHBuildOptions &opts)
+        {
+            build(objects, prims, start, end, opts);
         }
 
         bool intersect(const Ray &ri, Interval t_interval, Intersection &isect) const override {
+            RT_STAT(BVHNodes);
             if (!aabb.intersectP(ri, t_interval)) return false;
 
             // isect stores the closest intersection between ray & {left, right}.
             bool hit_left = left->intersect(ri, t_interval, isect);
-            bool hit_right = right->intersect(ri, Interval(t_interval.min, hit_left ? isect.distance : t_interval.max), isect);
+            bool hit_right = right && right->intersect(ri, Interval(t_interval.min, hit_left ? isect.distance : t_interval.max), isect);
 
             return hit_left || hit_right;
         }
 
         AABB get_AABB() const override { return aabb; }
 
+        // returns the tree's expected cost of tracing a random ray under the surface area heuristic
+        // (lower is better); compare trees built with different options over the same objects.
+        double sah_cost(const BVHBuildOptions &opts = BVHBuildOptions()) const {
+            return opts.traversal_cost + child_cost(left, opts) + (right ? child_cost(right, opts) : 0.0);
+        }
+
     private:
         shared_ptr<Object> left;
         shared_ptr<Object> right;
         AABB aabb;
 
-        static bool compare_AABB_pos(const shared_ptr<Object> &a, const shared_ptr<Object> &b,
-                                     int axis_index) 
+        void build(const std::vector<shared_ptr<Object>> &objects, std::vector<BVHPrimitive> &prims,
+                   size_t start, size_t end, const BVHBuildOptions &opts)
         {
-            double a_AABB_pos = a->get_AABB().Centriod()[axis_index];
-            double b_AABB_pos = b->get_AABB().Centriod()[axis_index];
-            return a_AABB_pos < b_AABB_pos;
-        }
+            aabb = AABB::empty;
+            for (size_t i = start; i < end; i++)
+                aabb = AABB(aabb, prims[i].aabb);
 
-        static bool compare_AABB_x(const shared_ptr<Object> &a, const shared_ptr<Object> &b) {
-            return compare_AABB_pos(a, b, 0);
-        }
+            size_t object_span = end - start;
 
-        static bool compare_AABB_y(const shared_ptr<Object> &a, const shared_ptr<Object> &b) {
-            return compare_AABB_pos(a, b, 1);
+            if (object_span == 1) {
+                left = objects[prims[start].index]; // right stays null, so the object is tested only once.
+            } else if (object_span == 2) {
+                left = objects[prims[start].index];
+                right = objects[prims[start+1].index];
+            } else {
+                auto middle = partition_bvh_primitives(prims, start, end, aabb, opts).middle;
+                left = make_shared<BVHNode>(objects, prims, start, middle, opts);
+                right = make_shared<BVHNode>(objects, prims, middle, end, opts);
+            }
         }
 
-        static bool compare_AABB_z(const shared_ptr<Object> &a, const shared_ptr<Object> &b) {
-            return compare_AABB_pos(a, b, 2);
+        // a child node costs its own SAH cost scaled by (A_child / A_node), the odds a ray through this
+        // node also passes through it; an object child costs C_isect.
+        double child_cost(const shared_ptr<Object> &child, const BVHBuildOptions &opts) const {
+            auto node = std::dynamic_pointer_cast<BVHNode>(child);
+            if (!node) return opts.intersection_cost;
+
+            double area = aabb.surface_area();
+            double ratio = (area > 0) ? node->aabb.surface_area() / area : 1.0;
+            return ratio * node->sah_cost(opts);
         }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -9,7 +9,7 @@ class ConstantMedium : public Object {
     public:
         ConstantMedium(shared_ptr<Object> boundary, double density, const Color &albedo) 
           : boundary(boundary), negInv_density(-1/density), 
-            phase_function(make_shared<Isotropic>(albedo)) 
+            phase_function(make_shared<Isotropic>(albedo))
         {}
 
         ConstantMedium(shared_ptr<Object> boundary, double density, shared_ptr<Texture> tex) 
@@ -20,10 +20,13 @@ class ConstantMedium : public Object {
         bool intersect(const Ray& ri, Interval t_interval, Intersection& isect)
         const override {
             Intersection isect1, isect2;
+            RT_STAT(MediumQueries);
 
+            RT_STAT(MediumBoundaryTests);
             if(!boundary->intersect(ri, Interval::universe, isect1))
                 return false;
 
+            RT_STAT(MediumBoundaryTests);
             if(!boundary->intersect(ri, Interval(isect1.distance+1e-4, infinity), isect2))
                 return false;
 
@@ -47,17 +50,26 @@ class ConstantMedium : public Object {
 
             isect.normal = Vector3d(1,0,0);    // these two are arbitrarily set because rays are randomly & uniformly
             isect.happend_outside = true; //  scattered in any directions for isotropic material.
-            isect.m = phase_function;
+            isect.set_geometric_normal(isect.normal);
+            isect.material = phase_function.handle;
 
             return true;
         }
 
         AABB get_AABB() const override { return boundary->get_AABB(); }
 
+        void register_materials(MaterialTable &table) override {
+            boundary->register_materials(table);
+            phase_function.register_in(table);
+        }
+
     private:
+        friend class SceneSnapshot;
+        ConstantMedium() {}
+
         shared_ptr<Object> boundary;
         double negInv_density;
-        shared_ptr<Material> phase_function;
+        MaterialRef phase_function;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,473 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "MappedFile.h"
+#include "Renderer.h"
+#include "Socket.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// renders spread over several processes, on one machine or many: a coordinator hands the tasks of a render
+// (tiles x sample chunks, see Renderer) to the workers that connect to it over TCP & merges the sums they
+// send back, exactly as Renderer::render merges its threads' sums, so the image is the same as a local
+// render's. a session goes:
+//
+//   worker -> Hello (protocol version, threads)   coordinator -> Job (the RenderJob)
+//   worker -> Ready (the render's header, see Renderer::Checkpoint) or Refused (why)
+//   coordinator -> Tasks (task ids)               worker -> Result (task id, task record) for each
+//   ...                                           coordinator -> Done
+//
+// every worker builds the scene once, from its own copy of the scene file. the job carries a hash of the
+// file and the Ready message the worker's render header, so a worker whose file or settings differ from the
+// coordinator's is turned away instead of mixing another render into the image.
+// note: messages are sent in host byte order, so all machines of a render must share it (& the Real type,
+//       which the header checks).
+
+enum class RenderMessage : uint32_t { Hello = 1, Job, Ready, Refused, Tasks, Result, Done };
+
+// what every process of a distributed render builds: a scene file, or a built-in scene, & the options that
+// override its settings.
+struct RenderJob {
+    std::string scene_file, builtin;
+    int32_t width = 0, spp = 0;
+    uint64_t scene_hash = 0; // hash_scene() on the coordinator.
+
+    // returns FNV-1a of the scene file's bytes (of the built-in scene's name), 0 if the file can't be read.
+    // note: files the scene file refers to (meshes, textures) aren't hashed; the render header's scene
+    //       fingerprint catches most differences there.
+    uint64_t hash_scene() const {
+        if (scene_file.empty()) return fnv1a(builtin.data(), builtin.size());
+        MappedFile file(scene_file);
+        return file.data() ? fnv1a(file.data(), file.size()) : 0;
+    }
+
+    Message message() const {
+        Message m(uint32_t(RenderMessage::Job));
+        return m.put(scene_file).put(builtin).put(width).put(spp).put(scene_hash);
+    }
+
+    bool read(const Message &m) {
+        MessageReader in(m);
+        return in.get(scene_file) && in.get(builtin) && in.get(width) && in.get(spp) && in.get(scene_hash);
+    }
+
+    private:
+        static uint64_t fnv1a(const char *p, size_t n) {
+            uint64_t h = 14695981039346656037ULL;
+            for (size_t i = 0; i < n; i++) h = (h ^ uint8_t(p[i])) * 1099511628211ULL;
+            return h;
+        }
+};
+
+// builds the scene of a job into scene & r; returns false (after printing why) if it can't.
+typedef std::function<bool(const RenderJob &, Scene &, Renderer &)> SceneBuilder;
+
+static const uint32_t render_protocol_version = 1;
+
+// the coordinator of a distributed render. it traces nothing itself: to use its machine too, start a
+// worker next to it.
+// tasks are handed out in batches, keeping up to two batches of a worker's thread count in flight, so a
+// worker never waits for its next batch. tasks of a worker that disconnects go back to the queue; once
+// the queue is empty, idle workers also get the tasks that have been running longest elsewhere, so a
+// slow or hung worker can't hold up the end of the render (whichever result comes first is kept; they're
+// the same anyway). a worker that sends nothing for worker_timeout seconds while it has tasks is dropped.
+class RenderCoordinator {
+    public:
+        double worker_timeout = 600;
+
+        RenderCoordinator(Renderer &r, Scene &scene, const RenderJob &job) : r(r), scene(scene), job(job) {}
+
+        // renders the scene with the workers that connect on port & writes the image like Renderer::render,
+        // checkpoints included. returns false if the render was stopped (or couldn't start) first.
+        bool render(int port) {
+            std::string error;
+            Socket listener = Socket::listen(port, error);
+            if (!listener.valid()) {
+                std::cerr << "ERROR: Could not listen on port " << port << ": " << error << ".\n";
+                return false;
+            }
+
+            scene.initialize_camera();
+            plan = r.make_plan(scene);
+            partial.assign(size_t(plan.n_chunks) * plan.image_w * plan.image_h, Color());
+            pixel_spp.assign(size_t(plan.image_w) * plan.image_h, r.adaptive ? 0 : r.spp);
+            done.assign(plan.n_tasks, 0);
+            copies.assign(plan.n_tasks, 0);
+            started.assign(plan.n_tasks, Clock::time_point());
+
+            if (r.resume && !r.checkpoint_file.empty()) {
+                size_t n_resumed = r.read_checkpoint(plan, partial, pixel_spp, done);
+                if (n_resumed > 0)
+                    std::cout << "Resumed " << n_resumed << " of " << plan.n_tasks << " tasks from '" << r.checkpoint_file << "'\n";
+            }
+            for (size_t task = 0; task < plan.n_tasks; task++) {
+                if (done[task]) n_done++;
+                else pending.push_back(task);
+            }
+
+            std::cout << "Coordinating on port " << port << ": " << plan.n_tasks << " tasks (" << plan.tiles.size()
+                      << " tiles, " << plan.n_chunks << " sample chunks)\n";
+
+            auto last_checkpoint = Clock::now();
+            std::vector<const Socket*> sockets;
+            std::vector<char> readable;
+            while (n_done < plan.n_tasks && !Renderer::stop_flag()) {
+                sockets.assign(1, &listener);
+                for (auto &w : workers) sockets.push_back(&w.socket);
+                Socket::poll(sockets, readable, 200);
+
+                if (readable[0]) accept(listener);
+                for (size_t i = 0; i < workers.size() && i + 1 < readable.size(); i++)
+                    if (readable[i + 1]) receive(workers[i]);
+
+                auto now = Clock::now();
+                for (auto &w : workers) {
+                    if (w.socket.valid() && !w.running.empty() && seconds(w.last_heard, now) > worker_timeout)
+                        drop(w, "sent nothing for too long");
+                }
+                workers.erase(std::remove_if(workers.begin(), workers.end(), [](const Worker &w) { return !w.socket.valid(); }),
+                              workers.end());
+
+                for (auto &w : workers) if (w.ready) hand_out(w);
+
+                if (!r.checkpoint_file.empty() && seconds(last_checkpoint, now) >= r.checkpoint_interval) {
+                    r.write_checkpoint(plan, partial, pixel_spp, done, done_mutex);
+                    last_checkpoint = now;
+                }
+            }
+
+            for (auto &w : workers) {
+                if (n_done == plan.n_tasks) w.socket.send(Message(uint32_t(RenderMessage::Done)));
+                w.socket.close();
+            }
+            if (n_done == plan.n_tasks) {
+                UpdateProgress(1.);
+                std::cout << "\n";
+                for (const auto &w : workers)
+                    if (w.ready) std::cout << w.name << " traced " << w.tasks_done << " tasks\n";
+            }
+
+            if (n_done < plan.n_tasks) {
+                std::cout << "\nRender stopped with " << n_done << " of " << plan.n_tasks << " tasks done";
+                if (!r.checkpoint_file.empty() && r.write_checkpoint(plan, partial, pixel_spp, done, done_mutex))
+                    std::cout << ", checkpoint written to '" << r.checkpoint_file << "'";
+                std::cout << ".\n";
+                return false;
+            }
+
+            if (r.finish(plan, partial, pixel_spp) && !r.checkpoint_file.empty())
+                std::remove(r.checkpoint_file.c_str());
+            return true;
+        }
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        struct Worker {
+            Socket socket;
+            std::string name;
+            int threads = 1;
+            bool ready = false;             // sent a matching Ready, takes tasks.
+            std::vector<size_t> running;    // tasks handed out & not returned yet.
+            size_t tasks_done = 0;          // tasks it finished first.
+            Clock::time_point last_heard;
+        };
+
+        Renderer &r;
+        Scene &scene;
+        RenderJob job;
+
+        Renderer::RenderPlan plan;
+        std::vector<Color> partial;
+        std::vector<int> pixel_spp;
+        std::vector<char> done;              // per task.
+        std::vector<int> copies;             // per task: workers tracing it right now.
+        std::vector<Clock::time_point> started; // per task: when it was first handed out.
+        std::mutex done_mutex;               // write_checkpoint() wants one; the coordinator is single-threaded.
+        std::deque<size_t> pending;          // tasks that aren't done nor running, in tile order.
+        size_t n_done = 0;
+
+        std::vector<Worker> workers;
+        int n_joined = 0;
+
+        static double seconds(Clock::time_point from, Clock::time_point to) {
+            return std::chrono::duration<double>(to - from).count();
+        }
+
+        void accept(const Socket &listener) {
+            Worker w;
+            w.socket = listener.accept();
+            if (!w.socket.valid()) return;
+            w.name = "Worker " + std::to_string(++n_joined) + " (" + w.socket.peer() + ")";
+            w.last_heard = Clock::now();
+            workers.push_back(std::move(w));
+        }
+
+        void receive(Worker &w) {
+            std::vector<Message> messages;
+            if (!w.socket.poll_receive(messages)) {
+                drop(w, "disconnected");
+                return;
+            }
+            w.last_heard = Clock::now();
+            for (const auto &m : messages) {
+                if (!w.socket.valid()) return;
+                handle(w, m);
+            }
+        }
+
+        void handle(Worker &w, const Message &m) {
+            MessageReader in(m);
+            switch (RenderMessage(m.type)) {
+                case RenderMessage::Hello: {
+                    uint32_t version;
+                    if (!in.get(version) || !in.get(w.threads) || version != render_protocol_version)
+                        return drop(w, "speaks another protocol version");
+                    w.threads = std::max(1, w.threads);
+                    if (!w.socket.send(job.message())) drop(w, "disconnected");
+                    return;
+                }
+                case RenderMessage::Ready:
+                    if (m.payload.size() != sizeof(plan.header) || std::memcmp(m.payload.data(), &plan.header, sizeof(plan.header)) != 0)
+                        return drop(w, "set up another render (scene, settings or build differ)");
+                    w.ready = true;
+                    std::cout << "\n" << w.name << " joined with " << w.threads << " threads\n";
+                    return;
+                case RenderMessage::Refused: {
+                    std::string why;
+                    in.get(why);
+                    return drop(w, "refused the job: " + why);
+                }
+                case RenderMessage::Result: {
+                    uint64_t task = 0;
+                    size_t size = 0;
+                    const char *record = (in.get(task) && task < plan.n_tasks) ? in.rest(size) : nullptr;
+                    if (!record) return drop(w, "sent a bad result");
+                    auto it = std::find(w.running.begin(), w.running.end(), size_t(task));
+                    if (it == w.running.end() || size != r.task_record_size(plan, task))
+                        return drop(w, "sent a bad result");
+                    w.running.erase(it);
+                    copies[task]--;
+                    if (!done[task]) {
+                        r.load_task_record(plan, task, record, partial, pixel_spp);
+                        done[task] = 1;
+                        n_done++;
+                        w.tasks_done++;
+                        UpdateProgress(n_done / double(plan.n_tasks));
+                    }
+                    return;
+                }
+                default:
+                    return drop(w, "sent an unknown message");
+            }
+        }
+
+        // closes w's connection (it's removed from workers later) & queues its tasks again.
+        void drop(Worker &w, const std::string &why) {
+            size_t n_requeued = 0;
+            for (size_t task : w.running) {
+                if (--copies[task] == 0 && !done[task]) {
+                    pending.push_front(task);
+                    n_requeued++;
+                }
+            }
+            w.running.clear();
+            w.socket.close();
+
+            std::cout << "\n" << w.name << " " << why;
+            if (w.ready) std::cout << ", it traced " << w.tasks_done << " tasks";
+            if (n_requeued > 0) std::cout << ", " << n_requeued << " of its tasks are handed out again";
+            std::cout << "\n";
+        }
+
+        // sends w batches of tasks until two are in flight.
+        void hand_out(Worker &w) {
+            while (w.socket.valid() && w.running.size() <= size_t(w.threads)) {
+                std::vector<uint64_t> batch;
+                while (batch.size() < size_t(w.threads) && !pending.empty()) {
+                    size_t task = pending.front();
+                    pending.pop_front();
+                    if (!done[task]) batch.push_back(task);
+                }
+
+                // nothing queued: help with what others have been tracing longest, least-helped first.
+                if (batch.empty() && w.running.empty()) {
+                    std::vector<size_t> stragglers;
+                    for (size_t task = 0; task < plan.n_tasks; task++)
+                        if (!done[task] && copies[task] > 0) stragglers.push_back(task);
+                    std::sort(stragglers.begin(), stragglers.end(), [&](size_t a, size_t b) {
+                        return copies[a] != copies[b] ? copies[a] < copies[b] : started[a] < started[b];
+                    });
+                    if (stragglers.size() > size_t(w.threads)) stragglers.resize(size_t(w.threads));
+                    batch.assign(stragglers.begin(), stragglers.end());
+                }
+                if (batch.empty()) return;
+
+                auto now = Clock::now();
+                Message m(uint32_t(RenderMessage::Tasks));
+                m.put(uint32_t(batch.size()));
+                for (uint64_t task : batch) {
+                    m.put(task);
+                    if (copies[task]++ == 0) started[task] = now;
+                    w.running.push_back(size_t(task));
+                }
+                if (!w.socket.send(m)) drop(w, "disconnected");
+            }
+        }
+};
+
+// a worker of a distributed render, see RenderCoordinator.
+class RenderWorker {
+    public:
+        // connects to the coordinator at address (host:port; it's retried for connect_timeout seconds, so
+        // workers can be started first), builds the job's scene with build & traces the tasks it's handed on
+        // n_threads threads (0: every hardware thread) until the render is done. returns false if it fails or
+        // is stopped (Renderer::request_stop) first; the coordinator hands its tasks to others then.
+        static bool serve(const std::string &address, int n_threads, const SceneBuilder &build, double connect_timeout = 30) {
+            size_t colon = address.rfind(':');
+            if (colon == std::string::npos || colon + 1 == address.size()) {
+                std::cerr << "ERROR: Expected host:port, got '" << address << "'.\n";
+                return false;
+            }
+            std::string host = address.substr(0, colon);
+            if (host.size() > 2 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+            int port = std::atoi(address.c_str() + colon + 1);
+
+            std::string error;
+            Socket socket;
+            auto start = std::chrono::steady_clock::now();
+            while (!(socket = Socket::connect(host, port, error)).valid()) {
+                if (Renderer::stop_flag() || std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() >= connect_timeout) {
+                    std::cerr << "ERROR: Could not connect to " << address << ": " << error << ".\n";
+                    return false;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            }
+
+            ThreadPool pool(n_threads);
+            Message m(uint32_t(RenderMessage::Hello));
+            if (!socket.send(m.put(render_protocol_version).put(int32_t(pool.size()))) || !socket.receive(m) ||
+                RenderMessage(m.type) != RenderMessage::Job)
+                return lost(address);
+
+            RenderJob job;
+            if (!job.read(m)) return lost(address);
+            std::cout << "Connected to " << address << ", scene " << (job.scene_file.empty() ? job.builtin : job.scene_file) << "\n";
+
+            Scene scene;
+            Renderer r;
+            std::string refused;
+            if (job.hash_scene() != job.scene_hash) refused = "its copy of the scene differs from the coordinator's";
+            else if (!build(job, scene, r)) refused = "it couldn't build the scene";
+            if (!refused.empty()) {
+                std::cerr << "ERROR: Refused the render, " << refused << ".\n";
+                socket.send(Message(uint32_t(RenderMessage::Refused)).put(refused));
+                return false;
+            }
+
+            scene.initialize_camera();
+            scene.register_materials();
+            auto plan = r.make_plan(scene);
+            if (!socket.send(Message(uint32_t(RenderMessage::Ready)).put(&plan.header, sizeof(plan.header))))
+                return lost(address);
+
+            // this thread receives & queues tasks while a tracer thread works through the queue, so the next
+            // batch is always at hand, & a Done (the render finished without the tasks still running here)
+            // stops the tracer at once. results go out as soon as each task is done.
+            std::deque<size_t> queue;
+            std::mutex queue_mutex, send_mutex;
+            std::condition_variable queued;
+            bool closing = false, connected = true;
+            size_t n_traced = 0;
+
+            std::thread tracer([&] {
+                std::vector<std::vector<Color>> worker_accum(pool.size());
+                std::vector<int> pixel_spp(size_t(plan.image_w) * plan.image_h, 0);
+                while (true) {
+                    std::vector<size_t> batch;
+                    {
+                        std::unique_lock<std::mutex> lock(queue_mutex);
+                        queued.wait(lock, [&] { return closing || !queue.empty(); });
+                        if (closing) return;
+                        batch.assign(queue.begin(), queue.end());
+                        queue.clear();
+                    }
+
+                    pool.parallel_for(batch.size(), [&](size_t k, int worker) {
+                        size_t task = batch[k];
+                        auto &accum = worker_accum[worker];
+                        if (!r.trace_task(scene, plan, task, accum, pixel_spp)) return;
+
+                        const Renderer::Tile &tile = r.task_tile(plan, task);
+                        Message result(uint32_t(RenderMessage::Result));
+                        result.payload.reserve(sizeof(uint64_t) + r.task_record_size(plan, task));
+                        result.put(uint64_t(task)).put(accum.data(), accum.size() * sizeof(Color));
+                        if (r.adaptive)
+                            for (auto j = 0; j < tile.h; j++)
+                                result.put(&pixel_spp[size_t(tile.y + j) * plan.image_w + tile.x], tile.w * sizeof(int));
+
+                        std::lock_guard<std::mutex> lock(send_mutex);
+                        connected = connected && socket.send(result);
+                        n_traced++;
+                    });
+                }
+            });
+
+            bool finished = false, failed = false;
+            std::vector<const Socket*> sockets(1, &socket);
+            std::vector<char> readable;
+            while (!Renderer::stop_flag()) {
+                Socket::poll(sockets, readable, 200);
+                if (!readable[0]) continue;
+                if (!socket.receive(m)) { failed = true; break; }
+                if (RenderMessage(m.type) == RenderMessage::Done) { finished = true; break; }
+
+                MessageReader in(m);
+                uint32_t n;
+                std::vector<uint64_t> batch;
+                if (RenderMessage(m.type) != RenderMessage::Tasks || !in.get(n) || n > plan.n_tasks) { failed = true; break; }
+                batch.resize(n);
+                for (auto &task : batch)
+                    if (!in.get(task) || task >= plan.n_tasks) failed = true;
+                if (failed) break;
+
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                queue.insert(queue.end(), batch.begin(), batch.end());
+                queued.notify_one();
+            }
+
+            // stop the tracer: the render is done, or this worker's tasks go to others.
+            Renderer::request_stop();
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                closing = true;
+                queued.notify_one();
+            }
+            tracer.join();
+
+            if (failed || (!finished && !connected)) return lost(address);
+            std::cout << (finished ? "Render done" : "Stopped") << ", traced " << n_traced << " tasks\n";
+            return finished;
+        }
+
+    private:
+        static bool lost(const std::string &address) {
+            std::cerr << "ERROR: Lost the coordinator at " << address << ".\n";
+            return false;
+        }
+};
+
+#endif
@@ -0,0 +1,297 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define RT_FRAMEBUFFER_SSE 1
+    #include <emmintrin.h>
+#else
+    #define RT_FRAMEBUFFER_SSE 0
+#endif
+
+// how radiance is mapped into [0, 1] (before gamma) for 8-bit output.
+enum class Tonemap {
+    Clamp,   // radiance above 1 is clipped.
+    Reinhard // x / (1 + x): highlights roll off instead of clipping.
+};
+
+// writes a file through one large buffer, so an image takes a handful of writes however it's encoded.
+// the file is written to "<filename>.tmp" & renamed over filename once complete, so a reader never sees a
+// half-written image (e.g. while a long render rewrites it).
+class BufferedWriter {
+    public:
+        explicit BufferedWriter(const std::string &filename)
+          : filename(filename), file(std::fopen((filename + ".tmp").c_str(), "wb"))
+        {
+            buffer.reserve(buffer_size);
+        }
+
+        ~BufferedWriter() { if (file) close(); }
+
+        BufferedWriter(const BufferedWriter &) = delete;
+        BufferedWriter &operator=(const BufferedWriter &) = delete;
+
+        void write(const void *data, size_t n) {
+            const char *p = static_cast<const char*>(data);
+            written += n;
+            while (n > 0) {
+                size_t k = std::min(n, buffer_size - buffer.size());
+                buffer.insert(buffer.end(), p, p + k);
+                p += k, n -= k;
+                if (buffer.size() == buffer_size) flush();
+            }
+        }
+
+        void write(const std::string &text) { write(text.data(), text.size()); }
+
+        // returns the bytes written so far, i.e. the file offset of the next write.
+        uint64_t position() const { return written; }
+
+        // little-endian integers & floats, as the binary formats store them.
+        void write_u32(uint32_t v) {
+            unsigned char b[4] = { (unsigned char)v, (unsigned char)(v >> 8), (unsigned char)(v >> 16), (unsigned char)(v >> 24) };
+            write(b, 4);
+        }
+        void write_u64(uint64_t v) { write_u32(uint32_t(v)); write_u32(uint32_t(v >> 32)); }
+        void write_f32(float f) { uint32_t v; std::memcpy(&v, &f, 4); write_u32(v); }
+        void write_f32s(const float *f, size_t n) {
+            if (little_endian()) write(f, n * sizeof(float));
+            else for (size_t i = 0; i < n; i++) write_f32(f[i]);
+        }
+
+        static bool little_endian() {
+            const uint32_t one = 1;
+            unsigned char first;
+            std::memcpy(&first, &one, 1);
+            return first == 1;
+        }
+
+        // flushes & renames the file into place. returns false (after printing an error) if any write failed.
+        bool close() {
+            flush();
+            bool ok = file && !failed;
+            if (file && std::fclose(file) != 0) ok = false;
+            file = nullptr;
+            if (ok) ok = std::rename((filename + ".tmp").c_str(), filename.c_str()) == 0;
+            if (!ok) {
+                std::remove((filename + ".tmp").c_str());
+                std::cerr << "ERROR: Could not write file '" << filename << "'.\n";
+            }
+            return ok;
+        }
+
+    private:
+        static const size_t buffer_size = size_t(1) << 20;
+
+        std::string filename;
+        FILE *file;
+        std::vector<char> buffer;
+        uint64_t written = 0;
+        bool failed = false;
+
+        void flush() {
+            if (file && !buffer.empty() && std::fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size())
+                failed = true;
+            buffer.clear();
+        }
+};
+
+// the image a render accumulates: per pixel, the sum of its samples' radiance (in float) & their count,
+// so the mean radiance is kept unclipped and more samples can be added to a pixel later.
+// write() picks the format from the file's extension: .ppm (8-bit: tonemapped & gamma corrected),
+// .pfm or .exr (the 32-bit float mean radiance, uncompressed).
+class Framebuffer {
+    public:
+        int width = 0, height = 0;
+
+        Framebuffer() {}
+        Framebuffer(int width, int height)
+          : width(width), height(height), sums(size_t(width) * height * 3, 0.0f), counts(size_t(width) * height, 0) {}
+
+        // adds n samples whose radiance adds up to sum to pixel (x, y).
+        void add(int x, int y, const Color &sum, uint32_t n) {
+            size_t p = size_t(y) * width + x;
+            sums[3*p]     += float(sum.x());
+            sums[3*p + 1] += float(sum.y());
+            sums[3*p + 2] += float(sum.z());
+            counts[p] += n;
+        }
+
+        uint32_t count(int x, int y) const { return counts[size_t(y) * width + x]; }
+
+        // returns pixel (x, y)'s mean radiance, black before it has samples.
+        Color radiance(int x, int y) const {
+            float rgb[3];
+            mean(size_t(y) * width + x, 1, rgb);
+            return Color(rgb[0], rgb[1], rgb[2]);
+        }
+
+        // writes the mean radiance of n pixels from pixel p on (r, g, b per pixel) into rgb.
+        void mean(size_t p, size_t n, float *rgb) const {
+            for (size_t k = 0; k < n; k++) {
+                float scale = 1.0f / float(std::max(counts[p + k], 1u));
+                for (int i = 0; i < 3; i++) rgb[3*k + i] = sums[3*(p + k) + i] * scale;
+            }
+        }
+
+        // returns the 8-bit image (r, g, b per pixel, top row first): mean radiance times exposure,
+        // tonemapped, gamma corrected (gamma 2) & quantized in one pass over the pixels, 4 at a time with SSE.
+        std::vector<unsigned char> to_8bit(Tonemap tonemap = Tonemap::Clamp, float exposure = 1.0f) const {
+            std::vector<unsigned char> rgb(sums.size());
+            if (tonemap == Tonemap::Reinhard) tonemap_pass<true>(rgb.data(), exposure);
+            else tonemap_pass<false>(rgb.data(), exposure);
+            return rgb;
+        }
+
+        // writes the image to filename; returns false after printing an error if it can't be written.
+        bool write(const std::string &filename, Tonemap tonemap = Tonemap::Clamp, float exposure = 1.0f) const {
+            std::string ext = filename.substr(std::min(filename.size(), filename.rfind('.') + 1));
+            for (auto &ch : ext) ch = char(std::tolower(static_cast<unsigned char>(ch)));
+
+            if (ext == "pfm") return write_pfm(filename);
+            if (ext == "exr") return write_exr(filename);
+            if (ext != "ppm")
+                std::cerr << "WARNING: Unknown image format of '" << filename << "', writing a PPM.\n";
+            return write_ppm(filename, tonemap, exposure);
+        }
+
+    private:
+        std::vector<float> sums;       // r, g, b per pixel, top row first.
+        std::vector<uint32_t> counts;
+
+        // note: the SSE & scalar paths round identically, and both clamp a NaN to black.
+        template <bool reinhard>
+        void tonemap_pass(unsigned char *out, float exposure) const {
+            const float *s = sums.data();
+            const uint32_t *c = counts.data();
+            size_t n = counts.size(), p = 0;
+
+#if RT_FRAMEBUFFER_SSE
+            const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+            const __m128 lo = _mm_set1_ps(0.001f), hi = _mm_set1_ps(0.999f), to_byte = _mm_set1_ps(255.999f);
+            auto quantize = [&](__m128 v) {
+                if (reinhard) v = _mm_div_ps(v, _mm_add_ps(one, v));
+                v = _mm_sqrt_ps(_mm_max_ps(v, zero));
+                v = _mm_min_ps(_mm_max_ps(v, lo), hi);
+                return _mm_cvttps_epi32(_mm_mul_ps(v, to_byte));
+            };
+
+            // 4 pixels are 12 floats: 3 vectors, with each pixel's scale spread over its 3 lanes.
+            for (; p + 4 <= n; p += 4) {
+                // note: counts stay below 2^31, so the signed conversion is exact.
+                __m128 n_samples = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(c + p)));
+                __m128 sc = _mm_div_ps(_mm_set1_ps(exposure), _mm_max_ps(n_samples, one));
+
+                __m128i q0 = quantize(_mm_mul_ps(_mm_loadu_ps(s + 3*p),     _mm_shuffle_ps(sc, sc, _MM_SHUFFLE(1, 0, 0, 0))));
+                __m128i q1 = quantize(_mm_mul_ps(_mm_loadu_ps(s + 3*p + 4), _mm_shuffle_ps(sc, sc, _MM_SHUFFLE(2, 2, 1, 1))));
+                __m128i q2 = quantize(_mm_mul_ps(_mm_loadu_ps(s + 3*p + 8), _mm_shuffle_ps(sc, sc, _MM_SHUFFLE(3, 3, 3, 2))));
+
+                alignas(16) unsigned char bytes[16];
+                _mm_store_si128(reinterpret_cast<__m128i*>(bytes),
+                                _mm_packus_epi16(_mm_packs_epi32(q0, q1), _mm_packs_epi32(q2, q2)));
+                std::memcpy(out + 3*p, bytes, 12);
+            }
+#endif
+
+            for (; p < n; p++) {
+                float scale = exposure / float(std::max(c[p], 1u));
+                for (int k = 0; k < 3; k++) {
+                    float v = s[3*p + k] * scale;
+                    if (reinhard) v = v / (1.0f + v);
+                    v = std::sqrt(std::max(0.0f, v));
+                    v = std::min(0.999f, std::max(0.001f, v));
+                    out[3*p + k] = (unsigned char)(255.999f * v);
+                }
+            }
+        }
+
+        bool write_ppm(const std::string &filename, Tonemap tonemap, float exposure) const {
+            BufferedWriter out(filename);
+            out.write("P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n");
+            auto rgb = to_8bit(tonemap, exposure);
+            out.write(rgb.data(), rgb.size());
+            return out.close();
+        }
+
+        // portable float map: r, g, b floats per pixel, bottom row first; a negative scale means little-endian.
+        bool write_pfm(const std::string &filename) const {
+            BufferedWriter out(filename);
+            out.write("PF\n" + std::to_string(width) + " " + std::to_string(height) + "\n-1.0\n");
+            std::vector<float> row(size_t(width) * 3);
+            for (int y = height - 1; y >= 0; y--) {
+                mean(size_t(y) * width, size_t(width), row.data());
+                out.write_f32s(row.data(), row.size());
+            }
+            return out.close();
+        }
+
+        // OpenEXR: a scanline image with B, G & R float channels and no compression, one scanline per block.
+        bool write_exr(const std::string &filename) const {
+            BufferedWriter out(filename);
+            out.write_u32(20000630); // magic number.
+            out.write_u32(2);        // version 2, single-part scanline image.
+
+            auto attribute = [&](const char *name, const char *type, uint32_t size) {
+                out.write(name, std::strlen(name) + 1);
+                out.write(type, std::strlen(type) + 1);
+                out.write_u32(size);
+            };
+            const unsigned char zero = 0;
+
+            // channels are listed (& stored) in alphabetical order.
+            attribute("channels", "chlist", 3 * (2 + 16) + 1);
+            for (const char *channel : { "B", "G", "R" }) {
+                out.write(channel, 2);
+                out.write_u32(2);                            // pixel type: float.
+                out.write_u32(0);                            // pLinear & reserved.
+                out.write_u32(1); out.write_u32(1);          // x & y sampling.
+            }
+            out.write(&zero, 1);
+
+            attribute("compression", "compression", 1);
+            out.write(&zero, 1);                             // none.
+            attribute("dataWindow", "box2i", 16);
+            out.write_u32(0); out.write_u32(0); out.write_u32(uint32_t(width - 1)); out.write_u32(uint32_t(height - 1));
+            attribute("displayWindow", "box2i", 16);
+            out.write_u32(0); out.write_u32(0); out.write_u32(uint32_t(width - 1)); out.write_u32(uint32_t(height - 1));
+            attribute("lineOrder", "lineOrder", 1);
+            out.write(&zero, 1);                             // increasing y.
+            attribute("pixelAspectRatio", "float", 4);
+            out.write_f32(1.0f);
+            attribute("screenWindowCenter", "v2f", 8);
+            out.write_f32(0.0f); out.write_f32(0.0f);
+            attribute("screenWindowWidth", "float", 4);
+            out.write_f32(1.0f);
+            out.write(&zero, 1);                             // end of header.
+
+            // the offset table points at each scanline block: its y, its size & the channel rows.
+            uint64_t block_size = 8 + uint64_t(width) * 3 * 4;
+            uint64_t first_block = out.position() + uint64_t(height) * 8;
+            for (int y = 0; y < height; y++) out.write_u64(first_block + uint64_t(y) * block_size);
+
+            std::vector<float> row(size_t(width) * 3), planes(size_t(width) * 3);
+            for (int y = 0; y < height; y++) {
+                mean(size_t(y) * width, size_t(width), row.data());
+                for (int x = 0; x < width; x++) {
+                    planes[x]           = row[3*x + 2];
+                    planes[width + x]   = row[3*x + 1];
+                    planes[2*width + x] = row[3*x];
+                }
+                out.write_u32(uint32_t(y));
+                out.write_u32(uint32_t(width) * 3 * 4);
+                out.write_f32s(planes.data(), planes.size());
+            }
+            return out.close();
+        }
+};
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef HANDLE_TABLE_H
+#define HANDLE_TABLE_H
+
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// owns shared objects (e.g. a scene's materials) & hands out 32-bit handles to them, so whatever refers to
+// an object per hit (e.g. a hit record) can copy a plain integer instead of a shared_ptr.
+// adding the same object twice returns its first handle.
+// note: add() locks, lookups don't; register everything while setting up the scene, before rendering.
+template <typename T>
+class HandleTable {
+    public:
+        uint32_t add(std::shared_ptr<T> item) {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = handles.find(item.get());
+            if (it != handles.end()) return it->second;
+
+            uint32_t handle = uint32_t(items.size());
+            handles[item.get()] = handle;
+            items.push_back(std::move(item));
+            return handle;
+        }
+
+        const T &operator[](uint32_t handle) const {
+            assert(handle < items.size() && "handle of another table");
+            return *items[handle];
+        }
+
+        size_t size() const { return items.size(); }
+
+    private:
+        std::vector<std::shared_ptr<T>> items;
+        std::unordered_map<const T*, uint32_t> handles;
+        std::mutex mutex;
+};
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include "Framebuffer.h"
+#include "Stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// the traversal cost of every pixel of a render (see TraceCost), summed over its samples. it's only kept
+// in RT_STATS builds; otherwise every method does nothing & add() compiles away.
+class CostImage {
+    public:
+        // starts an empty image of w x h pixels.
+        void reset(int w, int h) {
+#ifdef RT_STATS
+            width = w, height = h;
+            pixels = std::make_shared<Pixels>(size_t(w) * h);
+#else
+            (void)w; (void)h;
+#endif
+        }
+
+        // adds the cost of one sample of pixel p. safe to call from any thread: pixels split into sample
+        // chunks are traced by several at once.
+        void add(size_t p, const TraceCost &cost) const {
+#ifdef RT_STATS
+            if (!pixels) return; // e.g. a distributed worker, see Renderer::heatmap_file.
+            pixels->nodes[p].fetch_add(cost.nodes, std::memory_order_relaxed);
+            pixels->tests[p].fetch_add(cost.tests, std::memory_order_relaxed);
+            pixels->samples[p].fetch_add(1, std::memory_order_relaxed);
+#else
+            (void)p; (void)cost;
+#endif
+        }
+
+        // writes the mean cost per sample as two images named after filename, <stem>.nodes<ext> (BVH nodes
+        // visited) & <stem>.tests<ext> (primitives tested). a .ppm is false color, from black (no cost) to
+        // white (the 99th percentile of the pixels' costs & above); .pfm & .exr keep the costs themselves.
+        // returns false if an image couldn't be written.
+        bool write(const std::string &filename) const {
+#ifdef RT_STATS
+            if (!pixels) return false;
+            size_t dot = filename.find_last_of('.'), slash = filename.find_last_of("/\\");
+            if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) dot = filename.size();
+            std::string stem = filename.substr(0, dot), ext = filename.substr(dot);
+
+            return write_image(stem + ".nodes" + ext, pixels->nodes, "BVH nodes") &
+                   write_image(stem + ".tests" + ext, pixels->tests, "primitive tests");
+#else
+            (void)filename;
+            return false;
+#endif
+        }
+
+    private:
+#ifdef RT_STATS
+        struct Pixels {
+            std::vector<std::atomic<uint64_t>> nodes, tests, samples;
+
+            explicit Pixels(size_t n) : nodes(n), tests(n), samples(n) {
+                for (size_t p = 0; p < n; p++) nodes[p] = 0, tests[p] = 0, samples[p] = 0;
+            }
+        };
+
+        int width = 0, height = 0;
+        shared_ptr<Pixels> pixels; // shared, so renderers stay copyable.
+
+        bool write_image(const std::string &filename, const std::vector<std::atomic<uint64_t>> &cost, const char *what) const {
+            std::vector<float> mean(cost.size());
+            for (size_t p = 0; p < cost.size(); p++) {
+                uint64_t n = pixels->samples[p];
+                mean[p] = n ? float(double(cost[p]) / n) : 0.0f;
+            }
+
+            std::vector<float> sorted(mean);
+            size_t k = std::min(sorted.size() - 1, sorted.size() * 99 / 100);
+            std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+            float scale = std::max(sorted[k], 1e-6f);
+            bool false_color = filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".ppm") == 0;
+
+            Framebuffer image(width, height);
+            for (int j = 0; j < height; j++) {
+                for (int i = 0; i < width; i++) {
+                    float v = mean[size_t(j) * width + i];
+                    image.add(i, j, false_color ? ramp(v / scale) : Color(v, v, v), 1);
+                }
+            }
+            if (!image.write(filename)) return false;
+            std::cout << "Heatmap of " << what << " per sample written to '" << filename << "'";
+            if (false_color) std::cout << " (white: " << scale << " & above)";
+            std::cout << "\n";
+            return true;
+        }
+
+        // maps x in [0, 1] to black, purple, red, orange & white, squared so the 8-bit output's gamma 2
+        // gives back those colors.
+        static Color ramp(float x) {
+            static const float stops[5][3] = {
+                { 0.00f, 0.00f, 0.00f }, { 0.34f, 0.06f, 0.43f }, { 0.85f, 0.26f, 0.30f },
+                { 0.99f, 0.65f, 0.04f }, { 1.00f, 1.00f, 1.00f }
+            };
+            x = std::min(std::max(x, 0.0f), 1.0f) * 4;
+            int s = std::min(int(x), 3);
+            float f = x - s, c[3];
+            for (int a = 0; a < 3; a++) {
+                c[a] = stops[s][a] + (stops[s+1][a] - stops[s][a]) * f;
+                c[a] *= c[a];
+            }
+            return Color(c[0], c[1], c[2]);
+        }
+#endif
+};
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "AABB.h"
+#include "BVH.h"
+#include "Object.h"
+
+// an affine transform, i.e. a 4x4 matrix whose bottom row is (0 0 0 1); only the top 3 rows are stored.
+// the inverse is computed once on construction, so mapping rays back costs no more than mapping points.
+class Transform {
+    public:
+        Transform() : Transform(identity_rows()) {}
+
+        static Transform translate(const Vector3d &offset) {
+            Rows m = identity_rows();
+            for (int i = 0; i < 3; i++) m.r[i][3] = offset[i];
+            return Transform(m);
+        }
+
+        // rotation about the y axis, by `angle` degrees (same sense as RotateY).
+        static Transform rotate_y(double angle) {
+            auto theta = degrees_to_radians(angle);
+            Rows m = identity_rows();
+            m.r[0][0] =  std::cos(theta); m.r[0][2] = std::sin(theta);
+            m.r[2][0] = -std::sin(theta); m.r[2][2] = std::cos(theta);
+            return Transform(m);
+        }
+
+        static Transform scale(const Vector3d &s) {
+            Rows m = identity_rows();
+            for (int i = 0; i < 3; i++) m.r[i][i] = s[i];
+            return Transform(m);
+        }
+
+        // (a * b) applies b first, then a.
+        friend Transform operator*(const Transform &a, const Transform &b) {
+            Rows m;
+            for (int i = 0; i < 3; i++) {
+                for (int j = 0; j < 4; j++) {
+                    m.r[i][j] = (j == 3) ? a.m.r[i][3] : 0.0;
+                    for (int k = 0; k < 3; k++) m.r[i][j] += a.m.r[i][k] * b.m.r[k][j];
+                }
+            }
+            return Transform(m);
+        }
+
+        Point3d  point(const Point3d &p)           const { return apply(m, p, 1.0); }
+        Vector3d vector(const Vector3d &v)         const { return apply(m, v, 0.0); }
+        Point3d  inverse_point(const Point3d &p)   const { return apply(inv, p, 1.0); }
+        Vector3d inverse_vector(const Vector3d &v) const { return apply(inv, v, 0.0); }
+
+        // normals transform by the inverse transpose, so they stay perpendicular to transformed surfaces.
+        Vector3d normal(const Vector3d &n) const {
+            return Vector3d(inv.r[0][0]*n[0] + inv.r[1][0]*n[1] + inv.r[2][0]*n[2],
+                            inv.r[0][1]*n[0] + inv.r[1][1]*n[1] + inv.r[2][1]*n[2],
+                            inv.r[0][2]*n[0] + inv.r[1][2]*n[1] + inv.r[2][2]*n[2]);
+        }
+
+        // returns the box bounding the 8 transformed corners of aabb.
+        AABB bounds(const AABB &aabb) const {
+            Point3d min( infinity,  infinity,  infinity);
+            Point3d max(-infinity, -infinity, -infinity);
+            for (int c = 0; c < 8; c++) {
+                Point3d corner(
+                    (c & 1) ? aabb.x.max : aabb.x.min,
+                    (c & 2) ? aabb.y.max : aabb.y.min,
+                    (c & 4) ? aabb.z.max : aabb.z.min
+                );
+                Point3d p = point(corner);
+                for (int dim = 0; dim < 3; dim++) {
+                    min[dim] = std::fmin(min[dim], p[dim]);
+                    max[dim] = std::fmax(max[dim], p[dim]);
+                }
+            }
+            return AABB(min, max);
+        }
+
+    private:
+        friend class SceneSnapshot;
+
+        struct Rows { double r[3][4]; };
+
+        Rows m, inv;
+
+        explicit Transform(const Rows &rows) : m(rows) {
+            // inverse of the linear part by cofactors, then the translation is undone by it.
+            const double (*a)[4] = m.r;
+            double det = a[0][0] * (a[1][1]*a[2][2] - a[1][2]*a[2][1])
+                       - a[0][1] * (a[1][0]*a[2][2] - a[1][2]*a[2][0])
+                       + a[0][2] * (a[1][0]*a[2][1] - a[1][1]*a[2][0]);
+            double inv_det = 1 / det;
+
+            inv.r[0][0] =  (a[1][1]*a[2][2] - a[1][2]*a[2][1]) * inv_det;
+            inv.r[0][1] = -(a[0][1]*a[2][2] - a[0][2]*a[2][1]) * inv_det;
+            inv.r[0][2] =  (a[0][1]*a[1][2] - a[0][2]*a[1][1]) * inv_det;
+            inv.r[1][0] = -(a[1][0]*a[2][2] - a[1][2]*a[2][0]) * inv_det;
+            inv.r[1][1] =  (a[0][0]*a[2][2] - a[0][2]*a[2][0]) * inv_det;
+            inv.r[1][2] = -(a[0][0]*a[1][2] - a[0][2]*a[1][0]) * inv_det;
+            inv.r[2][0] =  (a[1][0]*a[2][1] - a[1][1]*a[2][0]) * inv_det;
+            inv.r[2][1] = -(a[0][0]*a[2][1] - a[0][1]*a[2][0]) * inv_det;
+            inv.r[2][2] =  (a[0][0]*a[1][1] - a[0][1]*a[1][0]) * inv_det;
+
+            for (int i = 0; i < 3; i++)
+                inv.r[i][3] = -(inv.r[i][0]*a[0][3] + inv.r[i][1]*a[1][3] + inv.r[i][2]*a[2][3]);
+        }
+
+        static Rows identity_rows() {
+            Rows m = {{ {1,0,0,0}, {0,1,0,0}, {0,0,1,0} }};
+            return m;
+        }
+
+        // w = 1 for points (translated), w = 0 for vectors.
+        static Vector3d apply(const Rows &m, const Vector3d &v, double w) {
+            return Vector3d(m.r[0][0]*v[0] + m.r[0][1]*v[1] + m.r[0][2]*v[2] + m.r[0][3]*w,
+                            m.r[1][0]*v[0] + m.r[1][1]*v[1] + m.r[1][2]*v[2] + m.r[1][3]*w,
+                            m.r[2][0]*v[0] + m.r[2][1]*v[1] + m.r[2][2]*v[2] + m.r[2][3]*w);
+        }
+};
+
+// one placement of a shared bottom-level BVH (BLAS) in the scene. every instance of a sub-scene points at
+// the same BLAS, so a copy costs a transform & a pointer; the scene's own BVH over its objects (instances
+// included) is the top level. a ray is transformed once per instance, instead of once per wrapper as with
+// stacked Translate / RotateY.
+// note: the object-space ray keeps its (possibly scaled) direction unnormalized, so its t is the world t.
+class Instance : public Object {
+    public:
+        Instance(shared_ptr<BVHAccel> blas, const Transform &to_world)
+          : blas(blas), to_world(to_world)
+        {
+            aabb = to_world.bounds(blas->get_AABB());
+        }
+
+        bool intersect(const Ray &ri, Interval t_interval, Intersection &isect) const override {
+            RT_STAT(InstanceTests);
+            Ray local_ri(to_world.inverse_point(ri.origin()), to_world.inverse_vector(ri.direction()), ri.time());
+            if (!blas->intersect(local_ri, t_interval, isect))
+                return false;
+
+            // the side the ray hit (happend_outside) is unchanged by the transform.
+            isect.p = to_world.point(isect.p);
+            isect.normal = normalize(to_world.normal(isect.normal));
+            isect.set_geometric_normal(normalize(to_world.normal(isect.geometric_normal())));
+            return true;
+        }
+
+        AABB get_AABB() const override { return aabb; }
+
+        void register_materials(MaterialTable &table) override { blas->register_materials(table); }
+
+    private:
+        friend class SceneSnapshot;
+        Instance() {}
+
+        shared_ptr<BVHAccel> blas;
+        Transform to_world;
+        AABB aabb;
+};
+
+#endif
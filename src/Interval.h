@@ -1,42 +1,51 @@
 #ifndef INTERVAL_H
 #define INTERVAL_H
 
-class Interval {
+// an interval over scalar type T; Interval is the one over the build's Real (see global.h).
+template <typename T>
+class IntervalT {
     public:
-        double min, max;
+        using scalar = T;
 
-        Interval() : min(+infinity), max(-infinity) {}
-        Interval(double min, double max) : min(min), max(max) {}
+        T min, max;
+
+        IntervalT() : min(+infinity), max(-infinity) {}
+        IntervalT(T min, T max) : min(min), max(max) {}
 
         // construct union of two intervals.
-        Interval(const Interval &a, const Interval &b) {
+        IntervalT(const IntervalT &a, const IntervalT &b) {
             min = std::min(a.min, b.min);
             max = std::max(a.max, b.max);
         }
 
-        double size() const { return max - min; }
+        T size() const { return max - min; }
 
-        double contains(double t) { return min <= t && t <= max; }
+        bool contains(T t) const { return min <= t && t <= max; }
 
-        double surrounds(double t) { return min < t && t < max; }
+        bool surrounds(T t) const { return min < t && t < max; }
 
-        double clamp(double x) const { return std::max(min, std::min(max, x)); }
+        T clamp(T x) const { return std::max(min, std::min(max, x)); }
 
-        Interval expand(double delta) const {
+        IntervalT expand(T delta) const {
             auto padding = delta / 2;
-            return Interval(min - padding, max + padding);
+            return IntervalT(min - padding, max + padding);
         }
  
-        static const Interval empty, universe;
+        static const IntervalT empty, universe;
 };
-const Interval Interval::empty = Interval(+infinity, -infinity);
-const Interval Interval::universe = Interval(-infinity, +infinity);
 
-Interval operator+(const Interval &intv, double offset) {
-    return Interval(intv.min + offset, intv.max + offset);
+template <typename T> const IntervalT<T> IntervalT<T>::empty = IntervalT<T>(+infinity, -infinity);
+template <typename T> const IntervalT<T> IntervalT<T>::universe = IntervalT<T>(-infinity, +infinity);
+
+using Interval = IntervalT<Real>;
+
+template <typename T>
+IntervalT<T> operator+(const IntervalT<T> &intv, typename IntervalT<T>::scalar offset) {
+    return IntervalT<T>(intv.min + offset, intv.max + offset);
 }
 
-Interval operator+(double offset, const Interval &intv) {
+template <typename T>
+IntervalT<T> operator+(typename IntervalT<T>::scalar offset, const IntervalT<T> &intv) {
     return intv + offset;
 }
 
@@ -0,0 +1,226 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+#include "AABB.h"
+#include "BVH.h"
+#include "Object.h"
+#include "SharedArray.h"
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// one 32-byte node of a flattened BVH. nodes are stored depth-first, so an interior node's first child
+// directly follows it and only the second child's offset is kept.
+struct LinearBVHNode {
+    float    bounds[2][3]; // min & max corners, rounded outwards from the double precision AABB.
+    uint32_t offset;       // leaf: first object in the leaf order, interior: second child.
+    uint16_t count;        // objects in a leaf, 0 for interior nodes.
+    uint8_t  axis;         // interior: split axis, used to visit the nearer child first.
+    uint8_t  pad;
+};
+
+static_assert(sizeof(LinearBVHNode) == 32, "LinearBVHNode should be 32 bytes");
+
+// appends the subtree of build_node to nodes, depth-first, and returns the index of its root.
+inline uint32_t flatten_linear_bvh(const BVHBuildNode &build_node, std::vector<LinearBVHNode> &nodes) {
+    uint32_t index = uint32_t(nodes.size());
+    nodes.push_back(LinearBVHNode());
+
+    LinearBVHNode node;
+    for (int a = 0; a < 3; a++) {
+        node.bounds[0][a] = round_down_to_float(build_node.aabb.axis_interval(a).min);
+        node.bounds[1][a] = round_up_to_float(build_node.aabb.axis_interval(a).max);
+    }
+    node.pad = 0;
+
+    if (build_node.is_leaf()) {
+        node.offset = uint32_t(build_node.first);
+        node.count = uint16_t(build_node.count);
+        node.axis = 0;
+    } else {
+        node.count = 0;
+        node.axis = uint8_t(build_node.axis);
+        flatten_linear_bvh(*build_node.children[0], nodes);
+        node.offset = flatten_linear_bvh(*build_node.children[1], nodes);
+    }
+
+    nodes[index] = node;
+    return index;
+}
+
+// 1 + 2 * gamma(3): bounds the relative error of 3 roundings (the subtraction, the product & inv_dir).
+const double slab_exit_scale = 1 + 3 * std::numeric_limits<double>::epsilon() / (1 - 1.5 * std::numeric_limits<double>::epsilon());
+
+// slab test against the node's box, clipped to [t.min, t.max]. the exit distances are scaled up by their
+// worst rounding error, so a ray grazing a corner or edge of the box (e.g. through a vertex of a triangle
+// mesh) can't miss it by an ulp.
+// note: a 0 direction component gives NaN products, which std::max/std::min ignore here.
+inline bool intersect_linear_bvh_node(const LinearBVHNode &node, const Point3d &orig, const double inv_dir[3],
+                                      const int dir_is_neg[3], const Interval &t)
+{
+    RT_STAT(BoxTests);
+    double t_min = t.min, t_max = t.max;
+    for (int a = 0; a < 3; a++) {
+        double t0 = (node.bounds[dir_is_neg[a]][a] - orig[a]) * inv_dir[a];
+        double t1 = (node.bounds[1 - dir_is_neg[a]][a] - orig[a]) * inv_dir[a] * slab_exit_scale;
+        t_min = std::max(t_min, t0);
+        t_max = std::min(t_max, t1);
+    }
+    return t_min <= t_max;
+}
+
+// walks the flattened BVH for ri with an explicit stack, calling leaf(first, count, t_interval) for every
+// leaf the ray enters; leaf returns whether it hit and shrinks t_interval.max to the closest hit.
+template <typename LeafIntersector>
+inline bool traverse_linear_bvh(const SharedArray<LinearBVHNode> &nodes, const Ray &ri, Interval &t_interval,
+                                LeafIntersector &&leaf)
+{
+    if (nodes.empty()) return false;
+    RT_STAT(BVHTraversals);
+
+    // per-ray values, computed once for the whole traversal.
+    const Point3d &orig = ri.origin();
+    const Vector3d &dir = ri.direction();
+    const double inv_dir[3] = { 1/double(dir[0]), 1/double(dir[1]), 1/double(dir[2]) };
+    const int dir_is_neg[3] = { inv_dir[0] < 0, inv_dir[1] < 0, inv_dir[2] < 0 };
+
+    bool hit_anything = false;
+    uint32_t stack[bvh_max_depth];
+    int stack_size = 0;
+    uint32_t current = 0;
+
+    while (true) {
+        const LinearBVHNode &node = nodes[current];
+        RT_STAT(BVHNodes);
+        if (intersect_linear_bvh_node(node, orig, inv_dir, dir_is_neg, t_interval)) {
+            if (node.count > 0) {
+                if (leaf(node.offset, uint32_t(node.count), t_interval))
+                    hit_anything = true;
+            } else if (dir_is_neg[node.axis]) {
+                // visit the child on the ray's side of the split first, so later nodes get culled
+                // by the closer hit.
+                stack[stack_size++] = current + 1;
+                current = node.offset;
+                continue;
+            } else {
+                stack[stack_size++] = node.offset;
+                current = current + 1;
+                continue;
+            }
+        }
+        if (stack_size == 0) break;
+        current = stack[--stack_size];
+    }
+
+    return hit_anything;
+}
+
+// returns the expected cost of tracing a random ray through nodes[index] under the surface area heuristic.
+inline double linear_bvh_cost(const SharedArray<LinearBVHNode> &nodes, uint32_t index, const BVHBuildOptions &opts) {
+    auto area = [](const LinearBVHNode &node) {
+        double dx = double(node.bounds[1][0]) - node.bounds[0][0];
+        double dy = double(node.bounds[1][1]) - node.bounds[0][1];
+        double dz = double(node.bounds[1][2]) - node.bounds[0][2];
+        return 2 * (dx*dy + dy*dz + dz*dx);
+    };
+
+    const LinearBVHNode &node = nodes[index];
+    if (node.count > 0) return opts.intersection_cost * node.count;
+
+    double node_area = area(node), cost = opts.traversal_cost;
+    uint32_t children[2] = { index + 1, node.offset };
+    for (uint32_t c : children) {
+        double ratio = (node_area > 0) ? area(nodes[c]) / node_area : 1.0;
+        cost += ratio * linear_bvh_cost(nodes, c, opts);
+    }
+    return cost;
+}
+
+// a BVH compacted into one contiguous node array, traversed with an explicit stack.
+class LinearBVH : public BVHAccel {
+    public:
+        LinearBVH(const std::vector<shared_ptr<Object>> &objects, const BVHBuildOptions &opts = BVHBuildOptions()) {
+            if (objects.empty()) return;
+            std::vector<LinearBVHNode> built;
+            flatten_linear_bvh(*build_tree(objects, opts).root, built);
+            nodes = SharedArray<LinearBVHNode>(std::move(built));
+        }
+
+        bool intersect(const Ray &ri, Interval t_interval, Intersection &isect) const override {
+            return traverse_linear_bvh(nodes, ri, t_interval, [&](uint32_t first, uint32_t count, Interval &t) {
+                return intersect_leaf(first, count, ri, t, isect);
+            });
+        }
+
+        // traverses the BVH once for the whole packet: a node is culled if the packet's frustum misses it,
+        // otherwise the first ray that enters it decides the visiting order, and rays before it (which
+        // missed the node) are skipped in its subtree.
+        void intersect_packet(RayPacket &packet, const Interval &t) const override {
+            packet.begin(t);
+            if (nodes.empty()) return;
+            RT_STAT(BVHTraversals);
+
+            struct StackEntry { uint32_t node; int first_active; };
+            StackEntry stack[bvh_max_depth + 1];
+            int stack_size = 0;
+            stack[stack_size++] = StackEntry{ 0, 0 };
+
+            double packet_t_max = t.max; // largest t_max of any ray, only shrinks after a leaf.
+
+            while (stack_size > 0) {
+                StackEntry entry = stack[--stack_size];
+                const LinearBVHNode &node = nodes[entry.node];
+                RT_STAT(BVHNodes);
+                RT_STAT(BoxTests);
+                if (!packet.frustum_overlaps(node.bounds[0], node.bounds[1], t.min, packet_t_max)) continue;
+
+                int first = first_hit_ray(node, packet, entry.first_active, t.min);
+                if (first == packet.size) continue;
+
+                if (node.count > 0) {
+                    for (int k = first; k < packet.size; k++) {
+                        Interval t_ray(t.min, packet.t_max[k]);
+                        if (!intersect_linear_bvh_node(node, packet.rays[k].origin(), packet.inv_dir[k], packet.dir_is_neg[k], t_ray))
+                            continue;
+                        if (intersect_leaf(node.offset, node.count, packet.rays[k], t_ray, packet.isect[k])) {
+                            packet.hit[k] = true;
+                            packet.t_max[k] = t_ray.max;
+                        }
+                    }
+                    packet_t_max = packet.packet_t_max();
+                } else if (packet.dir_is_neg[first][node.axis]) {
+                    stack[stack_size++] = StackEntry{ entry.node + 1, first };
+                    stack[stack_size++] = StackEntry{ node.offset, first };
+                } else {
+                    stack[stack_size++] = StackEntry{ node.offset, first };
+                    stack[stack_size++] = StackEntry{ entry.node + 1, first };
+                }
+            }
+        }
+
+        size_t node_count() const override { return nodes.size(); }
+
+        double sah_cost(const BVHBuildOptions &opts) const override {
+            if (nodes.empty()) return 0.0;
+            return linear_bvh_cost(nodes, 0, opts);
+        }
+
+    private:
+        friend class SceneSnapshot;
+        LinearBVH() {}
+
+        SharedArray<LinearBVHNode> nodes;
+
+        // returns the index of the first ray from `first` on that enters the node, or packet.size if none does.
+        static int first_hit_ray(const LinearBVHNode &node, const RayPacket &packet, int first, double t_min) {
+            for (int k = first; k < packet.size; k++) {
+                Interval t_ray(t_min, packet.t_max[k]);
+                if (intersect_linear_bvh_node(node, packet.rays[k].origin(), packet.inv_dir[k], packet.dir_is_neg[k], t_ray))
+                    return k;
+            }
+            return packet.size;
+        }
+};
+
+#endif
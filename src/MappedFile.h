@@ -0,0 +1,67 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #define RT_HAS_MMAP 1
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#else
+    #define RT_HAS_MMAP 0
+#endif
+
+// a whole file mapped read-only into memory. pages are read in by the OS as they're first touched, so
+// opening costs next to nothing however large the file is, and the data is never copied.
+// without mmap (non-POSIX platforms) the file is read into memory instead.
+// note: data() is null if the file couldn't be opened.
+class MappedFile {
+    public:
+        explicit MappedFile(const std::string &path) {
+#if RT_HAS_MMAP
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) return;
+            struct stat st;
+            if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+                void *p = ::mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p != MAP_FAILED) {
+                    bytes = static_cast<const char*>(p);
+                    n_bytes = size_t(st.st_size);
+                }
+            }
+            ::close(fd);
+#else
+            std::ifstream file(path, std::ios::binary | std::ios::ate);
+            if (!file) return;
+            copy.resize(size_t(file.tellg()));
+            file.seekg(0);
+            if (copy.empty() || !file.read(copy.data(), copy.size())) return;
+            bytes = copy.data();
+            n_bytes = copy.size();
+#endif
+        }
+
+        ~MappedFile() {
+#if RT_HAS_MMAP
+            if (bytes) ::munmap(const_cast<char*>(bytes), n_bytes);
+#endif
+        }
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        const char *data() const { return bytes; }
+        size_t size() const { return n_bytes; }
+
+    private:
+        const char *bytes = nullptr;
+        size_t n_bytes = 0;
+        std::vector<char> copy; // the file's contents when it can't be mapped.
+};
+
+#endif
@@ -12,6 +12,15 @@ class Material {
 
         virtual bool scatter(const Ray &ri, const Intersection &isect, Color &attenuation, Ray &ro)
         const { return false; }
+
+        virtual bool is_emissive() const { return false; }
+
+        // returns BSDF * cosine for scattering ri into direction wo (used when sampling lights).
+        virtual Color eval(const Ray &ri, const Intersection &isect, const Vector3d &wo) const { return Color(); }
+
+        // returns the solid-angle density of scatter() picking direction wo.
+        // note: 0 marks delta (specular) lobes, which can't be hit by light sampling, so it's skipped there.
+        virtual double pdf(const Ray &ri, const Intersection &isect, const Vector3d &wo) const { return 0.0; }
 };
 
 class Diffuse : public Material {
@@ -28,12 +37,25 @@ class Diffuse : public Material {
             } else {
                 wo = normalize(wo);
             }
-            ro = Ray(isect.p, wo, ri.time());
+            ro = isect.spawn_ray(wo, ri.time());
             attenuation = tex->get_texColor(isect.tex_u, isect.tex_v, isect.p);
             return true;
         }
+
+        // scatter() picks cosine-weighted directions, so pdf = cos/pi & BSDF = albedo/pi.
+        Color eval(const Ray &ri, const Intersection &isect, const Vector3d &wo) const override {
+            auto cosine = dotProduct(isect.normal, wo);
+            if (cosine <= 0) return Color();
+            return tex->get_texColor(isect.tex_u, isect.tex_v, isect.p) * (cosine / pi);
+        }
+
+        double pdf(const Ray &ri, const Intersection &isect, const Vector3d &wo) const override {
+            return std::fmax(0.0, dotProduct(isect.normal, wo)) / pi;
+        }
     
     private:
+        friend class SceneSnapshot;
+
         shared_ptr<Texture> tex;  
 };
 
@@ -56,7 +78,7 @@ class Metal : public Material {
         const override {
             // fuzzy dir = specular reflection dir + random vector in fuzz unit sphere .
             Vector3d wo = reflect(ri.direction(), isect.normal) + fuzz * sample_dir();
-            ro = Ray(isect.p, normalize(wo), ri.time());
+            ro = isect.spawn_ray(normalize(wo), ri.time());
             attenuation = albedo;
 
             // if fuzzing produces inward ray, treat it as absorbed by returning false.
@@ -64,6 +86,8 @@ class Metal : public Material {
         }
 
     private:
+        friend class SceneSnapshot;
+
         Color albedo;
 
         // defines the roughness of the metal's surface (1 >= fuzz >= 0).
@@ -92,11 +116,13 @@ class Dielectric : public Material {
                 wo = refract(wi, N, refraction_index);
             }
 
-            ro = Ray(isect.p, wo, ri.time());
+            ro = isect.spawn_ray(wo, ri.time());
             return true;
         }
 
     private:
+        friend class SceneSnapshot;
+
         // could be absolute ior (index of refraction), or relative (material's ior over enclosing material's).
         double ior;
 
@@ -117,7 +143,11 @@ class DiffuseLight : public Material {
             return tex->get_texColor(u, v, p);
         }
 
+        bool is_emissive() const override { return true; }
+
     private:
+        friend class SceneSnapshot;
+
         shared_ptr<Texture> tex;
 };
 
@@ -128,12 +158,22 @@ class Isotropic : public Material {
 
         bool scatter(const Ray &ri, const Intersection &isect, Color &attenuation, Ray &ro)
         const override {
-            ro = Ray(isect.p, sample_dir(), ri.time()); // ro could be generated anywhere on unit sphere.
+            ro = isect.spawn_ray(sample_dir(), ri.time()); // ro could be generated anywhere on unit sphere.
             attenuation = tex->get_texColor(isect.tex_u, isect.tex_v, isect.p);
             return true;
         }
 
+        Color eval(const Ray &ri, const Intersection &isect, const Vector3d &wo) const override {
+            return tex->get_texColor(isect.tex_u, isect.tex_v, isect.p) / (4*pi);
+        }
+
+        double pdf(const Ray &ri, const Intersection &isect, const Vector3d &wo) const override {
+            return 1 / (4*pi);
+        }
+
     private:
+        friend class SceneSnapshot;
+
         shared_ptr<Texture> tex;
 };
 
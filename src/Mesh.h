@@ -0,0 +1,221 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include "AABB.h"
+#include "BVH.h"
+#include "LinearBVH.h"
+#include "Material.h"
+#include "Object.h"
+#include "SharedArray.h"
+#include "ThreadPool.h"
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// the arrays of an indexed triangle mesh, as filled in by the loaders.
+struct MeshArrays {
+    std::vector<float> positions; // x, y, z per vertex.
+    std::vector<float> normals;   // x, y, z per vertex, or empty.
+    std::vector<float> uvs;       // u, v per vertex, or empty.
+    std::vector<uint32_t> indices; // 3 vertices per triangle, counter-clockwise seen from the front.
+};
+
+// a read-only view of an indexed triangle mesh. the arrays live wherever storage keeps them: in
+// MeshArrays, or in a mapped cache file (see MeshLoader.h), so a mesh is never copied once loaded.
+struct MeshData {
+    const float *positions = nullptr;
+    const float *normals = nullptr;  // null without per-vertex normals.
+    const float *uvs = nullptr;      // null without per-vertex uvs.
+    const uint32_t *indices = nullptr;
+    size_t n_vertices = 0, n_triangles = 0;
+    std::shared_ptr<const void> storage; // keeps the arrays alive.
+
+    bool empty() const { return n_triangles == 0; }
+
+    static MeshData from_arrays(MeshArrays &&arrays) {
+        auto owned = std::make_shared<MeshArrays>(std::move(arrays));
+        MeshData mesh;
+        mesh.positions = owned->positions.data();
+        mesh.normals = owned->normals.empty() ? nullptr : owned->normals.data();
+        mesh.uvs = owned->uvs.empty() ? nullptr : owned->uvs.data();
+        mesh.indices = owned->indices.data();
+        mesh.n_vertices = owned->positions.size() / 3;
+        mesh.n_triangles = owned->indices.size() / 3;
+        mesh.storage = owned;
+        return mesh;
+    }
+
+    Point3d position(uint32_t v) const { return Point3d(positions[3*v], positions[3*v + 1], positions[3*v + 2]); }
+    Vector3d normal(uint32_t v) const { return Vector3d(normals[3*v], normals[3*v + 1], normals[3*v + 2]); }
+};
+
+// returns the distance along ri to triangle (p0, p1, p2) if ri hits it within t_interval, with the
+// barycentric weights of the hit point in b. the test is watertight (Woop, Benthin & Wald 2013): rays
+// are sheared onto the z axis so the edge functions of triangles that share an edge are computed from
+// the same values, and a ray through an edge or vertex can't slip through the gap between them.
+inline bool intersect_triangle(const Ray &ri, const Interval &t_interval, const Point3d &p0, const Point3d &p1,
+                               const Point3d &p2, Real &t, Real b[3])
+{
+    // the largest direction component becomes z, which keeps the shear finite.
+    const Vector3d &dir = ri.direction();
+    int kz = (std::fabs(dir[0]) > std::fabs(dir[1]))
+           ? (std::fabs(dir[0]) > std::fabs(dir[2]) ? 0 : 2)
+           : (std::fabs(dir[1]) > std::fabs(dir[2]) ? 1 : 2);
+    int kx = (kz + 1) % 3, ky = (kx + 1) % 3;
+
+    Real sx = -dir[kx] / dir[kz], sy = -dir[ky] / dir[kz], sz = Real(1) / dir[kz];
+
+    // vertices relative to the ray origin, permuted & sheared.
+    Vector3d r0 = p0 - ri.origin(), r1 = p1 - ri.origin(), r2 = p2 - ri.origin();
+    Real x0 = r0[kx] + sx*r0[kz], y0 = r0[ky] + sy*r0[kz];
+    Real x1 = r1[kx] + sx*r1[kz], y1 = r1[ky] + sy*r1[kz];
+    Real x2 = r2[kx] + sx*r2[kz], y2 = r2[ky] + sy*r2[kz];
+
+    // e_i is the weight of vertex i: twice the signed area its opposite edge spans with the ray.
+    Real e0 = x1*y2 - y1*x2;
+    Real e1 = x2*y0 - y2*x0;
+    Real e2 = x0*y1 - y0*x1;
+
+    // an edge function rounded to 0 may be a hit exactly on the edge or not; redo the products in double.
+    if (sizeof(Real) < sizeof(double) && (e0 == 0 || e1 == 0 || e2 == 0)) {
+        e0 = Real(double(x1)*double(y2) - double(y1)*double(x2));
+        e1 = Real(double(x2)*double(y0) - double(y2)*double(x0));
+        e2 = Real(double(x0)*double(y1) - double(y0)*double(x1));
+    }
+
+    if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0))
+        return false;
+    Real det = e0 + e1 + e2;
+    if (det == 0)
+        return false;
+
+    // t * det, compared against the interval scaled by det, so the division only happens for hits.
+    Real t_scaled = (e0*r0[kz] + e1*r1[kz] + e2*r2[kz]) * sz;
+    if (det < 0 ? (t_scaled >= det * Real(t_interval.min) || t_scaled <= det * Real(t_interval.max))
+                : (t_scaled <= det * Real(t_interval.min) || t_scaled >= det * Real(t_interval.max)))
+        return false;
+
+    Real inv_det = Real(1) / det;
+    t = t_scaled * inv_det;
+    b[0] = e0 * inv_det;
+    b[1] = e1 * inv_det;
+    b[2] = e2 * inv_det;
+    return true;
+}
+
+// an indexed triangle mesh with its own BVH over its triangles, built on construction. a hit is shaded
+// with the vertex normals & uvs interpolated at the hit point, when the mesh has them; without normals the
+// mesh is faceted, without uvs (tex_u, tex_v) are the hit's barycentric coordinates (b1, b2).
+// note: meshes don't take part in light sampling; keep emitters as separate objects.
+class TriangleMesh : public BVHAccel {
+    public:
+        TriangleMesh(MeshData mesh, shared_ptr<Material> m, const BVHBuildOptions &opts = BVHBuildOptions())
+          : mesh(std::move(mesh)), material(m)
+        {
+            build(opts);
+        }
+
+        size_t size() const { return mesh.n_triangles; }
+
+        bool intersect(const Ray &ri, Interval t_interval, Intersection &isect) const override {
+            return traverse_linear_bvh(nodes, ri, t_interval, [&](uint32_t first, uint32_t count, Interval &t) {
+                return intersect_triangles(first, count, ri, t, isect);
+            });
+        }
+
+        size_t node_count() const override { return nodes.size(); }
+
+        double sah_cost(const BVHBuildOptions &opts) const override {
+            if (nodes.empty()) return 0.0;
+            return linear_bvh_cost(nodes, 0, opts);
+        }
+
+        void register_materials(MaterialTable &table) override { material.register_in(table); }
+
+    private:
+        friend class SceneSnapshot;
+        TriangleMesh() {}
+
+        MeshData mesh;
+        MaterialRef material;
+        SharedArray<uint32_t> triangles; // triangle ids in leaf order.
+        SharedArray<LinearBVHNode> nodes;
+
+        void build(const BVHBuildOptions &opts) {
+            size_t n = mesh.n_triangles;
+            if (n == 0) return;
+
+            std::vector<BVHPrimitive> prims(n);
+            const size_t chunk = 4096;
+            ThreadPool pool(opts.build_threads);
+            pool.parallel_for((n + chunk - 1) / chunk, [&](size_t c, int) {
+                for (size_t i = c * chunk; i < std::min(n, (c+1) * chunk); i++) {
+                    const uint32_t *v = mesh.indices + 3*i;
+                    prims[i].aabb = AABB(AABB(mesh.position(v[0]), mesh.position(v[1])),
+                                         AABB(mesh.position(v[2]), mesh.position(v[2])));
+                    prims[i].centroid = prims[i].aabb.Centriod();
+                    prims[i].index = i;
+                }
+            });
+            auto tree = build_bvh_tree(prims, 0, prims.size(), opts);
+
+            std::vector<uint32_t> order;
+            order.reserve(n);
+            for (const auto &p : prims) order.push_back(uint32_t(p.index));
+            triangles = SharedArray<uint32_t>(std::move(order));
+
+            std::vector<LinearBVHNode> built;
+            flatten_linear_bvh(*tree.root, built);
+            nodes = SharedArray<LinearBVHNode>(std::move(built));
+            aabb = tree.root->aabb;
+        }
+
+        // intersects triangles [first, first + count) of the leaf order, shrinking t_interval.max to the
+        // closest hit; only the closest fills in the hit record.
+        bool intersect_triangles(uint32_t first, uint32_t count, const Ray &ri, Interval &t_interval,
+                                 Intersection &isect) const
+        {
+            RT_STAT_ADD(TriangleTests, count);
+            uint32_t best = UINT32_MAX;
+            Real best_b[3] = { 0, 0, 0 };
+            for (uint32_t i = first; i < first + count; i++) {
+                const uint32_t *v = mesh.indices + 3*triangles[i];
+                Real t, b[3];
+                if (intersect_triangle(ri, t_interval, mesh.position(v[0]), mesh.position(v[1]), mesh.position(v[2]), t, b)) {
+                    t_interval.max = t;
+                    best = triangles[i];
+                    best_b[0] = b[0]; best_b[1] = b[1]; best_b[2] = b[2];
+                }
+            }
+            if (best == UINT32_MAX) return false;
+
+            const uint32_t *v = mesh.indices + 3*best;
+            Point3d p0 = mesh.position(v[0]), p1 = mesh.position(v[1]), p2 = mesh.position(v[2]);
+
+            // the barycentric point is closer to the surface than ri.at(t).
+            isect.p = best_b[0]*p0 + best_b[1]*p1 + best_b[2]*p2;
+            isect.distance = t_interval.max;
+
+            Vector3d n = normalize(crossProduct(p1 - p0, p2 - p0));
+            Vector3d shading = n;
+            if (mesh.normals) {
+                Vector3d s = best_b[0]*mesh.normal(v[0]) + best_b[1]*mesh.normal(v[1]) + best_b[2]*mesh.normal(v[2]);
+                if (dotProduct(s, s) > 0) shading = normalize(s);
+            }
+            isect.set_normal(ri, n, shading);
+
+            if (mesh.uvs) {
+                isect.tex_u = best_b[0]*mesh.uvs[2*v[0]] + best_b[1]*mesh.uvs[2*v[1]] + best_b[2]*mesh.uvs[2*v[2]];
+                isect.tex_v = best_b[0]*mesh.uvs[2*v[0] + 1] + best_b[1]*mesh.uvs[2*v[1] + 1] + best_b[2]*mesh.uvs[2*v[2] + 1];
+            } else {
+                isect.tex_u = best_b[1];
+                isect.tex_v = best_b[2];
+            }
+            isect.material = material.handle;
+            return true;
+        }
+};
+
+#endif
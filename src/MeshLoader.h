@@ -0,0 +1,452 @@
+#ifndef MESH_LOADER_H
+#define MESH_LOADER_H
+
+#include "Mesh.h"
+#include "MappedFile.h"
+
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/stat.h>
+
+// loading of triangle meshes from Wavefront OBJ & binary PLY files, and a binary cache of parsed meshes:
+// load_mesh() parses a file once, writes its arrays to "<file>.rtmesh" & maps that cache on later runs,
+// so a large mesh loads in the time it takes to map a file instead of parsing text.
+// loaders print an error & return false (load_mesh an empty mesh) when a file can't be read.
+
+// reads the whole file into text.
+inline bool read_file(const std::string &filename, std::string &text) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) return false;
+    std::ostringstream buffer;
+    buffer << file.rdbuf();
+    text = buffer.str();
+    return true;
+}
+
+// OBJ
+
+// parses v, vt, vn & f (polygons are split into fans); other statements (groups, materials...) are
+// ignored. OBJ indexes positions, uvs & normals separately, so each distinct combination used by a face
+// becomes one vertex of the mesh.
+inline bool load_obj(const std::string &filename, MeshArrays &mesh) {
+    std::string text;
+    if (!read_file(filename, text)) {
+        std::cerr << "ERROR: Could not open mesh file '" << filename << "'.\n";
+        return false;
+    }
+
+    std::vector<float> positions, uvs, normals;
+    struct Corner { long v, vt, vn; };
+    struct CornerHash {
+        size_t operator()(const Corner &c) const { return size_t(c.v) * 73856093u ^ size_t(c.vt) * 19349663u ^ size_t(c.vn) * 83492791u; }
+    };
+    struct CornerEqual {
+        bool operator()(const Corner &a, const Corner &b) const { return a.v == b.v && a.vt == b.vt && a.vn == b.vn; }
+    };
+    std::unordered_map<Corner, uint32_t, CornerHash, CornerEqual> vertices;
+    bool any_uv = false, any_normal = false;
+    std::vector<Corner> face;
+
+    mesh = MeshArrays();
+    size_t line_no = 0;
+    const char *p = text.c_str(), *end = p + text.size();
+
+    // OBJ indices are 1-based, or negative for "counting back from the last one read".
+    auto resolve = [](long index, size_t count) -> long { return index < 0 ? long(count) + index : index - 1; };
+
+    while (p < end) {
+        const char *eol = static_cast<const char*>(std::memchr(p, '\n', size_t(end - p)));
+        if (!eol) eol = end;
+        line_no++;
+        while (p < eol && (*p == ' ' || *p == '\t')) p++;
+
+        char *next;
+        if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+            const char *s = p + 1;
+            for (int a = 0; a < 3; a++) { positions.push_back(std::strtof(s, &next)); s = next; }
+        } else if (p[0] == 'v' && p[1] == 't') {
+            const char *s = p + 2;
+            for (int a = 0; a < 2; a++) { uvs.push_back(std::strtof(s, &next)); s = next; }
+        } else if (p[0] == 'v' && p[1] == 'n') {
+            const char *s = p + 2;
+            for (int a = 0; a < 3; a++) { normals.push_back(std::strtof(s, &next)); s = next; }
+        } else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+            face.clear();
+            p++;
+            while (true) {
+                while (p < eol && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+                if (p >= eol) break;
+
+                Corner c = { std::strtol(p, &next, 10), 0, 0 };
+                if (next == p) break;
+                p = next;
+                if (*p == '/') {
+                    p++;
+                    if (*p != '/') { c.vt = std::strtol(p, &next, 10); p = next; }
+                    if (*p == '/') { p++; c.vn = std::strtol(p, &next, 10); p = next; }
+                }
+
+                c.v = resolve(c.v, positions.size() / 3);
+                c.vt = c.vt ? resolve(c.vt, uvs.size() / 2) : -1;
+                c.vn = c.vn ? resolve(c.vn, normals.size() / 3) : -1;
+                if (c.v < 0 || c.v >= long(positions.size() / 3) || c.vt >= long(uvs.size() / 2) ||
+                    c.vn >= long(normals.size() / 3))
+                {
+                    std::cerr << "ERROR: Bad vertex index in mesh file '" << filename << "', line " << line_no << ".\n";
+                    return false;
+                }
+                any_uv |= c.vt >= 0;
+                any_normal |= c.vn >= 0;
+                face.push_back(c);
+            }
+
+            for (size_t k = 2; k < face.size(); k++) {
+                for (const Corner &c : { face[0], face[k-1], face[k] }) {
+                    auto it = vertices.emplace(c, uint32_t(vertices.size()));
+                    if (it.second) {
+                        mesh.positions.insert(mesh.positions.end(), &positions[3*c.v], &positions[3*c.v] + 3);
+                        mesh.uvs.push_back(c.vt >= 0 ? uvs[2*c.vt] : 0.0f);
+                        mesh.uvs.push_back(c.vt >= 0 ? uvs[2*c.vt + 1] : 0.0f);
+                        for (int a = 0; a < 3; a++) mesh.normals.push_back(c.vn >= 0 ? normals[3*c.vn + a] : 0.0f);
+                    }
+                    mesh.indices.push_back(it.first->second);
+                }
+            }
+        }
+        p = eol + 1;
+    }
+
+    if (!any_uv) mesh.uvs.clear();
+    if (!any_normal) mesh.normals.clear();
+    return true;
+}
+
+// PLY
+
+// a PLY scalar type; size is 0 for names that aren't one.
+struct PLYType {
+    int size = 0;
+    bool is_float = false, is_signed = false;
+
+    explicit PLYType(const std::string &name = "") {
+        if (name == "char" || name == "int8") { size = 1; is_signed = true; }
+        else if (name == "uchar" || name == "uint8") size = 1;
+        else if (name == "short" || name == "int16") { size = 2; is_signed = true; }
+        else if (name == "ushort" || name == "uint16") size = 2;
+        else if (name == "int" || name == "int32") { size = 4; is_signed = true; }
+        else if (name == "uint" || name == "uint32") size = 4;
+        else if (name == "float" || name == "float32") { size = 4; is_float = true; }
+        else if (name == "double" || name == "float64") { size = 8; is_float = true; }
+    }
+};
+
+// reads one PLY scalar of the given type at p, swapping its bytes if the file's byte order isn't ours.
+inline double read_ply_value(const char *p, const PLYType &type, bool swap) {
+    char bytes[8];
+    for (int i = 0; i < type.size; i++) bytes[i] = swap ? p[type.size - 1 - i] : p[i];
+
+    switch (type.size) {
+        case 1: return type.is_signed ? double(int8_t(bytes[0])) : double(uint8_t(bytes[0]));
+        case 2: {
+            uint16_t v; std::memcpy(&v, bytes, 2);
+            return type.is_signed ? double(int16_t(v)) : double(v);
+        }
+        case 4: {
+            if (type.is_float) { float f; std::memcpy(&f, bytes, 4); return f; }
+            uint32_t v; std::memcpy(&v, bytes, 4);
+            return type.is_signed ? double(int32_t(v)) : double(v);
+        }
+        default: { double d; std::memcpy(&d, bytes, 8); return d; }
+    }
+}
+
+// parses the vertex (x, y, z, nx, ny, nz & u, v or s, t) & face (vertex_indices) elements of a binary PLY
+// file, little or big endian; faces are split into fans & other elements are skipped.
+inline bool load_ply(const std::string &filename, MeshArrays &mesh) {
+    std::string text;
+    if (!read_file(filename, text)) {
+        std::cerr << "ERROR: Could not open mesh file '" << filename << "'.\n";
+        return false;
+    }
+    auto fail = [&](const char *why) {
+        std::cerr << "ERROR: " << why << " in mesh file '" << filename << "'.\n";
+        return false;
+    };
+
+    struct Property { std::string name; PLYType type, count_type; }; // count_type is set for lists only.
+    struct Element { std::string name; size_t count; std::vector<Property> properties; };
+    std::vector<Element> elements;
+
+    size_t header_end = text.find("end_header");
+    if (text.compare(0, 3, "ply") != 0 || header_end == std::string::npos) return fail("Bad PLY header");
+    size_t body = text.find('\n', header_end);
+    if (body == std::string::npos) return fail("Bad PLY header");
+    body++;
+
+    bool big_endian = false;
+    std::istringstream header(text.substr(0, header_end));
+    std::string line;
+    while (std::getline(header, line)) {
+        std::istringstream words(line);
+        std::string keyword;
+        words >> keyword;
+        if (keyword == "format") {
+            std::string format;
+            words >> format;
+            if (format == "binary_big_endian") big_endian = true;
+            else if (format != "binary_little_endian") return fail("Only binary PLY is supported");
+        } else if (keyword == "element") {
+            Element e;
+            words >> e.name >> e.count;
+            elements.push_back(e);
+        } else if (keyword == "property" && !elements.empty()) {
+            Property prop;
+            std::string type, count_type;
+            words >> type;
+            if (type == "list") words >> count_type >> type;
+            words >> prop.name;
+            prop.type = PLYType(type);
+            prop.count_type = PLYType(count_type);
+            if (!prop.type.size || (!count_type.empty() && !prop.count_type.size))
+                return fail("Unknown PLY property type");
+            elements.back().properties.push_back(prop);
+        }
+    }
+
+    const uint16_t probe = 1;
+    const bool little_endian_host = *reinterpret_cast<const uint8_t*>(&probe) == 1;
+    const bool swap = big_endian == little_endian_host;
+
+    mesh = MeshArrays();
+    const char *p = text.data() + body, *end = text.data() + text.size();
+    std::vector<uint32_t> polygon;
+    size_t n_vertices = 0;
+
+    for (const Element &e : elements) {
+        bool is_vertex = e.name == "vertex", is_face = e.name == "face";
+        int px = -1, py = -1, pz = -1, nx = -1, ny = -1, nz = -1, pu = -1, pv = -1;
+        for (int i = 0; i < int(e.properties.size()); i++) {
+            const std::string &name = e.properties[i].name;
+            if (name == "x") px = i; else if (name == "y") py = i; else if (name == "z") pz = i;
+            else if (name == "nx") nx = i; else if (name == "ny") ny = i; else if (name == "nz") nz = i;
+            else if (name == "u" || name == "s" || name == "texture_u") pu = i;
+            else if (name == "v" || name == "t" || name == "texture_v") pv = i;
+        }
+        if (is_vertex) {
+            if (px < 0 || py < 0 || pz < 0) return fail("PLY vertices without x, y, z");
+            n_vertices = e.count;
+        }
+        bool has_normals = is_vertex && nx >= 0 && ny >= 0 && nz >= 0, has_uvs = is_vertex && pu >= 0 && pv >= 0;
+
+        std::vector<double> values(e.properties.size());
+        for (size_t k = 0; k < e.count; k++) {
+            for (int i = 0; i < int(e.properties.size()); i++) {
+                const Property &prop = e.properties[i];
+                int size = prop.type.size;
+                if (!prop.count_type.size) {
+                    if (end - p < size) return fail("Truncated PLY data");
+                    values[i] = read_ply_value(p, prop.type, swap);
+                    p += size;
+                    continue;
+                }
+
+                if (end - p < prop.count_type.size) return fail("Truncated PLY data");
+                size_t n = size_t(read_ply_value(p, prop.count_type, swap));
+                p += prop.count_type.size;
+                if (size_t(end - p) < n * size) return fail("Truncated PLY data");
+
+                if (is_face && (prop.name == "vertex_indices" || prop.name == "vertex_index")) {
+                    polygon.clear();
+                    for (size_t j = 0; j < n; j++) {
+                        double index = read_ply_value(p + j*size, prop.type, swap);
+                        if (index < 0 || index >= double(n_vertices)) return fail("Bad PLY vertex index");
+                        polygon.push_back(uint32_t(index));
+                    }
+                    for (size_t j = 2; j < n; j++) {
+                        mesh.indices.push_back(polygon[0]);
+                        mesh.indices.push_back(polygon[j-1]);
+                        mesh.indices.push_back(polygon[j]);
+                    }
+                }
+                p += n * size;
+            }
+
+            if (is_vertex) {
+                mesh.positions.push_back(float(values[px]));
+                mesh.positions.push_back(float(values[py]));
+                mesh.positions.push_back(float(values[pz]));
+                if (has_normals) {
+                    mesh.normals.push_back(float(values[nx]));
+                    mesh.normals.push_back(float(values[ny]));
+                    mesh.normals.push_back(float(values[nz]));
+                }
+                if (has_uvs) {
+                    mesh.uvs.push_back(float(values[pu]));
+                    mesh.uvs.push_back(float(values[pv]));
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Binary cache
+
+// layout of a cache file: this header, then the arrays, each starting at a multiple of 64 bytes.
+// the arrays are stored as they are in memory (native byte order), so a mapped cache is used in place.
+struct MeshCacheHeader {
+    char magic[8];          // "RTMESH" & 2 zero bytes.
+    uint32_t version;
+    uint32_t byte_order;    // mesh_cache_byte_order as written; reads differently on the other byte order.
+    uint64_t source_size;   // size & modification time of the file the cache was made from,
+    int64_t source_mtime;   // so an edited source invalidates the cache.
+    uint64_t n_vertices, n_triangles;
+    uint64_t positions, normals, uvs, indices; // offsets of the arrays in the file; 0 for missing ones.
+    uint64_t file_size;
+};
+
+const char mesh_cache_magic[8] = { 'R', 'T', 'M', 'E', 'S', 'H', 0, 0 };
+const uint32_t mesh_cache_version = 1;
+const uint32_t mesh_cache_byte_order = 0x01020304;
+
+// returns the size & modification time of filename, or false if it doesn't exist.
+inline bool file_stamp(const std::string &filename, uint64_t &size, int64_t &mtime) {
+    struct stat st;
+    if (::stat(filename.c_str(), &st) != 0) return false;
+    size = uint64_t(st.st_size);
+    mtime = int64_t(st.st_mtime);
+    return true;
+}
+
+// writes mesh to cache_filename, stamped with the source file's size & modification time.
+// the file is written under a temporary name & renamed, so a reader never maps a half-written cache.
+inline bool write_mesh_cache(const std::string &cache_filename, const MeshData &mesh, uint64_t source_size,
+                             int64_t source_mtime)
+{
+    MeshCacheHeader header = {};
+    std::memcpy(header.magic, mesh_cache_magic, sizeof(header.magic));
+    header.version = mesh_cache_version;
+    header.byte_order = mesh_cache_byte_order;
+    header.source_size = source_size;
+    header.source_mtime = source_mtime;
+    header.n_vertices = mesh.n_vertices;
+    header.n_triangles = mesh.n_triangles;
+
+    auto align = [](uint64_t offset) { return (offset + 63) & ~uint64_t(63); };
+    uint64_t offset = align(sizeof(MeshCacheHeader));
+    auto place = [&](const void *array, uint64_t bytes) -> uint64_t {
+        if (!array) return 0;
+        uint64_t at = offset;
+        offset = align(offset + bytes);
+        return at;
+    };
+    header.positions = place(mesh.positions, mesh.n_vertices * 3 * sizeof(float));
+    header.normals = place(mesh.normals, mesh.n_vertices * 3 * sizeof(float));
+    header.uvs = place(mesh.uvs, mesh.n_vertices * 2 * sizeof(float));
+    header.indices = place(mesh.indices, mesh.n_triangles * 3 * sizeof(uint32_t));
+    header.file_size = offset;
+
+    std::string temp_filename = cache_filename + ".tmp";
+    {
+        std::ofstream file(temp_filename, std::ios::binary | std::ios::trunc);
+        if (!file) return false;
+
+        auto write_at = [&](uint64_t at, const void *data, uint64_t bytes) {
+            static const char zeros[64] = {};
+            uint64_t pos = uint64_t(file.tellp());
+            file.write(zeros, std::streamsize(at - pos));
+            file.write(static_cast<const char*>(data), std::streamsize(bytes));
+        };
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        if (mesh.positions) write_at(header.positions, mesh.positions, mesh.n_vertices * 3 * sizeof(float));
+        if (mesh.normals) write_at(header.normals, mesh.normals, mesh.n_vertices * 3 * sizeof(float));
+        if (mesh.uvs) write_at(header.uvs, mesh.uvs, mesh.n_vertices * 2 * sizeof(float));
+        if (mesh.indices) write_at(header.indices, mesh.indices, mesh.n_triangles * 3 * sizeof(uint32_t));
+        write_at(header.file_size, nullptr, 0);
+        if (!file) return false;
+    }
+    return std::rename(temp_filename.c_str(), cache_filename.c_str()) == 0;
+}
+
+// maps the cache at cache_filename into mesh, checking that it's intact & (unless source_size is 0) that
+// it was made from a source file of that size & modification time. returns false if it's unusable.
+inline bool load_mesh_cache(const std::string &cache_filename, MeshData &mesh, uint64_t source_size = 0,
+                            int64_t source_mtime = 0)
+{
+    auto file = std::make_shared<MappedFile>(cache_filename);
+    if (!file->data() || file->size() < sizeof(MeshCacheHeader)) return false;
+
+    MeshCacheHeader header;
+    std::memcpy(&header, file->data(), sizeof(header));
+    if (std::memcmp(header.magic, mesh_cache_magic, sizeof(header.magic)) != 0 ||
+        header.version != mesh_cache_version || header.byte_order != mesh_cache_byte_order ||
+        header.file_size != file->size())
+        return false;
+    if (source_size && (header.source_size != source_size || header.source_mtime != source_mtime))
+        return false;
+
+    // every array has to lie within the file.
+    auto fits = [&](uint64_t offset, uint64_t bytes) { return offset == 0 || (offset <= header.file_size && bytes <= header.file_size - offset); };
+    if (!header.positions || !header.indices ||
+        !fits(header.positions, header.n_vertices * 3 * sizeof(float)) ||
+        !fits(header.normals, header.n_vertices * 3 * sizeof(float)) ||
+        !fits(header.uvs, header.n_vertices * 2 * sizeof(float)) ||
+        !fits(header.indices, header.n_triangles * 3 * sizeof(uint32_t)))
+        return false;
+
+    const char *base = file->data();
+    mesh = MeshData();
+    mesh.positions = reinterpret_cast<const float*>(base + header.positions);
+    mesh.normals = header.normals ? reinterpret_cast<const float*>(base + header.normals) : nullptr;
+    mesh.uvs = header.uvs ? reinterpret_cast<const float*>(base + header.uvs) : nullptr;
+    mesh.indices = reinterpret_cast<const uint32_t*>(base + header.indices);
+    mesh.n_vertices = header.n_vertices;
+    mesh.n_triangles = header.n_triangles;
+    mesh.storage = file;
+    return true;
+}
+
+// loads the OBJ or PLY (by extension) mesh in filename, from its cache "<filename>.rtmesh" when that's
+// up to date, else by parsing the file & (if use_cache) writing the cache for next time.
+// the cache alone is enough if filename itself is missing. returns an empty mesh on failure.
+inline MeshData load_mesh(const std::string &filename, bool use_cache = true) {
+    std::string cache_filename = filename + ".rtmesh";
+    uint64_t source_size = 0;
+    int64_t source_mtime = 0;
+    bool have_source = file_stamp(filename, source_size, source_mtime);
+
+    MeshData mesh;
+    if (use_cache && load_mesh_cache(cache_filename, mesh, source_size, source_mtime))
+        return mesh;
+    if (!have_source) {
+        std::cerr << "ERROR: Could not open mesh file '" << filename << "'.\n";
+        return MeshData();
+    }
+
+    std::string extension = filename.substr(filename.find_last_of('.') + 1);
+    for (char &c : extension) c = char(std::tolower(c));
+
+    MeshArrays arrays;
+    bool loaded = false;
+    if (extension == "obj") loaded = load_obj(filename, arrays);
+    else if (extension == "ply") loaded = load_ply(filename, arrays);
+    else std::cerr << "ERROR: Unknown mesh format of '" << filename << "' (expected .obj or .ply).\n";
+    if (!loaded) return MeshData();
+
+    mesh = MeshData::from_arrays(std::move(arrays));
+    if (use_cache && !write_mesh_cache(cache_filename, mesh, source_size, source_mtime))
+        std::cerr << "WARNING: Could not write mesh cache '" << cache_filename << "'.\n";
+    return mesh;
+}
+
+#endif
@@ -2,26 +2,85 @@
 #define OBJECT_H
 
 #include "AABB.h"
+#include "HandleTable.h"
+
+#include <cstdint>
+#include <type_traits>
+#include <utility>
 
 class Material; // pre-defining solves circularity of references between Object & Material classes.
 
+// a scene's materials, which hit records refer to by handle.
+using MaterialTable = HandleTable<Material>;
+
+// index of a material in its scene's material table.
+using MaterialHandle = uint32_t;
+
+// a material an object uses: the object keeps it alive, its hits carry the handle it was given by the table
+// of the scene the object was last added to (see Object::register_materials).
+struct MaterialRef {
+    shared_ptr<Material> ptr;
+    MaterialHandle handle = 0;
+
+    MaterialRef() {}
+    MaterialRef(shared_ptr<Material> ptr) : ptr(std::move(ptr)) {}
+
+    void register_in(MaterialTable &table) { handle = table.add(ptr); }
+};
+
 // this stores the intersection information between ray & objects.
+// note: it's trivially copyable (no refcounted members), so recording a candidate hit is plain stores.
 class Intersection {
     public:
         Point3d p;
         Vector3d normal;
-        shared_ptr<Material> m; // material of hitted object.
-        double tex_u, tex_v; // texture (u,v) coordinate of hitted object at p.
-        double distance; // which is t (t>=0).
+        Real tex_u, tex_v; // texture (u,v) coordinate of hitted object at p.
+        Real distance; // which is t (t>=0).
+        MaterialHandle material; // material of hitted object.
         bool happend_outside; // if ray-object intersection happens at object's outer surface.
 
         // this guarantees normal always points agianst the ray.
         void set_normal(const Ray &ri, const Vector3d &outward_normal) {
             happend_outside = dotProduct(ri.direction(), outward_normal) < 0.0;
             normal = happend_outside ? outward_normal : -outward_normal;
+            set_geometric_normal(normal);
         }
+
+        // for surfaces shaded with an interpolated normal (e.g. smooth meshes): the side hit & the spawned
+        // rays' offsets follow the true surface, the shading normal is only flipped into its hemisphere.
+        void set_normal(const Ray &ri, const Vector3d &outward_normal, const Vector3d &shading_normal) {
+            set_normal(ri, outward_normal);
+            normal = (dotProduct(shading_normal, normal) < 0.0) ? -shading_normal : shading_normal;
+        }
+
+        // the normal of the true surface, against the ray; normal may differ for shading.
+        Vector3d geometric_normal() const { return Vector3d(gn[0], gn[1], gn[2]); }
+        void set_geometric_normal(const Vector3d &n) { gn[0] = n[0]; gn[1] = n[1]; gn[2] = n[2]; }
+
+        // returns a ray leaving p in direction dir. its origin is pushed off the surface, to the side dir
+        // points to, by a bound on p's rounding error, so the ray can't re-hit the surface it starts on
+        // (replacing a fixed t_min, which is either too small for float or wastefully large for double).
+        Ray spawn_ray(const Vector3d &dir, Real time) const {
+            Real magnitude = std::max(std::fabs(p[0]), std::max(std::fabs(p[1]), std::fabs(p[2])));
+            Real offset = ray_offset_scale * std::numeric_limits<Real>::epsilon() * (magnitude + 1);
+            Vector3d ng = geometric_normal(), shift = ng * offset;
+            return Ray((dotProduct(dir, ng) > 0) ? p + shift : p - shift, dir, time);
+        }
+
+        // multiple of epsilon * |p| the origin is pushed by; covers the error of intersection routines
+        // that solve for t and then evaluate p = o + t*d.
+        static constexpr Real ray_offset_scale = 1024;
+
+    private:
+        Real gn[3]; // the geometric normal, unpadded so the SIMD float build still fits a cache line.
 };
 
+static_assert(std::is_trivially_copyable<Intersection>::value, "Intersection should be trivially copyable");
+// note: the cache-line target only holds for RT_SINGLE_PRECISION builds (56 bytes, 64 with RT_SIMD_VECTOR).
+// in double, p, normal & distance alone take 56 bytes, & with gn, the uvs & the handle a record is 104 (128
+// with RT_SIMD_VECTOR); it can't get under 64 without narrowing fields, which would change the renders.
+static_assert(sizeof(Real) > 4 || sizeof(Intersection) <= 64, "Intersection should fit a cache line in float");
+
 class Object {
     // parent class defaultly define unused virtual functions, let for child classes to override.
     public:
@@ -31,6 +90,21 @@ class Object {
         virtual bool intersect(const Ray& ri, Interval t_interval, Intersection& isect) const = 0; 
 
         virtual AABB get_AABB() const = 0;
+
+        // light sampling interface, overridden by primitives that can act as area lights.
+
+        // if the object's material emits light (such objects are collected into Scene::lights).
+        virtual bool is_emissive() const { return false; }
+
+        // returns the solid-angle density of sampling ri's direction from ri's origin towards the object.
+        virtual double pdf_value(const Ray &ri) const { return 0.0; }
+
+        // returns a unit direction from origin towards a random point of the object.
+        virtual Vector3d sample_towards(const Point3d &origin, double time) const { return Vector3d(1,0,0); }
+
+        // registers the materials the object uses in table (its scene's), so its hits carry handles into
+        // that table; objects holding others pass table on to them.
+        virtual void register_materials(MaterialTable &table) {}
 };
 
 class Translate : public Object {
@@ -54,7 +128,12 @@ class Translate : public Object {
 
         AABB get_AABB() const override { return aabb; }
 
+        void register_materials(MaterialTable &table) override { obj->register_materials(table); }
+
     private:
+        friend class SceneSnapshot;
+        Translate() {}
+
         shared_ptr<Object> obj;
         Vector3d offset;
         AABB aabb;
@@ -116,27 +195,29 @@ class RotateY : public Object {
             if(!obj->intersect(rotated_ri, t_interval, isect))
                 return false;
 
-            isect.p = Point3d(
-                (cos_theta * isect.p.x()) + (sin_theta * isect.p.z()),
-                isect.p.y(),
-                (-sin_theta * isect.p.x()) + (cos_theta * isect.p.z())
-            );
-
-            isect.normal = Vector3d(
-                (cos_theta * isect.normal.x()) + (sin_theta * isect.normal.z()),
-                isect.normal.y(),
-                (-sin_theta * isect.normal.x()) + (cos_theta * isect.normal.z())
-            );
+            isect.p = to_world(isect.p);
+            isect.normal = to_world(isect.normal);
+            isect.set_geometric_normal(to_world(isect.geometric_normal()));
 
             return true;
         }
 
         AABB get_AABB() const override { return aabb; }
 
+        void register_materials(MaterialTable &table) override { obj->register_materials(table); }
+
     private:
+        friend class SceneSnapshot;
+        RotateY() {}
+
         shared_ptr<Object> obj;
         double cos_theta, sin_theta;
         AABB aabb;
+
+        // rotates a point or direction from object space back to world space.
+        Vector3d to_world(const Vector3d &n) const {
+            return Vector3d((cos_theta * n.x()) + (sin_theta * n.z()), n.y(), (-sin_theta * n.x()) + (cos_theta * n.z()));
+        }
 };
 
 #endif
\ No newline at end of file
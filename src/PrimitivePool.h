@@ -0,0 +1,549 @@
+#ifndef PRIMITIVE_POOL_H
+#define PRIMITIVE_POOL_H
+
+#include "AABB.h"
+#include "BVH.h"
+#include "LinearBVH.h"
+#include "Object.h"
+#include "Sphere.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define RT_POOL_SSE 1
+    #include <emmintrin.h>
+    #ifdef __AVX__
+        #include <immintrin.h>
+    #endif
+#else
+    #define RT_POOL_SSE 0
+#endif
+
+// primitives a pool kernel tests at once, matching the default leaf size.
+const int pool_lanes = 4;
+
+// 4 Reals operated on together: one SSE register of floats, one AVX register of doubles (or two SSE2
+// ones without AVX), or a plain array without SSE. comparisons return masks of the same type, all bits
+// set in the lanes where they hold; NaN lanes compare false.
+#if RT_POOL_SSE && defined(RT_SINGLE_PRECISION)
+
+struct PoolLanes { __m128 v; };
+
+inline PoolLanes lanes_load(const Real *p) { return PoolLanes{ _mm_loadu_ps(p) }; }
+inline PoolLanes lanes_set(Real x)         { return PoolLanes{ _mm_set1_ps(x) }; }
+inline void lanes_store(Real *p, PoolLanes a) { _mm_storeu_ps(p, a.v); }
+
+inline PoolLanes operator+(PoolLanes a, PoolLanes b) { return PoolLanes{ _mm_add_ps(a.v, b.v) }; }
+inline PoolLanes operator-(PoolLanes a, PoolLanes b) { return PoolLanes{ _mm_sub_ps(a.v, b.v) }; }
+inline PoolLanes operator*(PoolLanes a, PoolLanes b) { return PoolLanes{ _mm_mul_ps(a.v, b.v) }; }
+inline PoolLanes operator/(PoolLanes a, PoolLanes b) { return PoolLanes{ _mm_div_ps(a.v, b.v) }; }
+inline PoolLanes operator<(PoolLanes a, PoolLanes b)  { return PoolLanes{ _mm_cmplt_ps(a.v, b.v) }; }
+inline PoolLanes operator<=(PoolLanes a, PoolLanes b) { return PoolLanes{ _mm_cmple_ps(a.v, b.v) }; }
+inline PoolLanes operator&(PoolLanes a, PoolLanes b) { return PoolLanes{ _mm_and_ps(a.v, b.v) }; }
+inline PoolLanes operator|(PoolLanes a, PoolLanes b) { return PoolLanes{ _mm_or_ps(a.v, b.v) }; }
+
+inline PoolLanes lanes_sqrt(PoolLanes a) { return PoolLanes{ _mm_sqrt_ps(a.v) }; }
+inline PoolLanes lanes_abs(PoolLanes a)  { return PoolLanes{ _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v) }; }
+
+// mask ? a : b, per lane.
+inline PoolLanes lanes_select(PoolLanes mask, PoolLanes a, PoolLanes b) {
+    return PoolLanes{ _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)) };
+}
+
+// bit k is set if lane k of mask is.
+inline int lanes_bits(PoolLanes mask) { return _mm_movemask_ps(mask.v); }
+
+#elif RT_POOL_SSE && defined(__AVX__)
+
+struct PoolLanes { __m256d v; };
+
+inline PoolLanes lanes_load(const Real *p) { return PoolLanes{ _mm256_loadu_pd(p) }; }
+inline PoolLanes lanes_set(Real x)         { return PoolLanes{ _mm256_set1_pd(x) }; }
+inline void lanes_store(Real *p, PoolLanes a) { _mm256_storeu_pd(p, a.v); }
+
+inline PoolLanes operator+(PoolLanes a, PoolLanes b) { return PoolLanes{ _mm256_add_pd(a.v, b.v) }; }
+inline PoolLanes operator-(PoolLanes a, PoolLanes b) { return PoolLanes{ _mm256_sub_pd(a.v, b.v) }; }
+inline PoolLanes operator*(PoolLanes a, PoolLanes b) { return PoolLanes{ _mm256_mul_pd(a.v, b.v) }; }
+inline PoolLanes operator/(PoolLanes a, PoolLanes b) { return PoolLanes{ _mm256_div_pd(a.v, b.v) }; }
+inline PoolLanes operator<(PoolLanes a, PoolLanes b)  { return PoolLanes{ _mm256_cmp_pd(a.v, b.v, _CMP_LT_OQ) }; }
+inline PoolLanes operator<=(PoolLanes a, PoolLanes b) { return PoolLanes{ _mm256_cmp_pd(a.v, b.v, _CMP_LE_OQ) }; }
+inline PoolLanes operator&(PoolLanes a, PoolLanes b) { return PoolLanes{ _mm256_and_pd(a.v, b.v) }; }
+inline PoolLanes operator|(PoolLanes a, PoolLanes b) { return PoolLanes{ _mm256_or_pd(a.v, b.v) }; }
+
+inline PoolLanes lanes_sqrt(PoolLanes a) { return PoolLanes{ _mm256_sqrt_pd(a.v) }; }
+inline PoolLanes lanes_abs(PoolLanes a)  { return PoolLanes{ _mm256_andnot_pd(_mm256_set1_pd(-0.0), a.v) }; }
+
+inline PoolLanes lanes_select(PoolLanes mask, PoolLanes a, PoolLanes b) {
+    return PoolLanes{ _mm256_blendv_pd(b.v, a.v, mask.v) };
+}
+
+inline int lanes_bits(PoolLanes mask) { return _mm256_movemask_pd(mask.v); }
+
+#elif RT_POOL_SSE
+
+struct PoolLanes { __m128d lo, hi; }; // lanes (0, 1) & (2, 3).
+
+#define RT_POOL_LANES_OP(name, intrinsic) \
+    inline PoolLanes name(PoolLanes a, PoolLanes b) { \
+        return PoolLanes{ intrinsic(a.lo, b.lo), intrinsic(a.hi, b.hi) }; \
+    }
+
+RT_POOL_LANES_OP(operator+, _mm_add_pd)
+RT_POOL_LANES_OP(operator-, _mm_sub_pd)
+RT_POOL_LANES_OP(operator*, _mm_mul_pd)
+RT_POOL_LANES_OP(operator/, _mm_div_pd)
+RT_POOL_LANES_OP(operator<, _mm_cmplt_pd)
+RT_POOL_LANES_OP(operator<=, _mm_cmple_pd)
+RT_POOL_LANES_OP(operator&, _mm_and_pd)
+RT_POOL_LANES_OP(operator|, _mm_or_pd)
+
+#undef RT_POOL_LANES_OP
+
+inline PoolLanes lanes_load(const Real *p) { return PoolLanes{ _mm_loadu_pd(p), _mm_loadu_pd(p + 2) }; }
+inline PoolLanes lanes_set(Real x)         { return PoolLanes{ _mm_set1_pd(x), _mm_set1_pd(x) }; }
+inline void lanes_store(Real *p, PoolLanes a) { _mm_storeu_pd(p, a.lo); _mm_storeu_pd(p + 2, a.hi); }
+
+inline PoolLanes lanes_sqrt(PoolLanes a) { return PoolLanes{ _mm_sqrt_pd(a.lo), _mm_sqrt_pd(a.hi) }; }
+
+inline PoolLanes lanes_abs(PoolLanes a) {
+    __m128d sign = _mm_set1_pd(-0.0);
+    return PoolLanes{ _mm_andnot_pd(sign, a.lo), _mm_andnot_pd(sign, a.hi) };
+}
+
+inline PoolLanes lanes_select(PoolLanes mask, PoolLanes a, PoolLanes b) {
+    return PoolLanes{ _mm_or_pd(_mm_and_pd(mask.lo, a.lo), _mm_andnot_pd(mask.lo, b.lo)),
+                      _mm_or_pd(_mm_and_pd(mask.hi, a.hi), _mm_andnot_pd(mask.hi, b.hi)) };
+}
+
+inline int lanes_bits(PoolLanes mask) { return _mm_movemask_pd(mask.lo) | (_mm_movemask_pd(mask.hi) << 2); }
+
+#else
+
+// plain lanes; a mask lane is 1 or 0.
+struct PoolLanes { Real v[pool_lanes]; };
+
+#define RT_POOL_LANES_OP(name, expr) \
+    inline PoolLanes name(PoolLanes a, PoolLanes b) { \
+        PoolLanes r; \
+        for (int k = 0; k < pool_lanes; k++) r.v[k] = (expr); \
+        return r; \
+    }
+
+RT_POOL_LANES_OP(operator+, a.v[k] + b.v[k])
+RT_POOL_LANES_OP(operator-, a.v[k] - b.v[k])
+RT_POOL_LANES_OP(operator*, a.v[k] * b.v[k])
+RT_POOL_LANES_OP(operator/, a.v[k] / b.v[k])
+RT_POOL_LANES_OP(operator<, Real(a.v[k] < b.v[k]))
+RT_POOL_LANES_OP(operator<=, Real(a.v[k] <= b.v[k]))
+RT_POOL_LANES_OP(operator&, Real(a.v[k] != 0 && b.v[k] != 0))
+RT_POOL_LANES_OP(operator|, Real(a.v[k] != 0 || b.v[k] != 0))
+
+#undef RT_POOL_LANES_OP
+
+inline PoolLanes lanes_load(const Real *p) {
+    PoolLanes r;
+    for (int k = 0; k < pool_lanes; k++) r.v[k] = p[k];
+    return r;
+}
+
+inline PoolLanes lanes_set(Real x) {
+    PoolLanes r;
+    for (int k = 0; k < pool_lanes; k++) r.v[k] = x;
+    return r;
+}
+
+inline void lanes_store(Real *p, PoolLanes a) {
+    for (int k = 0; k < pool_lanes; k++) p[k] = a.v[k];
+}
+
+inline PoolLanes lanes_sqrt(PoolLanes a) {
+    for (int k = 0; k < pool_lanes; k++) a.v[k] = std::sqrt(a.v[k]);
+    return a;
+}
+
+inline PoolLanes lanes_abs(PoolLanes a) {
+    for (int k = 0; k < pool_lanes; k++) a.v[k] = std::fabs(a.v[k]);
+    return a;
+}
+
+inline PoolLanes lanes_select(PoolLanes mask, PoolLanes a, PoolLanes b) {
+    for (int k = 0; k < pool_lanes; k++) a.v[k] = (mask.v[k] != 0) ? a.v[k] : b.v[k];
+    return a;
+}
+
+inline int lanes_bits(PoolLanes mask) {
+    int bits = 0;
+    for (int k = 0; k < pool_lanes; k++) bits |= (mask.v[k] != 0) << k;
+    return bits;
+}
+
+#endif
+
+// mask of the first `valid` lanes.
+inline PoolLanes lanes_first(int valid) {
+    static const Real index[pool_lanes] = { 0, 1, 2, 3 };
+    return lanes_load(index) < lanes_set(Real(valid));
+}
+
+// the distinct materials of a buffer's primitives; each primitive keeps the slot of its own, so registering
+// them (see Object::register_materials) touches each material once however many primitives share it.
+class MaterialSlots {
+    public:
+        // returns m's slot, adding it if it's new.
+        uint32_t add(shared_ptr<Material> m) {
+            auto it = slots.find(m.get());
+            if (it != slots.end()) return it->second;
+            uint32_t slot = uint32_t(refs.size());
+            slots[m.get()] = slot;
+            refs.emplace_back(std::move(m));
+            return slot;
+        }
+
+        void register_in(MaterialTable &table) {
+            for (auto &ref : refs) ref.register_in(table);
+        }
+
+        MaterialHandle handle(uint32_t slot) const { return refs[slot].handle; }
+
+        const shared_ptr<Material> &operator[](uint32_t slot) const { return refs[slot].ptr; }
+
+    private:
+        std::vector<MaterialRef> refs;
+        std::unordered_map<const Material*, uint32_t> slots;
+};
+
+// SoA storage of spheres: one array per component, so a batch loads `pool_lanes` centers at once.
+class SphereBuffer {
+    public:
+        // static sphere
+        void add(const Point3d &center, double radius, shared_ptr<Material> m) {
+            add(center, center, radius, m);
+        }
+
+        // moving sphere, from center1 (t = 0) to center2 (t = 1).
+        void add(const Point3d &center1, const Point3d &center2, double radius, shared_ptr<Material> m) {
+            for (int a = 0; a < 3; a++) {
+                center[a].push_back(center1[a]);
+                motion[a].push_back(center2[a] - center1[a]);
+            }
+            this->radius.push_back(Real(std::fmax(0, radius)));
+            material_slot.push_back(materials.add(m));
+        }
+
+        size_t size() const { return material_slot.size(); }
+
+        void register_materials(MaterialTable &table) { materials.register_in(table); }
+
+        AABB bounds(size_t i) const {
+            Vector3d r_vec(radius[i], radius[i], radius[i]);
+            Point3d c1 = center_at(i, 0), c2 = center_at(i, 1);
+            return AABB(AABB(c1 - r_vec, c1 + r_vec), AABB(c2 - r_vec, c2 + r_vec));
+        }
+
+        // puts the spheres in the given order (order[k] is the old index of the new k-th sphere) and pads
+        // the arrays to a whole batch past the end, so a batch never reads out of bounds.
+        void reorder(const std::vector<size_t> &order) {
+            for (int a = 0; a < 3; a++) {
+                center[a] = permute(center[a], order);
+                motion[a] = permute(motion[a], order);
+            }
+            radius = permute(radius, order);
+            material_slot = permute(material_slot, order);
+            for (int a = 0; a < 3; a++) {
+                center[a].resize(order.size() + pool_lanes, 0);
+                motion[a].resize(order.size() + pool_lanes, 0);
+            }
+            radius.resize(order.size() + pool_lanes, 0);
+        }
+
+        // intersects spheres [first, first + count), shrinking t_interval.max to the closest hit.
+        // same test as Sphere::intersect, so a pool renders exactly like the equivalent Sphere objects.
+        bool intersect(uint32_t first, uint32_t count, const Ray &ri, Interval &t_interval,
+                       Intersection &isect) const
+        {
+            RT_STAT_ADD(SphereTests, count);
+            const Real ox = ri.origin()[0], oy = ri.origin()[1], oz = ri.origin()[2];
+            const Real dx = ri.direction()[0], dy = ri.direction()[1], dz = ri.direction()[2];
+            const Real time = Real(ri.time());
+            const Real a = ri.direction().norm_squared();
+
+            const Real *cx = center[0].data(), *cy = center[1].data(), *cz = center[2].data();
+            const Real *mx = motion[0].data(), *my = motion[1].data(), *mz = motion[2].data();
+
+            Real closest = t_interval.max;
+            uint32_t best = UINT32_MAX;
+
+            const PoolLanes o_x = lanes_set(ox), o_y = lanes_set(oy), o_z = lanes_set(oz);
+            const PoolLanes d_x = lanes_set(dx), d_y = lanes_set(dy), d_z = lanes_set(dz);
+            const PoolLanes t_lanes = lanes_set(time), a_lanes = lanes_set(a), zero = lanes_set(0);
+            const PoolLanes t_min = lanes_set(t_interval.min);
+
+            for (uint32_t base = first; base < first + count; base += pool_lanes) {
+                const int valid = int(std::min<uint32_t>(pool_lanes, first + count - base));
+                const PoolLanes t_max = lanes_set(closest);
+
+                PoolLanes ocx = (lanes_load(cx + base) + t_lanes*lanes_load(mx + base)) - o_x;
+                PoolLanes ocy = (lanes_load(cy + base) + t_lanes*lanes_load(my + base)) - o_y;
+                PoolLanes ocz = (lanes_load(cz + base) + t_lanes*lanes_load(mz + base)) - o_z;
+                PoolLanes r = lanes_load(radius.data() + base);
+                PoolLanes h = d_x*ocx + d_y*ocy + d_z*ocz;
+                PoolLanes c = (ocx*ocx + ocy*ocy + ocz*ocz) - r*r;
+                PoolLanes discriminant = h*h - a_lanes*c;
+
+                // a negative discriminant gives NaN roots, which fail every comparison below.
+                PoolLanes sqrtd = lanes_sqrt(discriminant);
+                PoolLanes t_near = (h - sqrtd) / a_lanes;
+                PoolLanes t_far = (h + sqrtd) / a_lanes;
+                PoolLanes near_ok = (t_min < t_near) & (t_near < t_max);
+                PoolLanes far_ok = (t_min < t_far) & (t_far < t_max);
+
+                PoolLanes hit = (near_ok | far_ok) & (zero <= discriminant) & lanes_first(valid);
+                int bits = lanes_bits(hit);
+                if (bits == 0) continue;
+
+                Real t_lane[pool_lanes];
+                lanes_store(t_lane, lanes_select(near_ok, t_near, t_far));
+                for (int k = 0; k < pool_lanes; k++) {
+                    if ((bits >> k & 1) && t_lane[k] < closest) {
+                        closest = t_lane[k];
+                        best = base + k;
+                    }
+                }
+            }
+
+            if (best == UINT32_MAX) return false;
+
+            // only the closest sphere fills in the hit record.
+            Point3d current_center = center_at(best, ri.time());
+            isect.p = ri.at(closest);
+            isect.distance = closest;
+            auto outward_normal = (isect.p - current_center) / radius[best];
+            isect.set_normal(ri, outward_normal);
+            Sphere::get_tex_uv(outward_normal, isect.tex_u, isect.tex_v);
+            isect.material = materials.handle(material_slot[best]);
+
+            t_interval.max = closest;
+            return true;
+        }
+
+    private:
+        friend class SceneSnapshot;
+
+        std::vector<Real> center[3], motion[3], radius;
+        std::vector<uint32_t> material_slot; // per sphere.
+        MaterialSlots materials;
+
+        Point3d center_at(size_t i, double time) const {
+            return Point3d(center[0][i] + Real(time)*motion[0][i],
+                           center[1][i] + Real(time)*motion[1][i],
+                           center[2][i] + Real(time)*motion[2][i]);
+        }
+
+        template <typename T>
+        static std::vector<T> permute(const std::vector<T> &v, const std::vector<size_t> &order) {
+            std::vector<T> out;
+            out.reserve(order.size() + pool_lanes);
+            for (size_t i : order) out.push_back(v[i]);
+            return out;
+        }
+};
+
+// SoA storage of quads: Q, the edges u & v, w = n / (n . n), the unit normal & the plane's D.
+class QuadBuffer {
+    public:
+        void add(const Point3d &Q, const Vector3d &u, const Vector3d &v, shared_ptr<Material> m) {
+            Vector3d n = crossProduct(u, v);
+            Vector3d normal = normalize(n);
+            Vector3d w = n / dotProduct(n, n);
+            for (int a = 0; a < 3; a++) {
+                this->Q[a].push_back(Q[a]);
+                this->u[a].push_back(u[a]);
+                this->v[a].push_back(v[a]);
+                this->w[a].push_back(w[a]);
+                this->normal[a].push_back(normal[a]);
+            }
+            D.push_back(dotProduct(Q, normal));
+            material_slot.push_back(materials.add(m));
+        }
+
+        size_t size() const { return material_slot.size(); }
+
+        void register_materials(MaterialTable &table) { materials.register_in(table); }
+
+        AABB bounds(size_t i) const {
+            Point3d q = vec(Q, i);
+            Vector3d eu = vec(u, i), ev = vec(v, i);
+            return AABB(AABB(q, q + eu + ev), AABB(q + eu, q + ev));
+        }
+
+        void reorder(const std::vector<size_t> &order) {
+            std::vector<Real> *arrays[] = { &Q[0], &Q[1], &Q[2], &u[0], &u[1], &u[2], &v[0], &v[1], &v[2],
+                                            &w[0], &w[1], &w[2], &normal[0], &normal[1], &normal[2], &D };
+            for (auto *array : arrays) {
+                std::vector<Real> out;
+                out.reserve(order.size() + pool_lanes);
+                for (size_t i : order) out.push_back((*array)[i]);
+                out.resize(order.size() + pool_lanes, 0);
+                array->swap(out);
+            }
+
+            std::vector<uint32_t> out;
+            out.reserve(order.size());
+            for (size_t i : order) out.push_back(material_slot[i]);
+            material_slot.swap(out);
+        }
+
+        // intersects quads [first, first + count), shrinking t_interval.max to the closest hit.
+        // same test as Quad::intersect.
+        bool intersect(uint32_t first, uint32_t count, const Ray &ri, Interval &t_interval,
+                       Intersection &isect) const
+        {
+            RT_STAT_ADD(QuadTests, count);
+            const Real ox = ri.origin()[0], oy = ri.origin()[1], oz = ri.origin()[2];
+            const Real dx = ri.direction()[0], dy = ri.direction()[1], dz = ri.direction()[2];
+
+            Real closest = t_interval.max;
+            Real best_alpha = 0, best_beta = 0;
+            uint32_t best = UINT32_MAX;
+
+            const PoolLanes o_x = lanes_set(ox), o_y = lanes_set(oy), o_z = lanes_set(oz);
+            const PoolLanes d_x = lanes_set(dx), d_y = lanes_set(dy), d_z = lanes_set(dz);
+            const PoolLanes zero = lanes_set(0), one = lanes_set(1), min_denom = lanes_set(Real(1e-8));
+            const PoolLanes t_min = lanes_set(t_interval.min);
+
+            for (uint32_t base = first; base < first + count; base += pool_lanes) {
+                const int valid = int(std::min<uint32_t>(pool_lanes, first + count - base));
+                const PoolLanes t_max = lanes_set(closest);
+                auto load = [base](const std::vector<Real> &c) { return lanes_load(c.data() + base); };
+
+                PoolLanes nx = load(normal[0]), ny = load(normal[1]), nz = load(normal[2]);
+                PoolLanes denom = d_x*nx + d_y*ny + d_z*nz;
+                PoolLanes t = (load(D) - (o_x*nx + o_y*ny + o_z*nz)) / denom;
+
+                // p = ri.at(t) - Q.
+                PoolLanes px = (o_x + t*d_x) - load(Q[0]);
+                PoolLanes py = (o_y + t*d_y) - load(Q[1]);
+                PoolLanes pz = (o_z + t*d_z) - load(Q[2]);
+                PoolLanes ux = load(u[0]), uy = load(u[1]), uz = load(u[2]);
+                PoolLanes vx = load(v[0]), vy = load(v[1]), vz = load(v[2]);
+                PoolLanes wx = load(w[0]), wy = load(w[1]), wz = load(w[2]);
+
+                // alpha = w . (p x v), beta = w . (u x p).
+                PoolLanes alpha = wx*(py*vz - vy*pz) + wy*(pz*vx - vz*px) + wz*(px*vy - vx*py);
+                PoolLanes beta  = wx*(uy*pz - py*uz) + wy*(uz*px - pz*ux) + wz*(ux*py - px*uy);
+
+                PoolLanes hit = (min_denom <= lanes_abs(denom)) & (t_min <= t) & (t <= t_max)
+                              & (zero <= alpha) & (alpha <= one) & (zero <= beta) & (beta <= one)
+                              & lanes_first(valid);
+                int bits = lanes_bits(hit);
+                if (bits == 0) continue;
+
+                Real t_lane[pool_lanes], alpha_lane[pool_lanes], beta_lane[pool_lanes];
+                lanes_store(t_lane, t);
+                lanes_store(alpha_lane, alpha);
+                lanes_store(beta_lane, beta);
+
+                // note: <= keeps the last of equally close quads, as testing them one by one would.
+                for (int k = 0; k < pool_lanes; k++) {
+                    if ((bits >> k & 1) && t_lane[k] <= closest) {
+                        closest = t_lane[k];
+                        best_alpha = alpha_lane[k];
+                        best_beta = beta_lane[k];
+                        best = base + k;
+                    }
+                }
+            }
+
+            if (best == UINT32_MAX) return false;
+
+            isect.p = ri.at(closest);
+            isect.distance = closest;
+            isect.set_normal(ri, vec(normal, best));
+            isect.tex_u = best_alpha;
+            isect.tex_v = best_beta;
+            isect.material = materials.handle(material_slot[best]);
+
+            t_interval.max = closest;
+            return true;
+        }
+
+    private:
+        friend class SceneSnapshot;
+
+        std::vector<Real> Q[3], u[3], v[3], w[3], normal[3], D;
+        std::vector<uint32_t> material_slot; // per quad.
+        MaterialSlots materials;
+
+        static Vector3d vec(const std::vector<Real> (&c)[3], size_t i) {
+            return Vector3d(c[0][i], c[1][i], c[2][i]);
+        }
+};
+
+// a BVH over one kind of primitive, stored by value in a SoA Buffer instead of as separate objects.
+// its leaves are ranges of the buffer, tested in batches by the buffer's kernel, so a leaf costs no
+// virtual calls or pointer chases. call build() once all primitives are added (none can be added after).
+// note: the BVH is always binary, opts.layout is ignored (see BVHLayout).
+// note: pools don't take part in light sampling; keep emissive primitives as separate objects.
+template <typename Buffer>
+class PrimitivePool : public BVHAccel {
+    public:
+        // forwards to Buffer::add, e.g. SpherePool::add(center, radius, material).
+        template <typename... Args>
+        void add(Args&&... args) { buffer.add(std::forward<Args>(args)...); }
+
+        size_t size() const { return n_primitives; }
+
+        void build(const BVHBuildOptions &opts = BVHBuildOptions()) {
+            n_primitives = buffer.size();
+            nodes = SharedArray<LinearBVHNode>();
+            aabb = AABB::empty;
+            if (n_primitives == 0) return;
+
+            std::vector<BVHPrimitive> prims(n_primitives);
+            for (size_t i = 0; i < n_primitives; i++) {
+                prims[i].aabb = buffer.bounds(i);
+                prims[i].centroid = prims[i].aabb.Centriod();
+                prims[i].index = i;
+            }
+            auto tree = build_bvh_tree(prims, 0, prims.size(), opts);
+
+            std::vector<size_t> order(n_primitives);
+            for (size_t i = 0; i < n_primitives; i++) order[i] = prims[i].index;
+            buffer.reorder(order);
+
+            std::vector<LinearBVHNode> built;
+            flatten_linear_bvh(*tree.root, built);
+            nodes = SharedArray<LinearBVHNode>(std::move(built));
+            aabb = tree.root->aabb;
+        }
+
+        bool intersect(const Ray &ri, Interval t_interval, Intersection &isect) const override {
+            return traverse_linear_bvh(nodes, ri, t_interval, [&](uint32_t first, uint32_t count, Interval &t) {
+                return buffer.intersect(first, count, ri, t, isect);
+            });
+        }
+
+        size_t node_count() const override { return nodes.size(); }
+
+        double sah_cost(const BVHBuildOptions &opts) const override {
+            if (nodes.empty()) return 0.0;
+            return linear_bvh_cost(nodes, 0, opts);
+        }
+
+        void register_materials(MaterialTable &table) override { buffer.register_materials(table); }
+
+    private:
+        friend class SceneSnapshot;
+
+        Buffer buffer;
+        size_t n_primitives = 0;
+        SharedArray<LinearBVHNode> nodes;
+};
+
+using SpherePool = PrimitivePool<SphereBuffer>;
+using QuadPool = PrimitivePool<QuadBuffer>;
+
+#endif
@@ -2,32 +2,35 @@
 #define QUAD_H
 
 #include "Object.h"
+#include "Material.h"
 #include "Scene.h"
 
 class Quad : public Object {
     public:
         Quad(const Point3d &Q, const Vector3d &u, const Vector3d &v, shared_ptr<Material> m)
-          : Q(Q), u(u), v(v), m(m)
+          : Q(Q), u(u), v(v), material(m)
         {
             Vector3d n = crossProduct(u, v);
             normal = normalize(n);
             D = dotProduct(Q, normal);
             w = n / dotProduct(n, n);
+            area = n.norm();
 
             set_AABB();
         }
 
         bool intersect(const Ray &ri, Interval t_interval, Intersection &isect) const override {
+            RT_STAT(QuadTests);
 
-            double denom = dotProduct(ri.direction(), normal);
+            Real denom = dotProduct(ri.direction(), normal);
             if (std::fabs(denom) < 1e-8) 
                 return false; 
             
-            double t = (D - dotProduct(ri.origin(), normal)) / denom;
+            Real t = (D - dotProduct(ri.origin(), normal)) / denom;
             Point3d P = ri.at(t);
             Vector3d p = P - Q;
-            double alpha = dotProduct(w, crossProduct(p, v));
-            double beta = dotProduct(w, crossProduct(u, p));
+            Real alpha = dotProduct(w, crossProduct(p, v));
+            Real beta = dotProduct(w, crossProduct(u, p));
             if (!t_interval.contains(t) || !inside_quad(alpha, beta))
                 return false;
 
@@ -36,7 +39,7 @@ class Quad : public Object {
             isect.set_normal(ri, normal);
             isect.tex_u = alpha;
             isect.tex_v = beta;
-            isect.m = m;
+            isect.material = material.handle;
 
             return true;
         }
@@ -49,17 +52,41 @@ class Quad : public Object {
         }
 
         AABB get_AABB() const override { return aabb; }
+
+        bool is_emissive() const override { return material.ptr->is_emissive(); }
+
+        void register_materials(MaterialTable &table) override { material.register_in(table); }
+
+        // the quad is sampled uniformly by area, converted to solid angle: pdf = dist^2 / (cos * area).
+        double pdf_value(const Ray &ri) const override {
+            Intersection isect;
+            if (!this->intersect(ri, Interval(0, infinity), isect))
+                return 0;
+
+            auto dist_squared = isect.distance * isect.distance * ri.direction().norm_squared();
+            auto cosine = std::fabs(dotProduct(ri.direction(), normal)) / ri.direction().norm();
+            return dist_squared / (cosine * area);
+        }
+
+        Vector3d sample_towards(const Point3d &origin, double time) const override {
+            auto p = Q + (sample_double() * u) + (sample_double() * v);
+            return normalize(p - origin);
+        }
     
     private:
+        friend class SceneSnapshot;
+        Quad() {}
+
         Point3d Q; // quad's left-bottom vertice.
         Vector3d u, v; // two edge vectors from Q.
         Vector3d w;
-        shared_ptr<Material> m;
+        MaterialRef material;
         AABB aabb;
         Vector3d normal; // quad's normal.
-        double D; // the D for quad's implicit fomula: ax + by + cz = D.
+        Real D; // the D for quad's implicit fomula: ax + by + cz = D.
+        Real area;
 
-        bool inside_quad(double alpha, double beta) const {
+        bool inside_quad(Real alpha, Real beta) const {
             Interval unit_interval = Interval(0, 1);
             if (!unit_interval.contains(alpha) || !unit_interval.contains(beta))
                 return false;
@@ -68,8 +95,9 @@ class Quad : public Object {
         }
 };
 
-// returns the 3D box (6 sides) that contains the two opposite vertices p1 & p2.
-inline shared_ptr<Scene> box(const Point3d &p1, const Point3d &p2, shared_ptr<Material> m) {
+// calls side(Q, u, v) for each of the 6 sides of the 3D box with the opposite vertices p1 & p2.
+template <typename SideFn>
+inline void for_each_box_side(const Point3d &p1, const Point3d &p2, SideFn &&side) {
     auto x = p1.x() < p2.x() ? Interval(p1.x(), p2.x()) : Interval(p2.x(), p1.x());
     auto y = p1.y() < p2.y() ? Interval(p1.y(), p2.y()) : Interval(p2.y(), p1.y());
     auto z = p1.z() < p2.z() ? Interval(p1.z(), p2.z()) : Interval(p2.z(), p1.z());
@@ -78,14 +106,22 @@ inline shared_ptr<Scene> box(const Point3d &p1, const Point3d &p2, shared_ptr<Ma
     auto dy = Vector3d(0, y.max - y.min, 0);
     auto dz = Vector3d(0, 0, z.max - z.min);
 
-    auto sides = make_shared<Scene>();
+    side(Point3d(x.min, y.min, z.max),  dx,  dy); // front
+    side(Point3d(x.max, y.min, z.max), -dz,  dy); // right
+    side(Point3d(x.max, y.min, z.min), -dx,  dy); // back
+    side(Point3d(x.min, y.min, z.min),  dz,  dy); // left
+    side(Point3d(x.min, y.max, z.max),  dx, -dz); // top
+    side(Point3d(x.min, y.min, z.min),  dx,  dz); // bottom
+}
+
+// returns the 3D box (6 sides) that contains the two opposite vertices p1 & p2.
+// the box & its sides are allocated from the enclosing scene's arena & share its materials.
+inline shared_ptr<Scene> box(const Point3d &p1, const Point3d &p2, shared_ptr<Material> m, const Scene &scene) {
+    auto sides = make_shared_in<Scene>(scene.arena, scene.arena, scene.materials);
 
-    sides->add(make_shared<Quad>(Point3d(x.min, y.min, z.max),  dx,  dy, m)); // front
-    sides->add(make_shared<Quad>(Point3d(x.max, y.min, z.max), -dz,  dy, m)); // right
-    sides->add(make_shared<Quad>(Point3d(x.max, y.min, z.min), -dx,  dy, m)); // back
-    sides->add(make_shared<Quad>(Point3d(x.min, y.min, z.min),  dz,  dy, m)); // left
-    sides->add(make_shared<Quad>(Point3d(x.min, y.max, z.max),  dx, -dz, m)); // top
-    sides->add(make_shared<Quad>(Point3d(x.min, y.min, z.min),  dx,  dz, m)); // bottom
+    for_each_box_side(p1, p2, [&](const Point3d &Q, const Vector3d &u, const Vector3d &v) {
+        sides->add<Quad>(Q, u, v, m);
+    });
 
     sides->buildBVH();
 
@@ -0,0 +1,94 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "Object.h"
+
+#include <algorithm>
+#include <cmath>
+
+// a bundle of coherent rays (e.g. the camera rays of a pixel block) traced through a BVH together.
+// the per-ray results are kept in the packet, so a traversal can narrow each ray's t range as it goes.
+class RayPacket {
+    public:
+        static const int max_size = 64; // an 8x8 pixel block.
+
+        int size = 0;
+        Ray rays[max_size];
+        double inv_dir[max_size][3];
+        int dir_is_neg[max_size][3];
+        double t_max[max_size];          // distance of the closest hit so far (or the range's max).
+        bool hit[max_size];
+        Intersection isect[max_size];
+
+        void clear() { size = 0; }
+
+        void add(const Ray &ri) {
+            rays[size] = ri;
+            for (int a = 0; a < 3; a++) {
+                inv_dir[size][a] = 1 / ri.direction()[a];
+                dir_is_neg[size][a] = inv_dir[size][a] < 0;
+            }
+            size++;
+        }
+
+        // resets the results and computes the packet bounds; call once all rays are added.
+        void begin(const Interval &t) {
+            frustum = size > 0;
+            for (int a = 0; a < 3; a++) {
+                common_neg[a] = (size > 0) && dir_is_neg[0][a];
+                orig_min[a] = inv_min[a] = +infinity;
+                orig_max[a] = inv_max[a] = -infinity;
+            }
+
+            for (int k = 0; k < size; k++) {
+                t_max[k] = t.max;
+                hit[k] = false;
+                for (int a = 0; a < 3; a++) {
+                    double inv = inv_dir[k][a];
+                    if (!std::isfinite(inv) || dir_is_neg[k][a] != common_neg[a]) frustum = false;
+                    orig_min[a] = std::fmin(orig_min[a], rays[k].origin()[a]);
+                    orig_max[a] = std::fmax(orig_max[a], rays[k].origin()[a]);
+                    inv_min[a] = std::fmin(inv_min[a], inv);
+                    inv_max[a] = std::fmax(inv_max[a], inv);
+                }
+            }
+        }
+
+        // largest distance any ray of the packet still accepts.
+        double packet_t_max() const {
+            double t = -infinity;
+            for (int k = 0; k < size; k++) t = std::fmax(t, t_max[k]);
+            return t;
+        }
+
+        // returns false only if no ray of the packet can enter the box [lo, hi] within [t_min, t_max].
+        // interval arithmetic over the packet's origins & inverse directions bounds every ray's slab
+        // distances, so whole nodes are culled with one test. always true unless the rays share signs.
+        bool frustum_overlaps(const float lo[3], const float hi[3], double t_min, double t_max) const {
+            if (!frustum) return true;
+            for (int a = 0; a < 3; a++) {
+                const float *near_plane = common_neg[a] ? hi : lo;
+                const float *far_plane  = common_neg[a] ? lo : hi;
+
+                // smallest entry & largest exit distance of any ray on this axis.
+                t_min = std::max(t_min, product_bounds(near_plane[a] - orig_max[a], near_plane[a] - orig_min[a], a).min);
+                t_max = std::min(t_max, product_bounds(far_plane[a] - orig_max[a], far_plane[a] - orig_min[a], a).max);
+            }
+            return t_min <= t_max;
+        }
+
+    private:
+        // packet bounds, only valid if every ray's direction has the same non-zero sign on each axis.
+        bool   frustum = false;
+        int    common_neg[3];
+        double orig_min[3], orig_max[3];
+        double inv_min[3], inv_max[3];
+
+        // bounds of [d0, d1] * [inv_min, inv_max] on axis a.
+        IntervalT<double> product_bounds(double d0, double d1, int a) const {
+            double p[4] = { d0 * inv_min[a], d0 * inv_max[a], d1 * inv_min[a], d1 * inv_max[a] };
+            return IntervalT<double>(*std::min_element(p, p+4), *std::max_element(p, p+4));
+        }
+};
+
+#endif
@@ -1,75 +1,799 @@
 #ifndef RENDERER_H
 #define RENDERER_H
 
+#include "Framebuffer.h"
+#include "Heatmap.h"
+#include "MappedFile.h"
 #include "Object.h"
 #include "Material.h"
+#include "RayPacket.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// order in which render tiles are handed to workers.
+enum class TileOrder { Scanline, Morton };
 
 class Renderer {
     public:
         int spp = 10; // count of samples per pixel.
 
+        int n_threads = 0;                      // worker threads, 0 uses every hardware thread.
+        int tile_size = 16;                     // edge length (in pixels) of one render tile.
+        TileOrder tile_order = TileOrder::Morton;
+        uint64_t seed = 0;                      // keys every sample stream; equal seeds give equal images at any thread count.
+
+        // adaptive sampling: every pixel takes min_spp samples, then keeps sampling in batches until the
+        // standard error of its mean luminance drops below error_threshold (relative), or max_spp is hit.
+        // note: the spp budget is then decided per pixel, and the `spp` field is ignored.
+        bool   adaptive        = false;
+        int    min_spp         = 16;
+        int    max_spp         = 1024;
+        double error_threshold = 0.05;
+
+        int max_depth    = 50; // bounces after which a path is cut off.
+        int rr_min_depth = 3;  // bounces before Russian roulette may terminate a path.
+
+        bool light_sampling = true; // sample Scene::lights directly at every non-specular bounce.
+
+        // camera rays of packet_size x packet_size pixel blocks are traced through the BVH as one packet
+        // (4 or 8; 0 traces every ray alone). bounces after the primary hit are always traced alone.
+        // note: packets give the same image as single rays, and aren't used by adaptive sampling.
+        int packet_size = 0;
+
+        // file the image is written to: .ppm (8-bit) or .pfm / .exr (float radiance), see Framebuffer.
+        std::string output = "binary.ppm";
+        Tonemap tonemap = Tonemap::Clamp; // tonemapping of 8-bit output.
+        double exposure = 1.0;            // radiance scale of 8-bit output.
+
+        Framebuffer framebuffer; // the last render's image.
+
+        // checkpoints: while checkpoint_file is set, the sums of the finished tasks (tiles x sample chunks) are
+        // written to it every checkpoint_interval seconds and when the render is stopped, & the file is removed
+        // once the image is written. with resume, a render loads the tasks of a checkpoint made for it & only
+        // traces the rest; sample streams are keyed per pixel sample, so the image is the one an uninterrupted
+        // render gives. note: tasks in flight when the render stops are traced again on resume.
+        std::string checkpoint_file;
+        double checkpoint_interval = 300;
+        bool resume = false;
+
+        // time budget: with time_budget > 0 (seconds), the render makes progressive passes over the whole image,
+        // each adding samples to every pixel, until the budget is spent or, with noise_target > 0, the image's
+        // noise (the pixels' mean relative standard error of luminance, as in adaptive sampling) is below it.
+        // every pass is sized from the last one's speed to fill half the remaining time, so the render ends
+        // close to the deadline; a tile the deadline cuts short drops that pass's samples, & pixels may end
+        // up with different spp (see framebuffer.count()). `spp`, adaptive sampling & checkpoints are unused.
+        // note: the budget covers tracing only, not the scene's setup or writing the image.
+        double time_budget = 0;
+        double noise_target = 0;
+
+        // traversal statistics (RT_STATS builds, see Stats.h): a render prints its counters once it's done, &
+        // with heatmap_file set writes the mean traversal cost per sample of every pixel (see CostImage::write).
+        // note: the counts of a distributed render stay with its workers.
+        std::string heatmap_file;
+
         Renderer() {}
 
-        void render(Scene &scene) {
+        // asks running renders to stop once their workers finish the pixel row they're on; a render that
+        // was stopped writes its checkpoint & returns false. safe to call from a signal handler.
+        static void request_stop() { stop_flag() = true; }
+
+        // renders scene & writes the image to output. returns false if the render was stopped first.
+        bool render(Scene &scene) {
             
             scene.initialize_camera();
+            scene.register_materials();
 
-            // calculate each pixel's RGB color value and store into image.
-            
-            FILE* fp = fopen("binary.ppm", "wb");
-            (void)fprintf(fp, "P6\n%d %d\n255\n", scene.image_w, scene.image_h);
-
-            std::cout << "SPP: " << spp << "\n";
-            double pps = 1 / double(spp);
-
-            for (auto j = 0; j < scene.image_h; j++) {
-                for (auto i = 0; i < scene.image_w; i++) {
-                    // compute color of the ray/pixel.
-                    auto pixel_color = Color();
-                    for (int s = 0; s < spp; s++) {
-                        auto r = scene.cast_ray(i, j);
-                        pixel_color += get_color(r, scene);
-                    }
+            const int image_w = scene.image_w, image_h = scene.image_h;
+
+            begin_stats(image_w, image_h);
+            if (time_budget > 0) return render_progressive(scene);
+
+            if (adaptive) std::cout << "SPP: adaptive [" << min_spp << ", " << max_spp << "], error threshold: " << error_threshold << "\n";
+            else          std::cout << "SPP: " << spp << "\n";
+
+            RenderPlan plan = make_plan(scene);
+
+            // per-chunk partial sums, reduced in chunk order once all workers are done.
+            std::vector<Color> partial(size_t(plan.n_chunks) * image_w * image_h);
+            std::vector<int> pixel_spp(size_t(image_w) * image_h, adaptive ? 0 : spp);
+
+            ThreadPool pool(n_threads);
+            std::cout << "Threads: " << pool.size() << ", tiles: " << plan.tiles.size()
+                      << ", sample chunks: " << plan.n_chunks << "\n";
 
-                    // write the computed pixel_color into image.
-                    write_color(fp, pixel_color * pps);
+            // every worker accumulates into its own tile buffer and publishes it once per task.
+            std::vector<std::vector<Color>> worker_accum(pool.size());
+            const size_t n_tasks = plan.n_tasks;
+
+            // a finished task's sums are never written again, so a checkpoint can save them while workers
+            // go on with other tasks; the flags themselves are guarded by done_mutex.
+            std::vector<char> done(n_tasks, 0);
+            std::mutex done_mutex;
+            if (resume && !checkpoint_file.empty()) {
+                size_t n_resumed = read_checkpoint(plan, partial, pixel_spp, done);
+                if (n_resumed > 0)
+                    std::cout << "Resumed " << n_resumed << " of " << n_tasks << " tasks from '" << checkpoint_file << "'\n";
+            }
+            std::atomic<size_t> tasks_done(size_t(std::count(done.begin(), done.end(), 1)));
+            auto last_checkpoint = std::chrono::steady_clock::now();
+
+            pool.parallel_for(n_tasks, [&](size_t task, int worker) {
+                if (done[task] || stop_flag()) return;
+
+                // the task may be cut short by a stop, it's traced again on resume.
+                auto &accum = worker_accum[worker];
+                if (!trace_task(scene, plan, task, accum, pixel_spp)) return;
+                store_task(plan, task, accum.data(), partial);
+
+                {
+                    std::lock_guard<std::mutex> lock(done_mutex);
+                    done[task] = 1;
                 }
-                UpdateProgress(j / double(scene.image_h));
+                size_t finished = ++tasks_done;
+                if (worker == 0) {
+                    UpdateProgress(finished / double(n_tasks));
+                    auto now = std::chrono::steady_clock::now();
+                    if (!checkpoint_file.empty() &&
+                        std::chrono::duration<double>(now - last_checkpoint).count() >= checkpoint_interval)
+                    {
+                        write_checkpoint(plan, partial, pixel_spp, done, done_mutex);
+                        last_checkpoint = now;
+                    }
+                }
+            });
+
+            if (stop_flag()) {
+                std::cout << "\nRender stopped with " << tasks_done << " of " << n_tasks << " tasks done";
+                if (!checkpoint_file.empty() && write_checkpoint(plan, partial, pixel_spp, done, done_mutex))
+                    std::cout << ", checkpoint written to '" << checkpoint_file << "'";
+                std::cout << ".\n";
+                return false;
             }
             UpdateProgress(1.);
-    
-            fclose(fp);
+
+            if (finish(plan, partial, pixel_spp) && !checkpoint_file.empty())
+                std::remove(checkpoint_file.c_str());
+            report_stats();
+            return true;
         }
 
         private:
-            double RussianRoulette = 0.8;
+            friend class RenderCoordinator;
+            friend class RenderWorker;
 
-            Color get_color(const Ray &ri, const Scene &scene) const {
+            // samples taken between two convergence tests of an adaptive pixel.
+            static const int adaptive_batch = 8;
 
-                auto isect = Intersection();
+            // running (Welford) mean & variance of one pixel's luminance.
+            struct PixelStats {
+                int n = 0;
+                double mean = 0.0, m2 = 0.0;
+
+                void add(double x) {
+                    n++;
+                    double delta = x - mean;
+                    mean += delta / n;
+                    m2 += delta * (x - mean);
+                }
+
+                // standard error of the mean, relative to the mean (floored so black pixels converge too).
+                bool converged(double threshold) const {
+                    if (n < 2) return false;
+                    return std::sqrt(m2 / (n-1) / n) <= threshold * std::fmax(mean, 1e-2);
+                }
+            };
+
+            // fewest tasks (tiles x sample chunks) a render is split into.
+            static const size_t min_tasks = 256;
+
+            struct Tile { int x, y, w, h; };
+
+            static std::atomic<bool> &stop_flag() {
+                static std::atomic<bool> flag(false);
+                return flag;
+            }
+
+            CostImage costs; // the running render's traversal cost per pixel, RT_STATS builds only.
 
-                // if doesn't intersect or (t < .001), return background color.
-                // note: (t_min == 1e-3 (> 0)) avoids self-intersection caused by floating point rounding errors.
-                if (!scene.intersect(ri, Interval(1e-3, infinity), isect)) {
-                    return scene.bgColor;
+            // zeroes the traversal counters & costs before a render (nothing without RT_STATS).
+            void begin_stats(int image_w, int image_h) {
+                reset_stats();
+                costs.reset(image_w, image_h);
+            }
+
+            // prints the counters of the render that just finished & writes its heatmaps.
+            void report_stats() const {
+#ifdef RT_STATS
+                print_stats(std::cout, stats_total());
+                if (!heatmap_file.empty()) costs.write(heatmap_file);
+#endif
+            }
+
+            // set while a time-budgeted render runs.
+            bool has_deadline = false;
+            std::chrono::steady_clock::time_point deadline;
+
+            // true once tracing should stop: the render was stopped, or its time budget is spent.
+            bool cancelled() const {
+                return stop_flag() || (has_deadline && std::chrono::steady_clock::now() >= deadline);
+            }
+
+            // a checkpoint file is this header, one done flag per task, then the sums of every done task in
+            // task order: its chunk's tile rows of Colors, and with adaptive sampling the tile's sample counts.
+            // the header holds everything that decides which samples a task traces & how they're summed, so
+            // a checkpoint is only resumed by the same render of the same scene.
+            // note: the scene is told apart by a fingerprint (camera, counts of objects, lights & BVH nodes,
+            //       bounds); scenes that differ in nothing of that need checkpoint files of their own.
+            struct Checkpoint {
+                char magic[8];
+                uint32_t version, color_size;
+                int32_t image_w, image_h, spp, chunk_spp, n_chunks, tile_size, tile_order;
+                int32_t adaptive, min_spp, max_spp, max_depth, rr_min_depth, light_sampling;
+                double error_threshold;
+                uint64_t seed, n_tasks, scene_fingerprint;
+            };
+
+            Checkpoint make_checkpoint(const Scene &scene, int chunk_spp, int n_chunks, size_t n_tasks) const {
+                Checkpoint c;
+                std::memset(&c, 0, sizeof(c)); // the header is compared bytewise, padding included.
+                std::memcpy(c.magic, "RTCKPT", 7);
+                c.version = 1;
+                c.color_size = uint32_t(sizeof(Color));
+                c.image_w = scene.image_w, c.image_h = scene.image_h;
+                c.spp = spp, c.chunk_spp = chunk_spp, c.n_chunks = n_chunks;
+                c.tile_size = tile_size, c.tile_order = int32_t(tile_order);
+                c.adaptive = adaptive, c.min_spp = min_spp, c.max_spp = max_spp;
+                c.max_depth = max_depth, c.rr_min_depth = rr_min_depth, c.light_sampling = light_sampling;
+                c.error_threshold = error_threshold;
+                c.seed = seed, c.n_tasks = n_tasks;
+
+                // FNV-1a over the scene's camera, counts & bounds.
+                uint64_t h = 14695981039346656037ULL;
+                auto mix = [&](double x) {
+                    unsigned char bytes[sizeof(double)];
+                    std::memcpy(bytes, &x, sizeof(double));
+                    for (unsigned char b : bytes) h = (h ^ b) * 1099511628211ULL;
+                };
+                auto mix_vector = [&](const Vector3d &v) { mix(v.x()); mix(v.y()); mix(v.z()); };
+                mix(scene.aspect_ratio); mix(scene.vfov); mix(scene.defocus_angle); mix(scene.focal_dist);
+                mix_vector(scene.eye_pos); mix_vector(scene.gaze_pos); mix_vector(scene.up_dir); mix_vector(scene.bgColor);
+                mix(double(scene.objects.size())); mix(double(scene.lights.size()));
+                mix(double(scene.bvh ? scene.bvh->node_count() : 0));
+                AABB bounds = scene.get_AABB();
+                for (const Interval &axis : { bounds.x, bounds.y, bounds.z }) { mix(axis.min); mix(axis.max); }
+                c.scene_fingerprint = h;
+                return c;
+            }
+
+            // how a render is split into tasks, each one tile x one chunk of its pixels' samples. the image is
+            // cut into tiles, and each pixel's samples into chunks when there are too few tiles to keep every
+            // worker busy (e.g. a tiny image at very high spp).
+            // note: the chunk count depends only on image size & spp, never on the thread count, so the
+            //       final sums are scheduling-independent (the sample streams are keyed per pixel sample anyway).
+            //       adaptive pixels are never split, their stopping test needs all of their samples.
+            struct RenderPlan {
+                int image_w, image_h;
+                std::vector<Tile> tiles;
+                int chunk_spp, n_chunks;
+                size_t n_tasks;
+                Checkpoint header; // tells this render apart from others, see Checkpoint.
+            };
+
+            RenderPlan make_plan(const Scene &scene) const {
+                RenderPlan plan;
+                plan.image_w = scene.image_w, plan.image_h = scene.image_h;
+                plan.tiles = make_tiles(scene.image_w, scene.image_h);
+                plan.chunk_spp = spp;
+                if (!adaptive && plan.tiles.size() < min_tasks) {
+                    int n_chunks = int((min_tasks + plan.tiles.size() - 1) / plan.tiles.size());
+                    plan.chunk_spp = std::max(1, (spp + n_chunks - 1) / n_chunks);
                 }
+                plan.n_chunks = adaptive ? 1 : (spp + plan.chunk_spp - 1) / plan.chunk_spp;
+                plan.n_tasks = plan.tiles.size() * plan.n_chunks;
+                plan.header = make_checkpoint(scene, plan.chunk_spp, plan.n_chunks, plan.n_tasks);
+                return plan;
+            }
+
+            const Tile &task_tile(const RenderPlan &plan, size_t task) const { return plan.tiles[task / plan.n_chunks]; }
+
+            // traces one task into accum, the sums of its tile's pixels row by row; with adaptive sampling the
+            // pixels' sample counts go to pixel_spp (image-sized). returns false if the render was stopped meanwhile.
+            bool trace_task(const Scene &scene, const RenderPlan &plan, size_t task, std::vector<Color> &accum,
+                            std::vector<int> &pixel_spp) const
+            {
+                const Tile &tile = task_tile(plan, task);
+                int chunk = int(task % plan.n_chunks);
+                int s_begin = chunk * plan.chunk_spp, s_end = std::min(spp, s_begin + plan.chunk_spp);
 
-                // test RR to decide if continues bouncing.
-                if (sample_double() > RussianRoulette) { return Color(); }
+                accum.assign(size_t(tile.w) * tile.h, Color());
 
-                // if RR passes, compute emitted & scattered radiance respectively.
-                Color attenuation; Ray ro;
-                Color Le = isect.m->emit(isect.tex_u, isect.tex_v, isect.p);
+                if (adaptive) sample_tile_adaptive(scene, tile, accum, pixel_spp);
+                else          sample_tile(scene, tile, s_begin, s_end, accum);
+                return !cancelled();
+            }
+
+            // copies a task's tile sums into its chunk's plane of partial.
+            void store_task(const RenderPlan &plan, size_t task, const Color *accum, std::vector<Color> &partial) const {
+                const Tile &tile = task_tile(plan, task);
+                size_t chunk = task % plan.n_chunks;
+                Color *out = &partial[(chunk * plan.image_h + tile.y) * plan.image_w + tile.x];
+                for (auto j = 0; j < tile.h; j++)
+                    std::copy(accum + size_t(j) * tile.w, accum + size_t(j + 1) * tile.w, out + size_t(j) * plan.image_w);
+            }
 
-                // if doesn't scatter (light source), just return object's emission.
-                if (!isect.m->scatter(ri, isect, attenuation, ro)) {
-                    return Le;
+            // reduces the chunk sums in chunk order into framebuffer, then writes the image out once.
+            // returns false if it couldn't be written.
+            bool finish(const RenderPlan &plan, const std::vector<Color> &partial, const std::vector<int> &pixel_spp) {
+                const int image_w = plan.image_w, image_h = plan.image_h;
+                if (adaptive) {
+                    double total = 0;
+                    for (int n : pixel_spp) total += n;
+                    std::cout << "\nAverage SPP: " << total / pixel_spp.size() << "\n";
                 }
 
-                // compute scattered radiance by recursively self-calling, which contains direct & indirect illumination.
-                Color Ls = attenuation * get_color(ro, scene) / RussianRoulette;
+                framebuffer = Framebuffer(image_w, image_h);
+                for (auto j = 0; j < image_h; j++) {
+                    for (auto i = 0; i < image_w; i++) {
+                        auto pixel_color = Color();
+                        for (int c = 0; c < plan.n_chunks; c++)
+                            pixel_color += partial[(size_t(c) * image_h + j) * image_w + i];
+                        framebuffer.add(i, j, pixel_color, uint32_t(pixel_spp[size_t(j) * image_w + i]));
+                    }
+                }
+                return framebuffer.write(output, tonemap, float(exposure));
+            }
+
+            // renders passes over the whole image until the time budget is spent or the noise target met,
+            // see time_budget, then writes the image.
+            bool render_progressive(Scene &scene) {
+                typedef std::chrono::steady_clock Clock;
+                auto seconds = [](Clock::time_point from, Clock::time_point to) { return std::chrono::duration<double>(to - from).count(); };
+                const int image_w = scene.image_w, image_h = scene.image_h;
+
+                std::cout << "Time budget: " << time_budget << " s";
+                if (noise_target > 0) std::cout << ", noise target: " << noise_target;
+                std::cout << "\n";
+
+                RenderPlan plan;
+                plan.image_w = image_w, plan.image_h = image_h;
+                plan.tiles = make_tiles(image_w, image_h);
+                plan.chunk_spp = 0, plan.n_chunks = 1;
+                plan.n_tasks = plan.tiles.size();
+
+                std::vector<Color> sums(size_t(image_w) * image_h);
+                std::vector<double> lum_sq(sums.size());
+                std::vector<int> pixel_spp(sums.size(), 0);
+
+                ThreadPool pool(n_threads);
+                std::cout << "Threads: " << pool.size() << ", tiles: " << plan.tiles.size() << "\n";
+                std::vector<std::vector<Color>> worker_accum(pool.size());
+                std::vector<std::vector<double>> worker_lum_sq(pool.size());
+
+                auto start = Clock::now();
+                deadline = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(time_budget));
+                has_deadline = true;
+
+                // the first pass takes one sample per pixel; later ones are sized from the last pass's speed, &
+                // with a noise target by the spp it predicts (noise falls as 1/sqrt(spp)).
+                int passes = 0, pass_spp = 1;
+                double seconds_per_spp = 0, noise = infinity;
+                while (!stop_flag()) {
+                    auto pass_start = Clock::now();
+                    if (passes > 0) {
+                        double remaining = seconds(pass_start, deadline);
+                        if ((noise_target > 0 && noise <= noise_target) || remaining < 1.1 * seconds_per_spp) break;
+                        double n = std::min(0.5 * remaining / seconds_per_spp, 1e6);
+                        if (noise_target > 0) {
+                            // grow slowly while the estimate is rough (or missing, below 2 spp).
+                            double spp_now = *std::min_element(pixel_spp.begin(), pixel_spp.end());
+                            n = std::min(n, 3 * spp_now);
+                            if (noise < infinity) n = std::min(n, spp_now * (noise * noise / (noise_target * noise_target) - 1));
+                        }
+                        pass_spp = int(std::max(1.0, n));
+                    }
+
+                    pool.parallel_for(plan.tiles.size(), [&](size_t t, int worker) {
+                        const Tile &tile = plan.tiles[t];
+                        auto &accum = worker_accum[worker];
+                        auto &tile_lum_sq = worker_lum_sq[worker];
+                        accum.assign(size_t(tile.w) * tile.h, Color());
+                        tile_lum_sq.assign(accum.size(), 0.0);
+
+                        // a tile's pixels always have equal spp, its next samples start there.
+                        int s_begin = pixel_spp[size_t(tile.y) * image_w + tile.x];
+                        sample_tile(scene, tile, s_begin, s_begin + pass_spp, accum, &tile_lum_sq);
+                        if (cancelled()) return;
+
+                        for (auto j = 0; j < tile.h; j++) {
+                            for (auto i = 0; i < tile.w; i++) {
+                                size_t p = size_t(tile.y + j) * image_w + tile.x + i, k = size_t(j) * tile.w + i;
+                                sums[p] += accum[k];
+                                lum_sq[p] += tile_lum_sq[k];
+                                pixel_spp[p] += pass_spp;
+                            }
+                        }
+                    });
+
+                    passes++;
+                    seconds_per_spp = seconds(pass_start, Clock::now()) / pass_spp;
+                    noise = image_noise(sums, lum_sq, pixel_spp);
+                    UpdateProgress(std::min(1.0, seconds(start, Clock::now()) / time_budget));
+                    if (cancelled()) break;
+                }
+                has_deadline = false;
+                double elapsed = seconds(start, Clock::now());
+
+                auto range = std::minmax_element(pixel_spp.begin(), pixel_spp.end());
+                double total = 0;
+                for (int n : pixel_spp) total += n;
+                std::cout << "\nPasses: " << passes << " in " << elapsed << " s, SPP per pixel: " << *range.first
+                          << " to " << *range.second << " (average " << total / pixel_spp.size() << "), noise: " << noise << "\n";
+                if (*range.first == 0) std::cout << "WARNING: The time budget ran out before every pixel had a sample.\n";
+
+                finish(plan, sums, pixel_spp);
+                report_stats();
+                return !stop_flag();
+            }
+
+            // returns the mean over pixels of the relative standard error of their mean luminance (infinity
+            // while a pixel has fewer than 2 samples).
+            static double image_noise(const std::vector<Color> &sums, const std::vector<double> &lum_sq, const std::vector<int> &pixel_spp) {
+                double total = 0;
+                for (size_t p = 0; p < sums.size(); p++) {
+                    double n = pixel_spp[p];
+                    if (n < 2) return infinity;
+                    double mean = luminance(sums[p]) / n;
+                    double variance = std::fmax(0.0, (lum_sq[p] - n * mean * mean) / (n - 1));
+                    total += std::sqrt(variance / n) / std::fmax(mean, 1e-2);
+                }
+                return total / sums.size();
+            }
+
+            // writes the done tasks' sums to checkpoint_file (atomically, see BufferedWriter).
+            bool write_checkpoint(const RenderPlan &plan, const std::vector<Color> &partial, const std::vector<int> &pixel_spp,
+                                  const std::vector<char> &done, std::mutex &done_mutex) const
+            {
+                std::vector<char> finished;
+                {
+                    std::lock_guard<std::mutex> lock(done_mutex);
+                    finished = done;
+                }
+
+                BufferedWriter out(checkpoint_file);
+                out.write(&plan.header, sizeof(plan.header));
+                out.write(finished.data(), finished.size());
+                for (size_t task = 0; task < finished.size(); task++) {
+                    if (!finished[task]) continue;
+                    const Tile &tile = task_tile(plan, task);
+                    size_t chunk = task % plan.n_chunks;
+                    for (auto j = 0; j < tile.h; j++)
+                        out.write(&partial[(chunk * plan.image_h + tile.y + j) * plan.image_w + tile.x], tile.w * sizeof(Color));
+                    if (adaptive)
+                        for (auto j = 0; j < tile.h; j++)
+                            out.write(&pixel_spp[size_t(tile.y + j) * plan.image_w + tile.x], tile.w * sizeof(int));
+                }
+                return out.close();
+            }
+
+            // loads the done tasks of checkpoint_file if it was made for this render (plan.header); returns how
+            // many, 0 (after a warning) for a checkpoint that can't be used.
+            size_t read_checkpoint(const RenderPlan &plan, std::vector<Color> &partial, std::vector<int> &pixel_spp,
+                                   std::vector<char> &done) const
+            {
+                MappedFile file(checkpoint_file);
+                if (!file.data()) return 0;
+
+                auto reject = [&](const char *why) {
+                    std::cerr << "WARNING: Ignoring checkpoint '" << checkpoint_file << "' (" << why << ").\n";
+                    return size_t(0);
+                };
+                if (file.size() < sizeof(plan.header) + done.size() || std::memcmp(file.data(), &plan.header, sizeof(plan.header)) != 0)
+                    return reject("made for another render");
+
+                // check the size before copying anything, so a bad file leaves the render untouched.
+                const char *flags = file.data() + sizeof(plan.header), *p = flags + done.size();
+                size_t expected = sizeof(plan.header) + done.size(), n_done = 0;
+                for (size_t task = 0; task < done.size(); task++) {
+                    if (!flags[task]) continue;
+                    expected += task_record_size(plan, task);
+                    n_done++;
+                }
+                if (file.size() != expected) return reject("wrong size");
+
+                for (size_t task = 0; task < done.size(); task++) {
+                    if (!flags[task]) continue;
+                    load_task_record(plan, task, p, partial, pixel_spp);
+                    p += task_record_size(plan, task);
+                    done[task] = 1;
+                }
+                return n_done;
+            }
+
+            // a task's record, as saved in checkpoints & sent by distributed workers: the sums of its tile's
+            // pixels row by row, then with adaptive sampling their sample counts.
+            size_t task_record_size(const RenderPlan &plan, size_t task) const {
+                const Tile &tile = task_tile(plan, task);
+                return size_t(tile.w) * tile.h * (sizeof(Color) + (adaptive ? sizeof(int) : 0));
+            }
+
+            // copies a task's record into partial & pixel_spp. the record needn't be aligned.
+            void load_task_record(const RenderPlan &plan, size_t task, const char *record, std::vector<Color> &partial,
+                                  std::vector<int> &pixel_spp) const
+            {
+                const Tile &tile = task_tile(plan, task);
+                size_t chunk = task % plan.n_chunks;
+                for (auto j = 0; j < tile.h; j++, record += tile.w * sizeof(Color))
+                    std::memcpy(&partial[(chunk * plan.image_h + tile.y + j) * plan.image_w + tile.x], record, tile.w * sizeof(Color));
+                if (adaptive)
+                    for (auto j = 0; j < tile.h; j++, record += tile.w * sizeof(int))
+                        std::memcpy(&pixel_spp[size_t(tile.y + j) * plan.image_w + tile.x], record, tile.w * sizeof(int));
+            }
+
+            std::vector<Tile> make_tiles(int image_w, int image_h) const {
+                int ts = std::max(1, tile_size);
+                int tiles_x = (image_w + ts - 1) / ts, tiles_y = (image_h + ts - 1) / ts;
+
+                std::vector<std::pair<uint64_t, Tile>> keyed;
+                for (int ty = 0; ty < tiles_y; ty++) {
+                    for (int tx = 0; tx < tiles_x; tx++) {
+                        Tile t = { tx*ts, ty*ts, std::min(ts, image_w - tx*ts), std::min(ts, image_h - ty*ts) };
+                        uint64_t key = (tile_order == TileOrder::Morton) ? morton_code(tx, ty)
+                                                                          : uint64_t(ty) * tiles_x + tx;
+                        keyed.push_back(std::make_pair(key, t));
+                    }
+                }
+                std::sort(keyed.begin(), keyed.end(),
+                    [](const std::pair<uint64_t, Tile> &a, const std::pair<uint64_t, Tile> &b) { return a.first < b.first; });
+
+                std::vector<Tile> tiles;
+                for (auto &k : keyed) tiles.push_back(k.second);
+                return tiles;
+            }
+
+            // interleaves the bits of x & y, so sorting by the code walks tiles along a Z-order curve.
+            static uint64_t morton_code(uint32_t x, uint32_t y) {
+                return spread_bits(x) | (spread_bits(y) << 1);
+            }
+
+            static uint64_t spread_bits(uint64_t v) {
+                v &= 0xffffffff;
+                v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+                v = (v | (v <<  8)) & 0x00ff00ff00ff00ffULL;
+                v = (v | (v <<  4)) & 0x0f0f0f0f0f0f0f0fULL;
+                v = (v | (v <<  2)) & 0x3333333333333333ULL;
+                v = (v | (v <<  1)) & 0x5555555555555555ULL;
+                return v;
+            }
+
+            // traces sample `s` of pixel (x, y), with the thread's sample stream keyed to it.
+            Color sample_pixel(const Scene &scene, int x, int y, int s) const {
+                thread_sampler().start(uint64_t(y) * scene.image_w + x, s, seed);
+                TraceCost before = thread_cost();
+                auto r = scene.cast_ray(x, y);
+                Color c = get_color(r, scene);
+                costs.add(size_t(y) * scene.image_w + x, thread_cost() - before);
+                return c;
+            }
+
+            // adds samples [s_begin, s_end) of every pixel of tile to accum (tile-local sums), & the squares of
+            // their luminances to lum_sq when it's given.
+            void sample_tile(const Scene &scene, const Tile &tile, int s_begin, int s_end, std::vector<Color> &accum,
+                             std::vector<double> *lum_sq = nullptr) const
+            {
+                if (packet_size > 0) {
+                    sample_tile_packets(scene, tile, s_begin, s_end, accum, lum_sq);
+                    return;
+                }
+                for (auto j = 0; j < tile.h && !cancelled(); j++) {
+                    for (auto i = 0; i < tile.w; i++) {
+                        // compute color of the ray/pixel.
+                        size_t k = size_t(j) * tile.w + i;
+                        for (int s = s_begin; s < s_end; s++) {
+                            Color c = sample_pixel(scene, tile.x + i, tile.y + j, s);
+                            accum[k] += c;
+                            if (lum_sq) (*lum_sq)[k] += luminance(c) * luminance(c);
+                        }
+                    }
+                }
+            }
+
+            static double luminance(const Color &c) { return 0.2126*c.x() + 0.7152*c.y() + 0.0722*c.z(); }
+
+            // samples one tile in blocks of packet_size x packet_size pixels, tracing each block's camera rays
+            // for one sample index as a packet. each pixel's sampler state after its camera ray is kept, so the
+            // rest of its path draws exactly the numbers it would have drawn when traced alone.
+            void sample_tile_packets(const Scene &scene, const Tile &tile, int s_begin, int s_end,
+                                     std::vector<Color> &accum, std::vector<double> *lum_sq) const
+            {
+                int ps = std::max(1, std::min(packet_size, 8));
+                RayPacket packet;
+                Sampler samplers[RayPacket::max_size];
+                int pixel_index[RayPacket::max_size];
+
+                for (auto bj = 0; bj < tile.h && !cancelled(); bj += ps) {
+                    for (auto bi = 0; bi < tile.w; bi += ps) {
+                        for (int s = s_begin; s < s_end; s++) {
+                            packet.clear();
+                            for (auto j = bj; j < std::min(tile.h, bj + ps); j++) {
+                                for (auto i = bi; i < std::min(tile.w, bi + ps); i++) {
+                                    int x = tile.x + i, y = tile.y + j;
+                                    thread_sampler().start(uint64_t(y) * scene.image_w + x, s, seed);
+                                    packet.add(scene.cast_ray(x, y));
+                                    samplers[packet.size - 1] = thread_sampler();
+                                    pixel_index[packet.size - 1] = j * tile.w + i;
+                                }
+                            }
+
+                            // the packet's traversal is shared out evenly among its pixels' costs.
+                            TraceCost before = thread_cost();
+                            scene.intersect_packet(packet, Interval(0, infinity));
+                            RT_STAT_ADD(Rays, packet.size);
+                            TraceCost packet_cost = thread_cost() - before;
+
+                            for (int k = 0; k < packet.size; k++) {
+                                thread_sampler() = samplers[k];
+                                TraceCost path_start = thread_cost();
+                                Color c = get_color(packet.rays[k], scene, packet.hit[k], packet.isect[k]);
+                                costs.add(size_t(tile.y + pixel_index[k] / tile.w) * scene.image_w + tile.x + pixel_index[k] % tile.w,
+                                          thread_cost() - path_start + packet_cost.share(k, packet.size));
+                                accum[pixel_index[k]] += c;
+                                if (lum_sq) (*lum_sq)[pixel_index[k]] += luminance(c) * luminance(c);
+                            }
+                        }
+                    }
+                }
+            }
+
+            // samples one tile adaptively into accum (tile-local sums), recording every pixel's sample count.
+            // a pixel keeps sampling while it, or any of its neighbours in the tile, is above the threshold:
+            // pixels whose first few samples happened to agree (e.g. all missed a small light) next to noisy
+            // ones would otherwise be dropped too early.
+            void sample_tile_adaptive(const Scene &scene, const Tile &tile, std::vector<Color> &accum,
+                                      std::vector<int> &pixel_spp) const
+            {
+                size_t n_pixels = size_t(tile.w) * tile.h;
+                std::vector<PixelStats> stats(n_pixels);
+                std::vector<char> active(n_pixels, 1), noisy(n_pixels);
+                int target = std::max(1, std::min(min_spp, max_spp));
+
+                while (!cancelled()) {
+                    for (auto j = 0; j < tile.h; j++) {
+                        for (auto i = 0; i < tile.w; i++) {
+                            size_t k = size_t(j) * tile.w + i;
+                            if (!active[k]) continue;
+                            while (stats[k].n < target) {
+                                Color c = sample_pixel(scene, tile.x + i, tile.y + j, stats[k].n);
+                                accum[k] += c;
+                                stats[k].add(luminance(c));
+                            }
+                        }
+                    }
+
+                    for (size_t k = 0; k < n_pixels; k++) noisy[k] = !stats[k].converged(error_threshold);
+
+                    // dilate the noisy mask by one pixel.
+                    bool any_active = false;
+                    for (auto j = 0; j < tile.h; j++) {
+                        for (auto i = 0; i < tile.w; i++) {
+                            size_t k = size_t(j) * tile.w + i;
+                            active[k] = 0;
+                            if (stats[k].n >= max_spp) continue;
+                            for (int dj = std::max(0, j-1); dj <= std::min(tile.h-1, j+1); dj++)
+                                for (int di = std::max(0, i-1); di <= std::min(tile.w-1, i+1); di++)
+                                    if (noisy[size_t(dj) * tile.w + di]) active[k] = 1;
+                            any_active = any_active || active[k];
+                        }
+                    }
+
+                    if (!any_active) break;
+                    target = std::min(max_spp, target + adaptive_batch);
+                }
+
+                for (auto j = 0; j < tile.h; j++)
+                    for (auto i = 0; i < tile.w; i++)
+                        pixel_spp[size_t(tile.y + j) * scene.image_w + tile.x + i] = stats[size_t(j) * tile.w + i].n;
+            }
+
+            // traces one path iteratively, carrying the path throughput (product of attenuations so far).
+            // with light_sampling, every non-specular vertex also samples a light directly (next-event
+            // estimation); both that and hitting an emitter by chance are weighted by MIS (power heuristic).
+            Color get_color(const Ray &camera_ray, const Scene &scene) const {
+                auto isect = Intersection();
+                RT_STAT(Rays);
+                bool hit = scene.intersect(camera_ray, Interval(0, infinity), isect);
+                return get_color(camera_ray, scene, hit, isect);
+            }
+
+            // continues the path of a camera ray whose first intersection (hit, isect) is already known.
+            Color get_color(const Ray &camera_ray, const Scene &scene, bool hit, Intersection isect) const {
+
+                Color L, throughput(1.0, 1.0, 1.0);
+                Ray ri = camera_ray;
+                double scatter_pdf = 0.0; // density of the previous bounce's direction, 0 for camera/specular.
+                bool sample_lights = light_sampling && !scene.lights.empty();
+                RT_STAT(Paths);
+
+                for (int depth = 0; depth < max_depth; depth++) {
+                    // note: bounce rays start just off the surface (Intersection::spawn_ray), so t_min can be 0.
+                    if (depth > 0) {
+                        isect = Intersection();
+                        RT_STAT(Rays);
+                        hit = scene.intersect(ri, Interval(0, infinity), isect);
+                    }
+
+                    // if doesn't intersect or (t < .001), add background color.
+                    if (!hit) {
+                        L += throughput * scene.bgColor;
+                        break;
+                    }
+                    RT_STAT(PathVertices);
+
+                    // add emitted radiance; if the previous bounce could have sampled this light directly too,
+                    // keep only its MIS share.
+                    const Material &m = (*scene.materials)[isect.material];
+                    Color Le = m.emit(isect.tex_u, isect.tex_v, isect.p);
+                    if (Le.x() > 0 || Le.y() > 0 || Le.z() > 0) {
+                        double weight = (sample_lights && scatter_pdf > 0) ? mis_weight(scatter_pdf, scene.light_pdf(ri)) : 1.0;
+                        L += throughput * Le * weight;
+                    }
+
+                    // stop if doesn't scatter (light source).
+                    Color attenuation; Ray ro;
+                    if (!m.scatter(ri, isect, attenuation, ro)) break;
+
+                    scatter_pdf = m.pdf(ri, isect, ro.direction());
+                    if (sample_lights && scatter_pdf > 0)
+                        L += throughput * sample_direct(ri, isect, scene);
+
+                    throughput = throughput * attenuation;
+
+                    // test RR once the path is rr_min_depth bounces long: paths that carry little energy are
+                    // likely terminated, survivors are reweighted by 1/p to stay unbiased.
+                    if (depth + 1 >= rr_min_depth) {
+                        double p = std::fmin(0.95, std::fmax(throughput.x(), std::fmax(throughput.y(), throughput.z())));
+                        if (sample_double() >= p) { RT_STAT(RRTerminations); break; }
+                        throughput /= p;
+                    }
+
+                    if (depth + 1 == max_depth) RT_STAT(DepthCutoffs);
+                    ri = ro;
+                }
+
+                return L;
+            }
+
+            // returns the MIS-weighted radiance reaching isect from one light-sampled direction.
+            Color sample_direct(const Ray &ri, const Intersection &isect, const Scene &scene) const {
+                Ray shadow_ray = isect.spawn_ray(scene.sample_light_dir(isect.p, ri.time()), ri.time());
+                double light_pdf = scene.light_pdf(shadow_ray);
+                if (light_pdf <= 0) return Color();
+
+                const Material &m = (*scene.materials)[isect.material];
+                Color f = m.eval(ri, isect, shadow_ray.direction());
+                if (f.x() <= 0 && f.y() <= 0 && f.z() <= 0) return Color();
+
+                // whatever the shadow ray hits first is what's seen: occluders simply don't emit.
+                auto light_isect = Intersection();
+                RT_STAT(Rays);
+                RT_STAT(ShadowRays);
+                if (!scene.intersect(shadow_ray, Interval(0, infinity), light_isect)) return Color();
+
+                Color Le = (*scene.materials)[light_isect.material].emit(light_isect.tex_u, light_isect.tex_v, light_isect.p);
+                double weight = mis_weight(light_pdf, m.pdf(ri, isect, shadow_ray.direction()));
+                return f * Le * (weight / light_pdf);
+            }
 
-                return Le + Ls;
+            // power heuristic (beta = 2) weight of the strategy with density pdf_a against pdf_b.
+            static double mis_weight(double pdf_a, double pdf_b) {
+                return (pdf_a*pdf_a) / (pdf_a*pdf_a + pdf_b*pdf_b);
             }
 };
 
@@ -0,0 +1,54 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstdint>
+
+// a PCG32 random stream keyed by (pixel, sample index, dimension).
+// start() jumps straight to dimension 0 of one pixel sample, every draw then moves one dimension on,
+// so the numbers a sample sees depend only on its key, never on which thread renders it or when.
+class Sampler {
+    public:
+        Sampler() { start(0, 0); }
+
+        // positions the stream at dimension 0 of sample `sample_index` of `pixel`.
+        void start(uint64_t pixel, uint64_t sample_index, uint64_t seed = 0) {
+            // the pixel picks the stream (odd increment), the sample index picks the start state.
+            inc = (mix(pixel ^ (seed << 32)) << 1) | 1u;
+            state = 0;
+            next_uint();
+            state += mix(sample_index + 0x9e3779b97f4a7c15ULL * (seed + 1));
+            next_uint();
+        }
+
+        uint32_t next_uint() {
+            uint64_t old = state;
+            state = old * multiplier + inc;
+            uint32_t xorshifted = uint32_t(((old >> 18u) ^ old) >> 27u);
+            uint32_t rot = uint32_t(old >> 59u);
+            return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31));
+        }
+
+        // returns a random double number in [0,1) with 32 bits of resolution.
+        double next_double() { return next_uint() * (1.0 / 4294967296.0); }
+
+    private:
+        static const uint64_t multiplier = 6364136223846793005ULL;
+
+        uint64_t state, inc;
+
+        // splitmix64 finalizer, decorrelates neighbouring keys.
+        static uint64_t mix(uint64_t z) {
+            z += 0x9e3779b97f4a7c15ULL;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return z ^ (z >> 31);
+        }
+};
+
+// the calling thread's stream; the renderer re-keys it at the start of every pixel sample.
+inline Sampler& thread_sampler() {
+    static thread_local Sampler sampler;
+    return sampler;
+}
+
+#endif
@@ -2,8 +2,11 @@
 #define OBJECT_LIST_H
 
 #include "AABB.h"
+#include "Arena.h"
 #include "BVH.h"
+#include "LinearBVH.h"
 #include "Object.h"
+#include "WideBVH.h"
 
 #include <vector>
 
@@ -28,6 +31,9 @@ class Scene : public Object {
         Scene(int image_w, double aspect_ratio, Color bgColor)
           : image_w(image_w), aspect_ratio(aspect_ratio), bgColor(bgColor) {}
 
+        // a sub-scene (e.g. the sides of a box()) allocating from its parent's arena & sharing its materials.
+        Scene(shared_ptr<Arena> arena, shared_ptr<MaterialTable> materials) : arena(arena), materials(materials) {}
+
         void initialize_camera() {
 
             image_h = int(image_w / aspect_ratio);
@@ -77,26 +83,89 @@ class Scene : public Object {
             return Ray(ray_origin, ray_direction, ray_time);
         }
 
+        // objects made through make() / add<T>() & the BVH are allocated from the arena; its blocks are
+        // released together once the scene & every object made from it are gone.
+        shared_ptr<Arena> arena = make_shared<Arena>();
+
+        // the materials the objects' hits refer to by handle, registered as the objects are added & released
+        // with the scene & its sub-scenes.
+        shared_ptr<MaterialTable> materials = make_shared<MaterialTable>();
+
         // shared_ptr ? 1. automatically frees memory; 2. allows multiple references.
         std::vector<shared_ptr<Object>> objects;
-        shared_ptr<BVHNode> bvh;
+        std::vector<shared_ptr<Object>> lights; // emissive objects, used for explicit light sampling.
+        shared_ptr<BVHAccel> bvh;
+        double bvh_build_time = 0.0; // seconds the last buildBVH() took.
 
-        void clear() { objects.clear(); }
+        void clear() { objects.clear(); lights.clear(); }
 
         AABB get_AABB() const override { return aabb; }
 
         void add(shared_ptr<Object> object) { 
+            object->register_materials(*materials);
             objects.push_back(object); 
             aabb = AABB(aabb, object->get_AABB());
+            if (object->is_emissive()) lights.push_back(object);
+        }
+
+        // returns a new T allocated from the scene's arena, e.g. an object to be wrapped before it's added.
+        template <typename T, typename... Args>
+        shared_ptr<T> make(Args&&... args) {
+            return make_shared_in<T>(arena, std::forward<Args>(args)...);
+        }
+
+        // constructs a T in the scene's arena & adds it, e.g. scene.add<Sphere>(center, radius, m).
+        template <typename T, typename... Args>
+        shared_ptr<T> add(Args&&... args) {
+            auto object = make<T>(std::forward<Args>(args)...);
+            add(object);
+            return object;
+        }
+
+        // returns a unit direction from origin towards a point on a uniformly chosen light.
+        Vector3d sample_light_dir(const Point3d &origin, double time) const {
+            auto n = int(lights.size());
+            auto k = std::min(int(sample_double() * n), n-1);
+            return lights[k]->sample_towards(origin, time);
         }
 
-        void buildBVH() {
-            this->bvh = make_shared<BVHNode>(objects);
+        // returns the solid-angle density of sample_light_dir() picking ri's direction from ri's origin.
+        double light_pdf(const Ray &ri) const {
+            if (lights.empty()) return 0.0;
+            double pdf_sum = 0.0;
+            for (const auto &light : lights) pdf_sum += light->pdf_value(ri);
+            return pdf_sum / lights.size();
+        }
+
+        // registers the materials of every object again, e.g. before rendering: an object that was added to
+        // another scene since carries handles into that scene's table.
+        // note: so two scenes sharing objects can't be rendered at once.
+        void register_materials() {
+            for (const auto &object : objects) object->register_materials(*materials);
+        }
+
+        // a scene added to another hands its objects the other's table.
+        void register_materials(MaterialTable &table) override {
+            for (const auto &object : objects) object->register_materials(table);
+        }
+
+        void buildBVH(const BVHBuildOptions &opts = BVHBuildOptions()) {
+            auto start = std::chrono::steady_clock::now();
+            if (opts.layout == BVHLayout::Wide4)
+                this->bvh = make<BVH4>(objects, opts);
+            else
+                this->bvh = make<LinearBVH>(objects, opts);
+            bvh_build_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
         }
 
         bool intersect(const Ray &ri, Interval t_interval, Intersection& isect) const override {
             return this->bvh->intersect(ri, t_interval, isect);
         }
+
+        // intersects a packet of (coherent) rays, results are stored in the packet.
+        void intersect_packet(RayPacket &packet, const Interval &t_interval) const {
+            this->bvh->intersect_packet(packet, t_interval);
+        }
     
     private:
         AABB aabb;
@@ -0,0 +1,413 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "ConstantMedium.h"
+#include "MappedFile.h"
+#include "Material.h"
+#include "MeshLoader.h"
+#include "Object.h"
+#include "Quad.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "Sphere.h"
+#include "Texture.h"
+
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// scene description files: a line-based text format setting up a scene's camera & objects and the
+// renderer's settings, so a render can be changed without recompiling. one statement per line, tokens are
+// separated by spaces, '#' starts a comment & a file name with spaces is written in double quotes:
+//
+//   image      <width> <aspect ratio>
+//   background <r g b>
+//   camera     [vfov <degrees>] [eye <x y z>] [gaze <x y z>] [up <x y z>] [defocus <degrees>] [focus <distance>]
+//   render     [spp <n>] [depth <n>] [packet <n>] [threads <n>] [seed <n>] [adaptive <min spp> <max spp> <threshold>]
+//              [tonemap clamp|reinhard] [exposure <scale>] [budget <seconds>] [noise <target>]
+//   bvh        [split middle|sah] [layout binary|wide4] [leaf <n>]
+//   texture    <name> solid <r g b> | checker <scale> <tex> <tex> | image <file> | noise <scale>
+//   material   <name> diffuse <tex> | metal <r g b> <fuzz> | dielectric <ior> | light <tex> | isotropic <tex>
+//   define     <name> <object>   names an object without adding it to the scene.
+//   <object>                     adds an object to the scene.
+//
+// a <tex> is a texture's name or an <r g b> color, an <object> is one of:
+//
+//   sphere <center> <radius> <material>          moving_sphere <center1> <center2> <radius> <material>
+//   quad <Q> <u> <v> <material>                  box <corner1> <corner2> <material>
+//   mesh <file> <material>                       (an OBJ or PLY file, see MeshLoader.h)
+//   translate <x y z> <object>                   rotate_y <degrees> <object>
+//   medium <density> <tex> <object>              <name> of a defined object
+//
+// e.g. "translate 265 0 295 rotate_y 15 box 0 0 0 165 330 165 white". names must be defined before
+// they're used. the file is parsed straight out of its mapping, and every statement is applied as soon as
+// it's read, so a file listing many objects is never held in memory as anything but the scene.
+// the scene's BVH is built once the whole file is read.
+class SceneFile {
+    public:
+        // sets up scene & r from filename. prints an error & returns false if the file can't be read or
+        // has a bad statement, leaving scene partly filled in.
+        static bool load(const std::string &filename, Scene &scene, Renderer &r) {
+            MappedFile file(filename);
+            if (!file.data()) {
+                std::cerr << "ERROR: Could not open scene file '" << filename << "'.\n";
+                return false;
+            }
+
+            SceneFile parser(filename, scene, r);
+            const char *p = file.data(), *end = p + file.size();
+            while (p < end) {
+                const char *eol = static_cast<const char*>(std::memchr(p, '\n', size_t(end - p)));
+                if (!eol) eol = end;
+                parser.line_no++;
+                if (!parser.split_line(p, eol) || (!parser.tokens.empty() && !parser.statement()))
+                    return false;
+                p = eol + 1;
+            }
+
+            scene.buildBVH(parser.bvh_opts);
+            return true;
+        }
+
+    private:
+        struct Token { const char *text; size_t size; };
+
+        std::string filename;
+        Scene &scene;
+        Renderer &r;
+        BVHBuildOptions bvh_opts;
+
+        std::unordered_map<std::string, shared_ptr<Texture>> textures;
+        std::unordered_map<std::string, shared_ptr<Material>> materials;
+        std::unordered_map<std::string, shared_ptr<Object>> objects;
+
+        size_t line_no = 0;
+        std::vector<Token> tokens; // of the current line.
+        size_t next = 0;           // next token to read.
+
+        SceneFile(const std::string &filename, Scene &scene, Renderer &r) : filename(filename), scene(scene), r(r) {}
+
+        // splits [p, eol) into tokens, up to a comment.
+        bool split_line(const char *p, const char *eol) {
+            tokens.clear();
+            next = 0;
+            while (true) {
+                while (p < eol && std::isspace(static_cast<unsigned char>(*p))) p++;
+                if (p >= eol || *p == '#') return true;
+
+                const char *start = p;
+                if (*p == '"') {
+                    start = ++p;
+                    while (p < eol && *p != '"') p++;
+                    if (p >= eol) return error("unterminated quote");
+                    tokens.push_back(Token{ start, size_t(p - start) });
+                    p++;
+                } else {
+                    while (p < eol && !std::isspace(static_cast<unsigned char>(*p))) p++;
+                    tokens.push_back(Token{ start, size_t(p - start) });
+                }
+            }
+        }
+
+        bool error(const std::string &why) {
+            std::cerr << "ERROR: " << why << " in scene file '" << filename << "', line " << line_no << ".\n";
+            return false;
+        }
+
+        bool at_end() const { return next >= tokens.size(); }
+
+        // prints that the next token isn't a what that's expected here.
+        bool unknown(const char *what) {
+            if (at_end()) return error(std::string("missing ") + what);
+            return error(std::string("unknown ") + what + " '" + std::string(tokens[next].text, tokens[next].size) + "'");
+        }
+
+        // returns if the next token is word, and reads it if so.
+        bool accept(const char *word) {
+            if (at_end()) return false;
+            const Token &t = tokens[next];
+            if (t.size != std::strlen(word) || std::memcmp(t.text, word, t.size) != 0) return false;
+            next++;
+            return true;
+        }
+
+        bool word(std::string &w, const char *what) {
+            if (at_end()) return error(std::string("missing ") + what);
+            w.assign(tokens[next].text, tokens[next].size);
+            next++;
+            return true;
+        }
+
+        bool next_is_number() const {
+            if (at_end()) return false;
+            char c = tokens[next].text[0];
+            return std::isdigit(static_cast<unsigned char>(c)) || c == '-' || c == '+' || c == '.';
+        }
+
+        bool number(double &x) {
+            if (at_end()) return error("missing number");
+            const Token &t = tokens[next++];
+            if (parse_decimal(t.text, t.size, x)) return true;
+
+            // exponents, long mantissas, inf... go through strtod.
+            std::string w(t.text, t.size);
+            char *stop;
+            x = std::strtod(w.c_str(), &stop);
+            if (w.empty() || *stop != '\0') return error("expected a number, got '" + w + "'");
+            return true;
+        }
+
+        // parses a plain decimal ([-+]digits[.digits]) of at most 15 digits, which is how scene files write
+        // nearly every number, several times faster than strtod. the digits as an integer & the power of ten
+        // are both exact doubles, so the one division rounds correctly, to what strtod returns (Clinger's
+        // fast path). returns false for anything else.
+        static bool parse_decimal(const char *s, size_t n, double &x) {
+            static const double powers_of_ten[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+                                                    1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15 };
+            const char *end = s + n;
+            bool negative = (s < end && *s == '-');
+            if (s < end && (*s == '-' || *s == '+')) s++;
+
+            uint64_t digits = 0;
+            int n_digits = 0, n_fraction = 0;
+            bool point = false;
+            for (; s < end; s++) {
+                if (*s >= '0' && *s <= '9') {
+                    if (++n_digits > 15) return false;
+                    digits = digits * 10 + uint64_t(*s - '0');
+                    n_fraction += point;
+                } else if (*s == '.' && !point) {
+                    point = true;
+                } else {
+                    return false;
+                }
+            }
+            if (n_digits == 0) return false;
+
+            x = double(digits) / powers_of_ten[n_fraction];
+            if (negative) x = -x;
+            return true;
+        }
+
+        bool integer(int &n) {
+            double x;
+            if (!number(x)) return false;
+            n = int(x);
+            if (n != x) return error("expected an integer");
+            return true;
+        }
+
+        bool vector(Vector3d &v) {
+            double x, y, z;
+            if (!number(x) || !number(y) || !number(z)) return false;
+            v = Vector3d(x, y, z);
+            return true;
+        }
+
+        bool color(Color &c) {
+            double red, green, blue;
+            if (!number(red) || !number(green) || !number(blue)) return false;
+            c = Color(red, green, blue);
+            return true;
+        }
+
+        // <tex>: a texture's name or an r g b color.
+        shared_ptr<Texture> texture() {
+            if (next_is_number()) {
+                Color c;
+                return color(c) ? make_shared<SolidColorTexture>(c) : nullptr;
+            }
+            return lookup(textures, "texture");
+        }
+
+        template <typename T>
+        shared_ptr<T> lookup(const std::unordered_map<std::string, shared_ptr<T>> &names, const char *what) {
+            std::string name;
+            if (!word(name, what)) return nullptr;
+            auto it = names.find(name);
+            if (it == names.end()) { error(std::string("unknown ") + what + " '" + name + "'"); return nullptr; }
+            return it->second;
+        }
+
+        bool statement() {
+            bool ok;
+            if (accept("image")) ok = integer(scene.image_w) && number(scene.aspect_ratio);
+            else if (accept("background")) ok = color(scene.bgColor);
+            else if (accept("camera")) ok = camera();
+            else if (accept("render")) ok = render();
+            else if (accept("bvh")) ok = bvh();
+            else if (accept("texture")) ok = define_texture();
+            else if (accept("material")) ok = define_material();
+            else if (accept("define")) {
+                std::string name;
+                ok = word(name, "object name");
+                auto obj = ok ? object() : nullptr;
+                ok = obj != nullptr;
+                if (ok) objects[name] = obj;
+            } else {
+                auto obj = object();
+                ok = obj != nullptr;
+                if (ok) scene.add(obj);
+            }
+            if (ok && !at_end())
+                return error("unexpected '" + std::string(tokens[next].text, tokens[next].size) + "'");
+            return ok;
+        }
+
+        bool camera() {
+            while (!at_end()) {
+                bool ok;
+                if (accept("vfov")) ok = number(scene.vfov);
+                else if (accept("eye")) ok = vector(scene.eye_pos);
+                else if (accept("gaze")) ok = vector(scene.gaze_pos);
+                else if (accept("up")) ok = vector(scene.up_dir);
+                else if (accept("defocus")) ok = number(scene.defocus_angle);
+                else if (accept("focus")) ok = number(scene.focal_dist);
+                else return unknown("camera setting");
+                if (!ok) return false;
+            }
+            return true;
+        }
+
+        bool render() {
+            while (!at_end()) {
+                bool ok = true;
+                double seed;
+                if (accept("spp")) ok = integer(r.spp);
+                else if (accept("depth")) ok = integer(r.max_depth);
+                else if (accept("packet")) ok = integer(r.packet_size);
+                else if (accept("threads")) ok = integer(r.n_threads);
+                else if (accept("seed")) { ok = number(seed); r.seed = uint64_t(seed); }
+                else if (accept("adaptive")) {
+                    r.adaptive = true;
+                    ok = integer(r.min_spp) && integer(r.max_spp) && number(r.error_threshold);
+                } else if (accept("tonemap")) {
+                    if (accept("clamp")) r.tonemap = Tonemap::Clamp;
+                    else if (accept("reinhard")) r.tonemap = Tonemap::Reinhard;
+                    else return error("expected clamp or reinhard");
+                } else if (accept("exposure")) ok = number(r.exposure);
+                else if (accept("budget")) ok = number(r.time_budget);
+                else if (accept("noise")) ok = number(r.noise_target);
+                else return unknown("render setting");
+                if (!ok) return false;
+            }
+            return true;
+        }
+
+        bool bvh() {
+            while (!at_end()) {
+                bool ok = true;
+                if (accept("split")) {
+                    if (accept("middle")) bvh_opts.split = BVHSplit::Middle;
+                    else if (accept("sah")) bvh_opts.split = BVHSplit::SAH;
+                    else return error("expected middle or sah");
+                } else if (accept("layout")) {
+                    if (accept("binary")) bvh_opts.layout = BVHLayout::Binary;
+                    else if (accept("wide4")) bvh_opts.layout = BVHLayout::Wide4;
+                    else return error("expected binary or wide4");
+                } else if (accept("leaf")) ok = integer(bvh_opts.max_leaf_size);
+                else return unknown("bvh setting");
+                if (!ok) return false;
+            }
+            return true;
+        }
+
+        bool define_texture() {
+            std::string name, file;
+            if (!word(name, "texture name")) return false;
+
+            shared_ptr<Texture> tex;
+            double scale;
+            if (accept("solid")) tex = texture();
+            else if (accept("checker")) {
+                if (!number(scale)) return false;
+                auto odd = texture();
+                auto even = odd ? texture() : nullptr;
+                if (even) tex = make_shared<CheckerTexture>(scale, odd, even);
+            } else if (accept("image")) {
+                if (word(file, "image file")) tex = make_shared<ImageTexture>(file.c_str());
+            } else if (accept("noise")) {
+                if (number(scale)) tex = make_shared<NoiseTexture>(scale);
+            } else return unknown("texture type");
+
+            if (!tex) return false;
+            textures[name] = tex;
+            return true;
+        }
+
+        bool define_material() {
+            std::string name;
+            if (!word(name, "material name")) return false;
+
+            shared_ptr<Material> m;
+            shared_ptr<Texture> tex;
+            Color albedo;
+            double x;
+            if (accept("diffuse")) {
+                if ((tex = texture())) m = make_shared<Diffuse>(tex);
+            } else if (accept("metal")) {
+                if (color(albedo) && number(x)) m = make_shared<Metal>(albedo, x);
+            } else if (accept("dielectric")) {
+                if (number(x)) m = make_shared<Dielectric>(x);
+            } else if (accept("light")) {
+                if ((tex = texture())) m = make_shared<DiffuseLight>(tex);
+            } else if (accept("isotropic")) {
+                if ((tex = texture())) m = make_shared<Isotropic>(tex);
+            } else return unknown("material type");
+
+            if (!m) return false;
+            materials[name] = m;
+            return true;
+        }
+
+        // returns the object an <object> expression makes, or null after printing an error.
+        shared_ptr<Object> object() {
+            Point3d p1, p2;
+            Vector3d u, v;
+            double x;
+            shared_ptr<Material> m;
+            shared_ptr<Texture> tex;
+            std::string file;
+
+            if (accept("sphere")) {
+                if (vector(p1) && number(x) && (m = lookup(materials, "material")))
+                    return scene.make<Sphere>(p1, x, m);
+            } else if (accept("moving_sphere")) {
+                if (vector(p1) && vector(p2) && number(x) && (m = lookup(materials, "material")))
+                    return scene.make<Sphere>(p1, p2, x, m);
+            } else if (accept("quad")) {
+                if (vector(p1) && vector(u) && vector(v) && (m = lookup(materials, "material")))
+                    return scene.make<Quad>(p1, u, v, m);
+            } else if (accept("box")) {
+                if (vector(p1) && vector(p2) && (m = lookup(materials, "material")))
+                    return box(p1, p2, m, scene)->bvh;
+            } else if (accept("mesh")) {
+                if (word(file, "mesh file") && (m = lookup(materials, "material"))) {
+                    MeshData data = load_mesh(file);
+                    if (data.empty()) { error("can't load mesh '" + file + "'"); return nullptr; }
+                    return scene.make<TriangleMesh>(data, m, bvh_opts);
+                }
+            } else if (accept("translate")) {
+                shared_ptr<Object> obj;
+                if (vector(u) && (obj = object())) return scene.make<Translate>(obj, u);
+            } else if (accept("rotate_y")) {
+                shared_ptr<Object> obj;
+                if (number(x) && (obj = object())) return scene.make<RotateY>(obj, x);
+            } else if (accept("medium")) {
+                shared_ptr<Object> obj;
+                if (number(x) && (tex = texture()) && (obj = object())) return scene.make<ConstantMedium>(obj, x, tex);
+            } else if (at_end()) {
+                error("missing object");
+            } else {
+                return lookup(objects, "object");
+            }
+            return nullptr;
+        }
+};
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef SHARED_ARRAY_H
+#define SHARED_ARRAY_H
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// a read-only array whose elements live either in a vector it owns, or in memory someone else keeps alive
+// through storage (e.g. a mapped snapshot file), so a structure loaded from a file is used in place.
+// copies share the elements.
+template <typename T>
+class SharedArray {
+    public:
+        SharedArray() {}
+
+        explicit SharedArray(std::vector<T> &&elements) {
+            auto owned = std::make_shared<std::vector<T>>(std::move(elements));
+            items = owned->data();
+            n_items = owned->size();
+            storage = owned;
+        }
+
+        SharedArray(const T *items, size_t n_items, std::shared_ptr<const void> storage)
+          : items(items), n_items(n_items), storage(std::move(storage)) {}
+
+        const T &operator[](size_t i) const { return items[i]; }
+        const T *data() const { return items; }
+        size_t size() const { return n_items; }
+        bool empty() const { return n_items == 0; }
+
+        const T *begin() const { return items; }
+        const T *end() const { return items + n_items; }
+
+    private:
+        const T *items = nullptr;
+        size_t n_items = 0;
+        std::shared_ptr<const void> storage; // keeps items alive.
+};
+
+#endif
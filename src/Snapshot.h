@@ -0,0 +1,681 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "Arena.h"
+#include "BVH.h"
+#include "ConstantMedium.h"
+#include "Instance.h"
+#include "LinearBVH.h"
+#include "MappedFile.h"
+#include "Material.h"
+#include "Mesh.h"
+#include "Object.h"
+#include "PrimitivePool.h"
+#include "Quad.h"
+#include "Scene.h"
+#include "SharedArray.h"
+#include "Sphere.h"
+#include "Texture.h"
+#include "WideBVH.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+// returns a 64-bit hash of the n bytes at p. it reads 32 bytes per step into 4 independent lanes, so
+// checking a large snapshot runs at memory speed; any change to one 8-byte word changes the result.
+inline uint64_t snapshot_checksum(const char *p, size_t n) {
+    const uint64_t prime = 0x9E3779B97F4A7C15ull;
+    uint64_t lanes[4] = { 1, 2, 3, 4 };
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        for (int k = 0; k < 4; k++) {
+            uint64_t word;
+            std::memcpy(&word, p + i + 8*k, 8);
+            lanes[k] = (lanes[k] ^ word) * prime;
+            lanes[k] ^= lanes[k] >> 29;
+        }
+    }
+    uint64_t h = uint64_t(n) * prime;
+    for (int k = 0; k < 4; k++) { h = (h ^ lanes[k]) * prime; h ^= h >> 31; }
+    for (; i < n; i++) { h = (h ^ uint8_t(p[i])) * prime; h ^= h >> 31; }
+    return h;
+}
+
+// a snapshot file: this header, then the payload from offset snapshot_payload_offset. the payload is a
+// sequence of records (textures, materials & objects, each after the ones it refers to, which it names by
+// their index in the file), closed by the scene's own record. arrays inside records start at multiples of
+// 64 bytes from the start of the file & are stored as laid out in memory, so they're used in place.
+struct SnapshotHeader {
+    char magic[8];          // "RTSCENE" & a zero byte.
+    uint32_t version;
+    uint32_t byte_order;    // snapshot_byte_order as written.
+    uint32_t real_size;     // sizeof(Real) & sizeof(Vector3d) of the build that wrote the file; arrays
+    uint32_t vector_size;   // can only be used in place by a build with the same layout.
+    uint64_t key;           // snapshot_checksum of the caller's scene key.
+    uint64_t payload_size;
+    uint64_t checksum;      // snapshot_checksum of the payload.
+};
+
+const char snapshot_magic[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', 0 };
+const uint32_t snapshot_version = 2; // 2: BVHs are at most bvh_max_depth deep, as the traversals assume.
+const uint32_t snapshot_byte_order = 0x01020304;
+const size_t snapshot_payload_offset = 64;
+
+// saves a built scene (camera, objects with their materials & textures, and every BVH in its flattened
+// form) & loads it back, so a run can start tracing without building the scene or any BVH.
+// loading maps the file: BVH nodes, triangle orders & mesh arrays are used in place from the mapped pages;
+// the objects, materials & textures themselves are recreated from their records & pool arrays are copied.
+// load() rejects a snapshot whose checksum doesn't match its contents, that was written by a build with a
+// different layout or format version, or whose key differs from the caller's. the key names what the
+// scene was made from (e.g. its name, the build that made it & the stamps of the files it reads), so a
+// snapshot of an older scene isn't used by mistake.
+// note: objects of other types (e.g. BVHNode, a Scene added as an object) can't be saved.
+class SceneSnapshot {
+    public:
+        static bool save(const Scene &scene, const std::string &filename, const std::string &key) {
+            Writer out;
+            std::vector<uint32_t> objects;
+            for (const auto &obj : scene.objects) objects.push_back(write_object(out, obj.get()));
+            uint32_t bvh = scene.bvh ? write_object(out, scene.bvh.get()) : no_index;
+            if (!out.ok) return false;
+
+            out.put(Tag::Scene);
+            out.put(scene.image_w);
+            out.put(scene.aspect_ratio);
+            out.put(scene.bgColor);
+            out.put(scene.vfov);
+            out.put(scene.eye_pos);
+            out.put(scene.gaze_pos);
+            out.put(scene.up_dir);
+            out.put(scene.defocus_angle);
+            out.put(scene.focal_dist);
+            out.put_array(objects.data(), objects.size());
+            out.put(bvh);
+
+            SnapshotHeader header = {};
+            std::memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+            header.version = snapshot_version;
+            header.byte_order = snapshot_byte_order;
+            header.real_size = sizeof(Real);
+            header.vector_size = sizeof(Vector3d);
+            header.key = snapshot_checksum(key.data(), key.size());
+            header.payload_size = out.bytes.size();
+            header.checksum = snapshot_checksum(out.bytes.data(), out.bytes.size());
+
+            // written under a temporary name & renamed, so a reader never maps a half-written snapshot.
+            std::string temp_filename = filename + ".tmp";
+            {
+                std::ofstream file(temp_filename, std::ios::binary | std::ios::trunc);
+                char padding[snapshot_payload_offset] = {};
+                std::memcpy(padding, &header, sizeof(header));
+                file.write(padding, sizeof(padding));
+                file.write(out.bytes.data(), std::streamsize(out.bytes.size()));
+                if (!file) {
+                    std::cerr << "ERROR: Could not write scene snapshot '" << filename << "'.\n";
+                    return false;
+                }
+            }
+            return std::rename(temp_filename.c_str(), filename.c_str()) == 0;
+        }
+
+        // replaces scene's camera, objects & BVH with the snapshot's. returns false (leaving scene as it
+        // was) if there's no usable snapshot in filename for key.
+        static bool load(Scene &scene, const std::string &filename, const std::string &key) {
+            auto file = std::make_shared<MappedFile>(filename);
+            if (!file->data()) return false;
+
+            SnapshotHeader header;
+            if (file->size() < snapshot_payload_offset) return reject(filename, "truncated");
+            std::memcpy(&header, file->data(), sizeof(header));
+            if (std::memcmp(header.magic, snapshot_magic, sizeof(header.magic)) != 0 ||
+                header.version != snapshot_version || header.byte_order != snapshot_byte_order ||
+                header.real_size != sizeof(Real) || header.vector_size != sizeof(Vector3d))
+                return reject(filename, "written by another version or build configuration");
+            if (header.key != snapshot_checksum(key.data(), key.size()))
+                return reject(filename, "made from a different scene");
+            const char *payload = file->data() + snapshot_payload_offset;
+            if (header.payload_size != file->size() - snapshot_payload_offset ||
+                header.checksum != snapshot_checksum(payload, size_t(header.payload_size)))
+                return reject(filename, "checksum mismatch");
+
+            Reader in(file, scene.arena);
+            while (in.ok) {
+                Tag tag = in.get<Tag>();
+                if (!in.ok || tag == Tag::Scene) break;
+                if (tag < Tag::FirstMaterial) read_texture(in, tag);
+                else if (tag < Tag::FirstObject) read_material(in, tag);
+                else read_object(in, tag);
+            }
+
+            int image_w = in.get<int>();
+            double aspect_ratio = in.get<double>();
+            Color bgColor = in.get<Color>();
+            double vfov = in.get<double>();
+            Point3d eye_pos = in.get<Point3d>(), gaze_pos = in.get<Point3d>();
+            Vector3d up_dir = in.get<Vector3d>();
+            double defocus_angle = in.get<double>(), focal_dist = in.get<double>();
+            SharedArray<uint32_t> objects = in.array<uint32_t>();
+            uint32_t bvh = in.get<uint32_t>();
+            shared_ptr<BVHAccel> accel = (bvh == no_index) ? nullptr : in.accel(bvh);
+            for (uint32_t id : objects) in.object(id);
+            if (!in.ok) return reject(filename, "corrupt");
+
+            scene.image_w = image_w;
+            scene.aspect_ratio = aspect_ratio;
+            scene.bgColor = bgColor;
+            scene.vfov = vfov;
+            scene.eye_pos = eye_pos;
+            scene.gaze_pos = gaze_pos;
+            scene.up_dir = up_dir;
+            scene.defocus_angle = defocus_angle;
+            scene.focal_dist = focal_dist;
+            scene.clear();
+            for (uint32_t id : objects) scene.add(in.object(id));
+            scene.bvh = accel;
+            return true;
+        }
+
+    private:
+        enum class Tag : uint32_t {
+            SolidColorTexture, CheckerTexture, ImageTexture, NoiseTexture,
+            FirstMaterial = 100, Diffuse = FirstMaterial, Metal, Dielectric, DiffuseLight, Isotropic,
+            FirstObject = 200, Sphere = FirstObject, Quad, Translate, RotateY, Instance, ConstantMedium,
+            LinearBVH, BVH4, SpherePool, QuadPool, TriangleMesh,
+            Scene = 1000
+        };
+
+        static const uint32_t no_index = UINT32_MAX;
+
+        // appends records to a byte buffer; textures, materials & objects already written are looked up
+        // by identity, so each is written once however many things refer to it.
+        struct Writer {
+            std::vector<char> bytes;
+            std::unordered_map<const Object*, uint32_t> objects;
+            std::unordered_map<const Material*, uint32_t> materials;
+            std::unordered_map<const Texture*, uint32_t> textures;
+            bool ok = true;
+
+            template <typename T>
+            void put(const T &value) {
+                static_assert(std::is_trivially_copyable<T>::value, "snapshot fields are stored as raw bytes");
+                const char *p = reinterpret_cast<const char*>(&value);
+                bytes.insert(bytes.end(), p, p + sizeof(T));
+            }
+
+            // an element count, then the elements from the next multiple of 64 bytes in the file.
+            template <typename T>
+            void put_array(const T *items, size_t n) {
+                static_assert(std::is_trivially_copyable<T>::value, "snapshot fields are stored as raw bytes");
+                put(uint64_t(n));
+                size_t offset = snapshot_payload_offset + bytes.size();
+                bytes.resize(bytes.size() + ((64 - offset % 64) % 64), 0);
+                const char *p = reinterpret_cast<const char*>(items);
+                bytes.insert(bytes.end(), p, p + n * sizeof(T));
+            }
+
+            void put_string(const std::string &s) { put_array(s.data(), s.size()); }
+        };
+
+        // reads records from a mapped snapshot, recreating what they describe. every read is bounds
+        // checked; a failed one clears ok & returns zeros, so a corrupt file is rejected, never trusted.
+        struct Reader {
+            std::shared_ptr<const MappedFile> file;
+            std::shared_ptr<Arena> arena;
+            const char *p, *end;
+            bool ok = true;
+
+            std::vector<shared_ptr<Texture>> textures;
+            std::vector<shared_ptr<Material>> materials;
+            std::vector<shared_ptr<Object>> objects;
+
+            Reader(std::shared_ptr<const MappedFile> file, std::shared_ptr<Arena> arena)
+              : file(file), arena(arena), p(file->data() + snapshot_payload_offset), end(file->data() + file->size()) {}
+
+            // note: T's constructor isn't run (e.g. Perlin's would draw random numbers), only its bytes copied.
+            template <typename T>
+            T get() {
+                typename std::aligned_storage<sizeof(T), alignof(T)>::type value = {};
+                if (size_t(end - p) < sizeof(T)) ok = false;
+                else {
+                    std::memcpy(&value, p, sizeof(T));
+                    p += sizeof(T);
+                }
+                return *reinterpret_cast<const T*>(&value);
+            }
+
+            // the elements in place in the mapped file, kept alive by the array.
+            template <typename T>
+            SharedArray<T> array() {
+                uint64_t n = get<uint64_t>();
+                size_t offset = size_t(p - file->data());
+                size_t padding = (64 - offset % 64) % 64;
+                if (!ok || size_t(end - p) < padding || n > (size_t(end - p) - padding) / sizeof(T)) {
+                    ok = false;
+                    return SharedArray<T>();
+                }
+                const T *items = reinterpret_cast<const T*>(p + padding);
+                p += padding + n * sizeof(T);
+                return SharedArray<T>(items, size_t(n), file);
+            }
+
+            template <typename T>
+            std::vector<T> vector() {
+                SharedArray<T> items = array<T>();
+                return std::vector<T>(items.begin(), items.end());
+            }
+
+            std::string string() {
+                SharedArray<char> chars = array<char>();
+                return std::string(chars.begin(), chars.end());
+            }
+
+            shared_ptr<Texture> texture(uint32_t id) {
+                if (id >= textures.size()) { ok = false; return make_shared<SolidColorTexture>(Color()); }
+                return textures[id];
+            }
+
+            shared_ptr<Material> material(uint32_t id) {
+                if (id >= materials.size()) { ok = false; return make_shared<Diffuse>(Color()); }
+                return materials[id];
+            }
+
+            shared_ptr<Object> object(uint32_t id) {
+                if (id >= objects.size() || !objects[id]) { ok = false; return nullptr; }
+                return objects[id];
+            }
+
+            shared_ptr<BVHAccel> accel(uint32_t id) {
+                auto accel = std::dynamic_pointer_cast<BVHAccel>(object(id));
+                if (!accel) ok = false;
+                return accel;
+            }
+
+        };
+
+        // a T allocated from the scene's arena (like Scene::make), made with T's private default constructor
+        // for the fields to be filled in from its record.
+        template <typename T>
+        static shared_ptr<T> create(Reader &in) {
+            T *object = new (in.arena->allocate(sizeof(T), alignof(T))) T();
+            return shared_ptr<T>(object, [](T *t) { t->~T(); }, ArenaAllocator<T>(in.arena));
+        }
+
+        static bool reject(const std::string &filename, const char *why) {
+            std::cerr << "WARNING: Ignoring scene snapshot '" << filename << "' (" << why << ").\n";
+            return false;
+        }
+
+        // Textures & materials.
+
+        static uint32_t write_texture(Writer &out, const Texture *texture) {
+            auto it = out.textures.find(texture);
+            if (it != out.textures.end()) return it->second;
+
+            const Texture &tex = *texture;
+            if (auto t = dynamic_cast<const SolidColorTexture*>(&tex)) {
+                out.put(Tag::SolidColorTexture);
+                out.put(t->albedo);
+            } else if (auto t = dynamic_cast<const CheckerTexture*>(&tex)) {
+                uint32_t odd = write_texture(out, t->odd.get()), even = write_texture(out, t->even.get());
+                out.put(Tag::CheckerTexture);
+                out.put(t->invScale);
+                out.put(odd);
+                out.put(even);
+            } else if (auto t = dynamic_cast<const ImageTexture*>(&tex)) {
+                out.put(Tag::ImageTexture);
+                out.put_string(t->filename);
+            } else if (auto t = dynamic_cast<const NoiseTexture*>(&tex)) {
+                out.put(Tag::NoiseTexture);
+                out.put(t->scale);
+                out.put(t->perlin);
+            } else {
+                return unsupported(out, typeid(tex).name());
+            }
+
+            uint32_t id = uint32_t(out.textures.size());
+            out.textures[texture] = id;
+            return id;
+        }
+
+        static void read_texture(Reader &in, Tag tag) {
+            shared_ptr<Texture> tex;
+            if (tag == Tag::SolidColorTexture) {
+                tex = make_shared<SolidColorTexture>(in.get<Color>());
+            } else if (tag == Tag::CheckerTexture) {
+                auto t = shared_ptr<CheckerTexture>(new CheckerTexture());
+                t->invScale = in.get<double>();
+                t->odd = in.texture(in.get<uint32_t>());
+                t->even = in.texture(in.get<uint32_t>());
+                tex = t;
+            } else if (tag == Tag::ImageTexture) {
+                tex = make_shared<ImageTexture>(in.string().c_str());
+            } else if (tag == Tag::NoiseTexture) {
+                double scale = in.get<double>();
+                tex = shared_ptr<NoiseTexture>(new NoiseTexture(scale, in.get<Perlin>()));
+            } else {
+                in.ok = false;
+                return;
+            }
+            in.textures.push_back(tex);
+        }
+
+        static uint32_t write_material(Writer &out, const Material *m) {
+            auto it = out.materials.find(m);
+            if (it != out.materials.end()) return it->second;
+
+            const Material &material = *m;
+            if (auto m = dynamic_cast<const Diffuse*>(&material)) {
+                uint32_t tex = write_texture(out, m->tex.get());
+                out.put(Tag::Diffuse);
+                out.put(tex);
+            } else if (auto m = dynamic_cast<const Metal*>(&material)) {
+                out.put(Tag::Metal);
+                out.put(m->albedo);
+                out.put(m->fuzz);
+            } else if (auto m = dynamic_cast<const Dielectric*>(&material)) {
+                out.put(Tag::Dielectric);
+                out.put(m->ior);
+            } else if (auto m = dynamic_cast<const DiffuseLight*>(&material)) {
+                uint32_t tex = write_texture(out, m->tex.get());
+                out.put(Tag::DiffuseLight);
+                out.put(tex);
+            } else if (auto m = dynamic_cast<const Isotropic*>(&material)) {
+                uint32_t tex = write_texture(out, m->tex.get());
+                out.put(Tag::Isotropic);
+                out.put(tex);
+            } else {
+                return unsupported(out, typeid(material).name());
+            }
+
+            uint32_t id = uint32_t(out.materials.size());
+            out.materials[m] = id;
+            return id;
+        }
+
+        static void read_material(Reader &in, Tag tag) {
+            shared_ptr<Material> material;
+            if (tag == Tag::Diffuse) {
+                material = make_shared<Diffuse>(in.texture(in.get<uint32_t>()));
+            } else if (tag == Tag::Metal) {
+                Color albedo = in.get<Color>();
+                material = make_shared<Metal>(albedo, in.get<double>());
+            } else if (tag == Tag::Dielectric) {
+                material = make_shared<Dielectric>(in.get<double>());
+            } else if (tag == Tag::DiffuseLight) {
+                material = make_shared<DiffuseLight>(in.texture(in.get<uint32_t>()));
+            } else if (tag == Tag::Isotropic) {
+                material = make_shared<Isotropic>(in.texture(in.get<uint32_t>()));
+            } else {
+                in.ok = false;
+                return;
+            }
+            in.materials.push_back(material);
+        }
+
+        // Objects.
+
+        static uint32_t write_object(Writer &out, const Object *obj) {
+            auto it = out.objects.find(obj);
+            if (it != out.objects.end()) return it->second;
+
+            if (auto s = dynamic_cast<const Sphere*>(obj)) {
+                uint32_t material = write_material(out, s->material.ptr.get());
+                out.put(Tag::Sphere);
+                out.put(s->center);
+                out.put(s->radius);
+                out.put(material);
+                out.put(s->aabb);
+            } else if (auto q = dynamic_cast<const Quad*>(obj)) {
+                uint32_t material = write_material(out, q->material.ptr.get());
+                out.put(Tag::Quad);
+                out.put(q->Q); out.put(q->u); out.put(q->v); out.put(q->w);
+                out.put(material);
+                out.put(q->aabb);
+                out.put(q->normal);
+                out.put(q->D);
+                out.put(q->area);
+            } else if (auto t = dynamic_cast<const Translate*>(obj)) {
+                uint32_t child = write_object(out, t->obj.get());
+                out.put(Tag::Translate);
+                out.put(child);
+                out.put(t->offset);
+                out.put(t->aabb);
+            } else if (auto r = dynamic_cast<const RotateY*>(obj)) {
+                uint32_t child = write_object(out, r->obj.get());
+                out.put(Tag::RotateY);
+                out.put(child);
+                out.put(r->cos_theta);
+                out.put(r->sin_theta);
+                out.put(r->aabb);
+            } else if (auto inst = dynamic_cast<const Instance*>(obj)) {
+                uint32_t blas = write_object(out, inst->blas.get());
+                out.put(Tag::Instance);
+                out.put(blas);
+                out.put(inst->to_world);
+                out.put(inst->aabb);
+            } else if (auto medium = dynamic_cast<const ConstantMedium*>(obj)) {
+                uint32_t boundary = write_object(out, medium->boundary.get());
+                uint32_t phase_function = write_material(out, medium->phase_function.ptr.get());
+                out.put(Tag::ConstantMedium);
+                out.put(boundary);
+                out.put(medium->negInv_density);
+                out.put(phase_function);
+            } else if (auto bvh = dynamic_cast<const LinearBVH*>(obj)) {
+                auto leaves = write_leaves(out, *bvh);
+                out.put(Tag::LinearBVH);
+                put_leaves(out, *bvh, leaves);
+                out.put_array(bvh->nodes.data(), bvh->nodes.size());
+            } else if (auto bvh = dynamic_cast<const BVH4*>(obj)) {
+                auto leaves = write_leaves(out, *bvh);
+                out.put(Tag::BVH4);
+                put_leaves(out, *bvh, leaves);
+                out.put_array(bvh->nodes.data(), bvh->nodes.size());
+            } else if (auto pool = dynamic_cast<const SpherePool*>(obj)) {
+                const SphereBuffer &b = pool->buffer;
+                auto materials = write_materials(out, b.materials, b.material_slot);
+                out.put(Tag::SpherePool);
+                put_pool(out, *pool);
+                for (int a = 0; a < 3; a++) put_vector(out, b.center[a]);
+                for (int a = 0; a < 3; a++) put_vector(out, b.motion[a]);
+                put_vector(out, b.radius);
+                put_vector(out, materials);
+            } else if (auto pool = dynamic_cast<const QuadPool*>(obj)) {
+                const QuadBuffer &b = pool->buffer;
+                auto materials = write_materials(out, b.materials, b.material_slot);
+                out.put(Tag::QuadPool);
+                put_pool(out, *pool);
+                const std::vector<Real> (*arrays[])[3] = { &b.Q, &b.u, &b.v, &b.w, &b.normal };
+                for (auto array : arrays)
+                    for (int a = 0; a < 3; a++) put_vector(out, (*array)[a]);
+                put_vector(out, b.D);
+                put_vector(out, materials);
+            } else if (auto mesh = dynamic_cast<const TriangleMesh*>(obj)) {
+                const MeshData &m = mesh->mesh;
+                uint32_t material = write_material(out, mesh->material.ptr.get());
+                out.put(Tag::TriangleMesh);
+                out.put(material);
+                out.put(mesh->aabb);
+                out.put_array(m.positions, m.n_vertices * 3);
+                out.put_array(m.normals, m.normals ? m.n_vertices * 3 : 0);
+                out.put_array(m.uvs, m.uvs ? m.n_vertices * 2 : 0);
+                out.put_array(m.indices, m.n_triangles * 3);
+                out.put_array(mesh->triangles.data(), mesh->triangles.size());
+                out.put_array(mesh->nodes.data(), mesh->nodes.size());
+            } else {
+                return unsupported(out, typeid(*obj).name());
+            }
+
+            uint32_t id = uint32_t(out.objects.size());
+            out.objects[obj] = id;
+            return id;
+        }
+
+        static void read_object(Reader &in, Tag tag) {
+            shared_ptr<Object> obj;
+            if (tag == Tag::Sphere) {
+                auto s = create<Sphere>(in);
+                s->center = in.get<Ray>();
+                s->radius = in.get<Real>();
+                s->material = in.material(in.get<uint32_t>());
+                s->aabb = in.get<AABB>();
+                obj = s;
+            } else if (tag == Tag::Quad) {
+                auto q = create<Quad>(in);
+                q->Q = in.get<Point3d>(); q->u = in.get<Vector3d>(); q->v = in.get<Vector3d>(); q->w = in.get<Vector3d>();
+                q->material = in.material(in.get<uint32_t>());
+                q->aabb = in.get<AABB>();
+                q->normal = in.get<Vector3d>();
+                q->D = in.get<Real>();
+                q->area = in.get<Real>();
+                obj = q;
+            } else if (tag == Tag::Translate) {
+                auto t = create<Translate>(in);
+                t->obj = in.object(in.get<uint32_t>());
+                t->offset = in.get<Vector3d>();
+                t->aabb = in.get<AABB>();
+                obj = t;
+            } else if (tag == Tag::RotateY) {
+                auto r = create<RotateY>(in);
+                r->obj = in.object(in.get<uint32_t>());
+                r->cos_theta = in.get<double>();
+                r->sin_theta = in.get<double>();
+                r->aabb = in.get<AABB>();
+                obj = r;
+            } else if (tag == Tag::Instance) {
+                auto inst = create<Instance>(in);
+                inst->blas = in.accel(in.get<uint32_t>());
+                inst->to_world = in.get<Transform>();
+                inst->aabb = in.get<AABB>();
+                obj = inst;
+            } else if (tag == Tag::ConstantMedium) {
+                auto medium = create<ConstantMedium>(in);
+                medium->boundary = in.object(in.get<uint32_t>());
+                medium->negInv_density = in.get<double>();
+                medium->phase_function = in.material(in.get<uint32_t>());
+                obj = medium;
+            } else if (tag == Tag::LinearBVH) {
+                auto bvh = create<LinearBVH>(in);
+                get_leaves(in, *bvh);
+                bvh->nodes = in.array<LinearBVHNode>();
+                obj = bvh;
+            } else if (tag == Tag::BVH4) {
+                auto bvh = create<BVH4>(in);
+                get_leaves(in, *bvh);
+                bvh->nodes = in.array<BVH4Node>();
+                obj = bvh;
+            } else if (tag == Tag::SpherePool) {
+                auto pool = create<SpherePool>(in);
+                SphereBuffer &b = pool->buffer;
+                get_pool(in, *pool);
+                for (int a = 0; a < 3; a++) b.center[a] = in.vector<Real>();
+                for (int a = 0; a < 3; a++) b.motion[a] = in.vector<Real>();
+                b.radius = in.vector<Real>();
+                b.material_slot = get_materials(in, b.materials);
+                obj = pool;
+            } else if (tag == Tag::QuadPool) {
+                auto pool = create<QuadPool>(in);
+                QuadBuffer &b = pool->buffer;
+                get_pool(in, *pool);
+                std::vector<Real> (*arrays[])[3] = { &b.Q, &b.u, &b.v, &b.w, &b.normal };
+                for (auto array : arrays)
+                    for (int a = 0; a < 3; a++) (*array)[a] = in.vector<Real>();
+                b.D = in.vector<Real>();
+                b.material_slot = get_materials(in, b.materials);
+                obj = pool;
+            } else if (tag == Tag::TriangleMesh) {
+                auto mesh = create<TriangleMesh>(in);
+                mesh->material = in.material(in.get<uint32_t>());
+                mesh->aabb = in.get<AABB>();
+                SharedArray<float> positions = in.array<float>(), normals = in.array<float>(), uvs = in.array<float>();
+                SharedArray<uint32_t> indices = in.array<uint32_t>();
+                MeshData &m = mesh->mesh;
+                m.positions = positions.data();
+                m.normals = normals.empty() ? nullptr : normals.data();
+                m.uvs = uvs.empty() ? nullptr : uvs.data();
+                m.indices = indices.data();
+                m.n_vertices = positions.size() / 3;
+                m.n_triangles = indices.size() / 3;
+                m.storage = in.file;
+                mesh->triangles = in.array<uint32_t>();
+                mesh->nodes = in.array<LinearBVHNode>();
+                obj = mesh;
+            } else {
+                in.ok = false;
+                return;
+            }
+            in.objects.push_back(obj);
+        }
+
+        // the objects in a BVH's leaves, written before the BVH itself.
+        static std::vector<uint32_t> write_leaves(Writer &out, const BVHAccel &accel) {
+            std::vector<uint32_t> leaves;
+            leaves.reserve(accel.owned.size());
+            for (const auto &obj : accel.owned) leaves.push_back(write_object(out, obj.get()));
+            return leaves;
+        }
+
+        static void put_leaves(Writer &out, const BVHAccel &accel, const std::vector<uint32_t> &leaves) {
+            out.put(accel.aabb);
+            out.put_array(leaves.data(), leaves.size());
+        }
+
+        static void get_leaves(Reader &in, BVHAccel &accel) {
+            accel.aabb = in.get<AABB>();
+            SharedArray<uint32_t> leaves = in.array<uint32_t>();
+            accel.owned.reserve(leaves.size());
+            accel.leaf_objects.reserve(leaves.size());
+            for (uint32_t id : leaves) {
+                accel.owned.push_back(in.object(id));
+                accel.leaf_objects.push_back(accel.owned.back().get());
+            }
+        }
+
+        template <typename Buffer>
+        static void put_pool(Writer &out, const PrimitivePool<Buffer> &pool) {
+            out.put(pool.aabb);
+            out.put(uint64_t(pool.n_primitives));
+            out.put_array(pool.nodes.data(), pool.nodes.size());
+        }
+
+        template <typename Buffer>
+        static void get_pool(Reader &in, PrimitivePool<Buffer> &pool) {
+            pool.aabb = in.get<AABB>();
+            pool.n_primitives = size_t(in.get<uint64_t>());
+            pool.nodes = in.array<LinearBVHNode>();
+        }
+
+        // a pool's materials are written per primitive.
+        static std::vector<uint32_t> write_materials(Writer &out, const MaterialSlots &materials,
+                                                     const std::vector<uint32_t> &slots) {
+            std::vector<uint32_t> ids;
+            ids.reserve(slots.size());
+            for (uint32_t slot : slots) ids.push_back(write_material(out, materials[slot].get()));
+            return ids;
+        }
+
+        static std::vector<uint32_t> get_materials(Reader &in, MaterialSlots &materials) {
+            std::vector<uint32_t> slots;
+            for (uint32_t id : in.array<uint32_t>()) slots.push_back(materials.add(in.material(id)));
+            return slots;
+        }
+
+        template <typename T>
+        static void put_vector(Writer &out, const std::vector<T> &v) { out.put_array(v.data(), v.size()); }
+
+        static uint32_t unsupported(Writer &out, const char *type) {
+            std::cerr << "ERROR: Can't save an object of type '" << type << "' in a scene snapshot.\n";
+            out.ok = false;
+            return no_index;
+        }
+};
+
+#endif
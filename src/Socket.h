@@ -0,0 +1,307 @@
+#ifndef SOCKET_H
+#define SOCKET_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #define RT_HAS_SOCKETS 1
+    #include <cerrno>
+    #include <netdb.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <unistd.h>
+#else
+    #define RT_HAS_SOCKETS 0
+#endif
+
+#ifndef MSG_NOSIGNAL
+    #define MSG_NOSIGNAL 0 // macOS: SO_NOSIGPIPE is set on every socket instead.
+#endif
+
+// one message of the render protocol (see Distributed.h): a type & a payload of at most max_size bytes.
+// on the wire it's the type & the payload size (uint32 each, in host byte order) followed by the payload.
+struct Message {
+    static const uint32_t max_size = 1u << 28;
+
+    uint32_t type = 0;
+    std::vector<char> payload;
+
+    Message() {}
+    explicit Message(uint32_t type) : type(type) {}
+
+    // appends values to the payload.
+    Message &put(const void *data, size_t size) {
+        payload.insert(payload.end(), static_cast<const char*>(data), static_cast<const char*>(data) + size);
+        return *this;
+    }
+    template <typename T> Message &put(T value) { return put(&value, sizeof(T)); }
+    Message &put(const std::string &s) { put(uint32_t(s.size())); return put(s.data(), s.size()); }
+};
+
+// reads values from a message's payload front to back. every get returns false, & so do all later ones,
+// once the payload is too short.
+class MessageReader {
+    public:
+        explicit MessageReader(const Message &m) : p(m.payload.data()), end(m.payload.data() + m.payload.size()) {}
+
+        bool get(void *data, size_t size) {
+            if (size_t(end - p) < size) { p = end; ok = false; }
+            if (!ok) return false;
+            std::memcpy(data, p, size);
+            p += size;
+            return true;
+        }
+        template <typename T> bool get(T &value) { return get(&value, sizeof(T)); }
+        bool get(std::string &s) {
+            uint32_t size;
+            if (!get(size) || size_t(end - p) < size) return ok = false;
+            s.assign(p, size);
+            p += size;
+            return true;
+        }
+
+        // the rest of the payload, read in place.
+        const char *rest(size_t &size) const { size = ok ? size_t(end - p) : 0; return p; }
+
+    private:
+        const char *p, *end;
+        bool ok = true;
+};
+
+// a TCP socket that closes itself: a connection, or a listening socket that accepts them.
+// messages are sent whole & received either whole (receive(), blocking) or piecewise as bytes arrive
+// (poll_receive(), for serving many connections from one thread).
+// note: without POSIX sockets (non-POSIX platforms) every socket is invalid.
+class Socket {
+    public:
+        Socket() {}
+        ~Socket() { close(); }
+
+        Socket(Socket &&other) : fd(other.fd), inbox(std::move(other.inbox)) { other.fd = -1; }
+        Socket &operator=(Socket &&other) {
+            if (this != &other) {
+                close();
+                fd = other.fd, other.fd = -1;
+                inbox = std::move(other.inbox);
+            }
+            return *this;
+        }
+        Socket(const Socket &) = delete;
+        Socket &operator=(const Socket &) = delete;
+
+        bool valid() const { return fd >= 0; }
+
+        // returns a socket listening on port of every interface, or an invalid one (with error set).
+        static Socket listen(int port, std::string &error) {
+            Socket s;
+#if RT_HAS_SOCKETS
+            s.fd = ::socket(AF_INET6, SOCK_STREAM, 0);
+            bool v6 = s.fd >= 0;
+            if (!v6) s.fd = ::socket(AF_INET, SOCK_STREAM, 0);
+            if (s.fd < 0) { error = std::strerror(errno); return s; }
+
+            int on = 1, off = 0;
+            ::setsockopt(s.fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            int bound;
+            if (v6) {
+                ::setsockopt(s.fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)); // take IPv4 connections too.
+                sockaddr_in6 addr;
+                std::memset(&addr, 0, sizeof(addr));
+                addr.sin6_family = AF_INET6;
+                addr.sin6_addr = in6addr_any;
+                addr.sin6_port = htons(uint16_t(port));
+                bound = ::bind(s.fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+            } else {
+                sockaddr_in addr;
+                std::memset(&addr, 0, sizeof(addr));
+                addr.sin_family = AF_INET;
+                addr.sin_addr.s_addr = htonl(INADDR_ANY);
+                addr.sin_port = htons(uint16_t(port));
+                bound = ::bind(s.fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+            }
+            if (bound != 0 || ::listen(s.fd, 64) != 0) { error = std::strerror(errno); s.close(); }
+#else
+            (void)port;
+            error = "sockets aren't supported on this platform";
+#endif
+            return s;
+        }
+
+        // returns a connection to host:port, or an invalid socket (with error set).
+        static Socket connect(const std::string &host, int port, std::string &error) {
+            Socket s;
+#if RT_HAS_SOCKETS
+            addrinfo hints, *found = nullptr;
+            std::memset(&hints, 0, sizeof(hints));
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            int status = ::getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found);
+            if (status != 0) { error = ::gai_strerror(status); return s; }
+
+            for (addrinfo *a = found; a; a = a->ai_next) {
+                s.fd = ::socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+                if (s.fd < 0) continue;
+                if (::connect(s.fd, a->ai_addr, a->ai_addrlen) == 0) break;
+                error = std::strerror(errno);
+                s.close();
+            }
+            ::freeaddrinfo(found);
+            if (s.valid()) s.configure();
+#else
+            (void)host; (void)port;
+            error = "sockets aren't supported on this platform";
+#endif
+            return s;
+        }
+
+        // returns the next pending connection of a listening socket (invalid if there's none).
+        Socket accept() const {
+            Socket s;
+#if RT_HAS_SOCKETS
+            s.fd = ::accept(fd, nullptr, nullptr);
+            if (s.valid()) s.configure();
+#endif
+            return s;
+        }
+
+        // returns the numeric address of the other end of a connection.
+        std::string peer() const {
+#if RT_HAS_SOCKETS
+            sockaddr_storage addr;
+            socklen_t size = sizeof(addr);
+            char host[NI_MAXHOST];
+            if (::getpeername(fd, reinterpret_cast<sockaddr*>(&addr), &size) == 0 &&
+                ::getnameinfo(reinterpret_cast<sockaddr*>(&addr), size, host, sizeof(host), nullptr, 0, NI_NUMERICHOST) == 0)
+            {
+                std::string h = host;
+                return h.compare(0, 7, "::ffff:") == 0 ? h.substr(7) : h; // IPv4 through the IPv6 socket.
+            }
+#endif
+            return "?";
+        }
+
+        // waits up to timeout_ms for any of sockets to become readable (or closed), & sets readable[i] for
+        // those that are.
+        static void poll(const std::vector<const Socket*> &sockets, std::vector<char> &readable, int timeout_ms) {
+            readable.assign(sockets.size(), 0);
+#if RT_HAS_SOCKETS
+            std::vector<pollfd> fds(sockets.size());
+            for (size_t i = 0; i < sockets.size(); i++) {
+                fds[i].fd = sockets[i]->fd;
+                fds[i].events = POLLIN;
+                fds[i].revents = 0;
+            }
+            if (::poll(fds.data(), nfds_t(fds.size()), timeout_ms) <= 0) return;
+            for (size_t i = 0; i < fds.size(); i++)
+                readable[i] = (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) != 0;
+#else
+            (void)timeout_ms;
+#endif
+        }
+
+        // sends a whole message; returns false once the connection is lost.
+        bool send(const Message &m) {
+            uint32_t header[2] = { m.type, uint32_t(m.payload.size()) };
+            return send_bytes(header, sizeof(header)) && send_bytes(m.payload.data(), m.payload.size());
+        }
+
+        // blocks until a whole message is received; returns false once the connection is lost.
+        bool receive(Message &m) {
+            uint32_t header[2];
+            if (!receive_bytes(header, sizeof(header)) || header[1] > Message::max_size) return false;
+            m.type = header[0];
+            m.payload.resize(header[1]);
+            return receive_bytes(m.payload.data(), m.payload.size());
+        }
+
+        // reads whatever has arrived (call it when poll() reports the socket readable) & moves the complete
+        // messages to out. returns false once the connection is lost or sends garbage.
+        bool poll_receive(std::vector<Message> &out) {
+#if RT_HAS_SOCKETS
+            char buffer[65536];
+            ssize_t n = ::recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) return false;
+            if (n > 0) inbox.insert(inbox.end(), buffer, buffer + n);
+
+            size_t used = 0;
+            while (inbox.size() - used >= 2 * sizeof(uint32_t)) {
+                uint32_t header[2];
+                std::memcpy(header, &inbox[used], sizeof(header));
+                if (header[1] > Message::max_size) return false;
+                if (inbox.size() - used - sizeof(header) < header[1]) break;
+
+                Message m(header[0]);
+                const char *payload = &inbox[used] + sizeof(header);
+                m.payload.assign(payload, payload + header[1]);
+                out.push_back(std::move(m));
+                used += sizeof(header) + header[1];
+            }
+            inbox.erase(inbox.begin(), inbox.begin() + used);
+            return true;
+#else
+            (void)out;
+            return false;
+#endif
+        }
+
+        void close() {
+#if RT_HAS_SOCKETS
+            if (fd >= 0) ::close(fd);
+#endif
+            fd = -1;
+            inbox.clear();
+        }
+
+    private:
+        int fd = -1;
+        std::vector<char> inbox; // bytes of messages received in part, see poll_receive().
+
+        void configure() {
+#if RT_HAS_SOCKETS
+            int on = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); // task requests are tiny.
+#ifdef SO_NOSIGPIPE
+            ::setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+#endif
+        }
+
+        bool send_bytes(const void *data, size_t size) {
+#if RT_HAS_SOCKETS
+            const char *p = static_cast<const char*>(data);
+            while (size > 0) {
+                ssize_t n = ::send(fd, p, size, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return false;
+                p += n, size -= size_t(n);
+            }
+            return true;
+#else
+            (void)data; (void)size;
+            return false;
+#endif
+        }
+
+        bool receive_bytes(void *data, size_t size) {
+#if RT_HAS_SOCKETS
+            char *p = static_cast<char*>(data);
+            while (size > 0) {
+                ssize_t n = ::recv(fd, p, size, 0);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) return false;
+                p += n, size -= size_t(n);
+            }
+            return true;
+#else
+            (void)data; (void)size;
+            return false;
+#endif
+        }
+};
+
+#endif
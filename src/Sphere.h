@@ -2,12 +2,13 @@
 #define SPHERE_H
 
 #include "Object.h"
+#include "Material.h"
 
 class Sphere : public Object {
     public:
         // static sphere
         Sphere(const Point3d &static_center, double radius, shared_ptr<Material> m)
-          : center(static_center, Vector3d(0,0,0)), radius(std::fmax(0,radius)), m(m) 
+          : center(static_center, Vector3d(0,0,0)), radius(std::fmax(0,radius)), material(m)
         {
             auto rVec = Vector3d(radius, radius, radius);
             aabb = AABB(static_center - rVec, static_center + rVec);
@@ -16,7 +17,7 @@ class Sphere : public Object {
         // moving sphere
         Sphere(const Point3d &center1, const Point3d &center2, double radius,
                shared_ptr<Material> m)
-          : center(center1, center2 - center1), radius(std::fmax(0,radius)), m(m)
+          : center(center1, center2 - center1), radius(std::fmax(0,radius)), material(m)
         {
             auto rVec = Vector3d(radius, radius, radius);
             AABB aabb1 = AABB(center1 - rVec, center1 + rVec);
@@ -25,6 +26,7 @@ class Sphere : public Object {
         }
 
         bool intersect(const Ray &ri, Interval t_interval, Intersection &isect) const override {
+            RT_STAT(SphereTests);
             Point3d current_center = center.at(ri.time());
             Vector3d d = ri.direction(), oc = current_center - ri.origin();
             auto a = d.norm_squared();
@@ -50,20 +52,53 @@ class Sphere : public Object {
             auto outward_normal = (isect.p - current_center) / radius;
             isect.set_normal(ri, outward_normal);
             get_tex_uv(outward_normal, isect.tex_u, isect.tex_v);
-            isect.m = m;
+            isect.material = material.handle;
 
             return true;
         }
 
         AABB get_AABB() const override { return aabb; }
-    
-    private:
-        Ray center; // allows center to move from start (t = 0) to end (t = 1).
-        double radius;
-        shared_ptr<Material> m;
-        AABB aabb;
 
-        static void get_tex_uv(const Point3d &p, double &u, double &v) {
+        bool is_emissive() const override { return material.ptr->is_emissive(); }
+
+        void register_materials(MaterialTable &table) override { material.register_in(table); }
+
+        // the sphere is sampled uniformly over the cone of directions it subtends from the origin.
+        double pdf_value(const Ray &ri) const override {
+            Intersection isect;
+            if (!this->intersect(ri, Interval(0, infinity), isect))
+                return 0;
+
+            auto dist_squared = (center.at(ri.time()) - ri.origin()).norm_squared();
+            if (dist_squared <= radius*radius)
+                return 1 / (4*pi); // origin inside the sphere: uniform over all directions.
+
+            auto cos_theta_max = std::sqrt(1 - radius*radius/dist_squared);
+            return 1 / (2*pi * (1 - cos_theta_max));
+        }
+
+        Vector3d sample_towards(const Point3d &origin, double time) const override {
+            Vector3d dir = center.at(time) - origin;
+            auto dist_squared = dir.norm_squared();
+            if (dist_squared <= radius*radius)
+                return sample_dir();
+
+            // sample the cone around dir, then rotate it into the (a, b, w) frame.
+            auto cos_theta_max = std::sqrt(1 - radius*radius/dist_squared);
+            auto cos_theta = 1 + sample_double() * (cos_theta_max - 1);
+            auto sin_theta = std::sqrt(std::fmax(0.0, 1 - cos_theta*cos_theta));
+            auto phi = 2*pi * sample_double();
+
+            Vector3d w = dir / std::sqrt(dist_squared);
+            Vector3d a = (std::fabs(w.x()) > 0.9) ? Vector3d(0,1,0) : Vector3d(1,0,0);
+            Vector3d v = normalize(crossProduct(w, a));
+            Vector3d u = crossProduct(w, v);
+
+            return std::cos(phi)*sin_theta * u + std::sin(phi)*sin_theta * v + cos_theta * w;
+        }
+    
+        // returns the texture coordinate of p; also used by SphereBuffer.
+        static void get_tex_uv(const Point3d &p, Real &u, Real &v) {
             // p: a given point on the unit sphere centered at (0, 0, 0).
             // u: returned value [0,1] of angle around the Y axis from X=-1.
             // v: returned value [0,1] of angle from Y=-1 to Y=+1.
@@ -77,6 +112,15 @@ class Sphere : public Object {
             u = phi / (2*pi);
             v = theta / pi;
         }
+
+    private:
+        friend class SceneSnapshot;
+        Sphere() {}
+
+        Ray center; // allows center to move from start (t = 0) to end (t = 1).
+        Real radius;
+        MaterialRef material;
+        AABB aabb;
 };
 
 #endif
\ No newline at end of file
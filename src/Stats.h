@@ -0,0 +1,202 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+
+#ifdef RT_STATS
+    #include <mutex>
+    #include <vector>
+#endif
+
+// traversal statistics. with RT_STATS defined (the RT_STATS CMake option), the tracing code counts its work
+// with RT_STAT() into counters of the calling thread, so counting never contends; the renderer prints their
+// sum after a render & can write heatmaps of every pixel's cost (see Heatmap.h). without it RT_STAT()
+// expands to nothing, so a normal build carries no counters at all.
+
+// what's counted.
+enum class Stat {
+    Rays,                // scene intersections by the renderer: camera, bounce & shadow rays.
+    ShadowRays,          // the light sampling ones among them.
+    BVHTraversals,       // walks of a BVH: nested scenes, meshes, pools & instances each walk their own.
+    BVHNodes,            // BVH nodes visited.
+    BoxTests,            // ray-box slab tests (a 4-wide node tests 4 boxes, a packet node its frustum too).
+    SphereTests,         // primitive tests, by type (pooled ones included).
+    QuadTests,
+    TriangleTests,
+    InstanceTests,       // rays transformed into an instance's BVH.
+    MediumQueries,       // ConstantMedium intersections,
+    MediumBoundaryTests, // & the boundary intersections they make (also counted by the boundary's type).
+    Paths,               // paths traced from a camera ray.
+    PathVertices,        // surfaces (or media) the paths hit.
+    RRTerminations,      // paths ended by Russian roulette,
+    DepthCutoffs,        // & by max_depth.
+    Count
+};
+
+// one set of counters, indexed by Stat.
+struct StatCounts {
+    uint64_t n[int(Stat::Count)] = {};
+
+    uint64_t operator[](Stat s) const { return n[int(s)]; }
+
+    // the primitive tests of every type.
+    uint64_t primitive_tests() const {
+        return n[int(Stat::SphereTests)] + n[int(Stat::QuadTests)] + n[int(Stat::TriangleTests)];
+    }
+
+    void add(const StatCounts &other) {
+        for (int i = 0; i < int(Stat::Count); i++) n[i] += other.n[i];
+    }
+};
+
+// the traversal cost heatmaps show: BVH nodes visited & primitives tested.
+struct TraceCost {
+    uint64_t nodes = 0, tests = 0;
+
+    TraceCost operator+(const TraceCost &other) const {
+        TraceCost s;
+        s.nodes = nodes + other.nodes, s.tests = tests + other.tests;
+        return s;
+    }
+
+    TraceCost operator-(const TraceCost &other) const {
+        TraceCost d;
+        d.nodes = nodes - other.nodes, d.tests = tests - other.tests;
+        return d;
+    }
+
+    // returns ray k's share of a cost split among n rays (e.g. a packet's), the remainder going to the first.
+    TraceCost share(int k, int n) const {
+        TraceCost s;
+        s.nodes = nodes / n + (uint64_t(k) < nodes % n);
+        s.tests = tests / n + (uint64_t(k) < tests % n);
+        return s;
+    }
+};
+
+#ifdef RT_STATS
+
+// every thread's counters; a thread's are folded into `retired` when it exits.
+class StatRegistry {
+    public:
+        static StatRegistry &get() {
+            static StatRegistry registry;
+            return registry;
+        }
+
+        void enter(StatCounts *counts) {
+            std::lock_guard<std::mutex> lock(mutex);
+            live.push_back(counts);
+        }
+
+        void leave(StatCounts *counts) {
+            std::lock_guard<std::mutex> lock(mutex);
+            retired.add(*counts);
+            live.erase(std::remove(live.begin(), live.end(), counts), live.end());
+        }
+
+        // note: only exact while no other thread counts, e.g. between renders.
+        StatCounts total() {
+            std::lock_guard<std::mutex> lock(mutex);
+            StatCounts sum = retired;
+            for (const StatCounts *counts : live) sum.add(*counts);
+            return sum;
+        }
+
+        void reset() {
+            std::lock_guard<std::mutex> lock(mutex);
+            retired = StatCounts();
+            for (StatCounts *counts : live) *counts = StatCounts();
+        }
+
+    private:
+        std::mutex mutex;
+        std::vector<StatCounts*> live;
+        StatCounts retired;
+};
+
+struct ThreadStats {
+    StatCounts counts;
+    ThreadStats() { StatRegistry::get().enter(&counts); }
+    ~ThreadStats() { StatRegistry::get().leave(&counts); }
+};
+
+// the calling thread's counters.
+inline StatCounts &thread_stats() {
+    static thread_local ThreadStats stats;
+    return stats.counts;
+}
+
+#define RT_STAT(name) (thread_stats().n[int(Stat::name)]++)
+#define RT_STAT_ADD(name, k) (thread_stats().n[int(Stat::name)] += (k))
+
+// returns the calling thread's cost so far; a sample's cost is the difference across it.
+inline TraceCost thread_cost() {
+    const StatCounts &counts = thread_stats();
+    TraceCost c;
+    c.nodes = counts[Stat::BVHNodes], c.tests = counts.primitive_tests();
+    return c;
+}
+
+#else
+
+#define RT_STAT(name) ((void)0)
+#define RT_STAT_ADD(name, k) ((void)0)
+
+inline TraceCost thread_cost() { return TraceCost(); }
+
+#endif
+
+// returns the sum of every thread's counters (all 0 without RT_STATS).
+inline StatCounts stats_total() {
+#ifdef RT_STATS
+    return StatRegistry::get().total();
+#else
+    return StatCounts();
+#endif
+}
+
+// zeroes every thread's counters, e.g. before a render.
+inline void reset_stats() {
+#ifdef RT_STATS
+    StatRegistry::get().reset();
+#endif
+}
+
+// prints the counters with their rates per ray & per path.
+inline void print_stats(std::ostream &out, const StatCounts &s) {
+    double rays = double(std::max<uint64_t>(1, s[Stat::Rays])), paths = double(std::max<uint64_t>(1, s[Stat::Paths]));
+    auto line = [&](const char *name, uint64_t count, double per, const char *unit) {
+        out << "  " << std::left << std::setw(24) << name << std::right << std::setw(16) << count;
+        if (unit) out << "  " << std::fixed << std::setprecision(2) << std::setw(10) << count / per << " per " << unit;
+        out << "\n";
+    };
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+
+    out << "Traversal statistics:\n";
+    line("rays",                  s[Stat::Rays], 1, nullptr);
+    line("  shadow rays",         s[Stat::ShadowRays], rays, "ray");
+    line("BVH traversals",        s[Stat::BVHTraversals], rays, "ray");
+    line("BVH nodes visited",     s[Stat::BVHNodes], rays, "ray");
+    line("box tests",             s[Stat::BoxTests], rays, "ray");
+    line("primitive tests",       s.primitive_tests(), rays, "ray");
+    line("  spheres",             s[Stat::SphereTests], rays, "ray");
+    line("  quads",               s[Stat::QuadTests], rays, "ray");
+    line("  triangles",           s[Stat::TriangleTests], rays, "ray");
+    line("instance tests",        s[Stat::InstanceTests], rays, "ray");
+    line("medium queries",        s[Stat::MediumQueries], rays, "ray");
+    line("  boundary tests",      s[Stat::MediumBoundaryTests], rays, "ray");
+    line("paths",                 s[Stat::Paths], 1, nullptr);
+    line("  vertices",            s[Stat::PathVertices], paths, "path");
+    line("  ended by roulette",   s[Stat::RRTerminations], paths, "path");
+    line("  cut at max depth",    s[Stat::DepthCutoffs], paths, "path");
+
+    out.flags(flags);
+    out.precision(precision);
+}
+
+#endif
@@ -4,6 +4,8 @@
 #include "Perlin.h"
 #include "Image.h"
 
+#include <string>
+
 class Texture {
     public:
         virtual ~Texture() = default;
@@ -22,6 +24,8 @@ class SolidColorTexture : public Texture {
         }
 
     private:
+        friend class SceneSnapshot;
+
         Color albedo;
 };
 
@@ -45,14 +49,17 @@ class CheckerTexture : public Texture {
         }
 
     private:
+        friend class SceneSnapshot;
+        CheckerTexture() {}
+
         double invScale;
         shared_ptr<Texture> odd;
-        shared_ptr<Texture> even;      
+        shared_ptr<Texture> even;
 };
 
 class ImageTexture : public Texture {
     public:
-        ImageTexture(const char* filename) : image(filename) {}
+        ImageTexture(const char* filename) : filename(filename), image(filename) {}
 
         Color get_texColor(double u, double v, const Point3d& p) const override {
 
@@ -72,6 +79,9 @@ class ImageTexture : public Texture {
         }
 
     private:
+        friend class SceneSnapshot;
+
+        std::string filename; // a snapshot stores the name & loads the image again.
         Image image;
 };
 
@@ -83,6 +93,9 @@ class NoiseTexture : public Texture {
             return Color(.5,.5,.5) * (1 + std::sin(scale * p.z() + 10 * perlin.turb(p, 7)));
         }
     private:
+        friend class SceneSnapshot;
+        NoiseTexture(double scale, const Perlin &perlin) : perlin(perlin), scale(scale) {}
+
         Perlin perlin;
         double scale;
 };
@@ -0,0 +1,81 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// a small work-stealing pool: every worker owns a deque of task indices, pops from its front and,
+// once empty, steals from the back of another worker's deque.
+class ThreadPool {
+    public:
+        // n_threads <= 0 means one worker per hardware thread.
+        explicit ThreadPool(int n_threads = 0) {
+            if (n_threads <= 0) n_threads = int(std::thread::hardware_concurrency());
+            workers = (n_threads < 1) ? 1 : n_threads;
+        }
+
+        int size() const { return workers; }
+
+        // runs task(index, worker) for every index in [0, n_tasks) and blocks until all are done.
+        // worker 0 is the calling thread. tasks are dealt out in contiguous blocks, so neighbouring
+        // indices (e.g. neighbouring tiles) stay on one worker until stealing kicks in.
+        void parallel_for(size_t n_tasks, const std::function<void(size_t, int)> &task) {
+            if (n_tasks == 0) return;
+
+            int n_workers = (size_t(workers) < n_tasks) ? workers : int(n_tasks);
+            std::vector<TaskQueue> queues(n_workers);
+            for (int w = 0; w < n_workers; w++) {
+                size_t begin = n_tasks * w / n_workers;
+                size_t end = n_tasks * (w+1) / n_workers;
+                for (size_t i = begin; i < end; i++) queues[w].tasks.push_back(i);
+            }
+
+            auto work = [&](int worker) {
+                size_t index;
+                while (pop(queues, worker, index) || steal(queues, worker, index)) {
+                    task(index, worker);
+                }
+            };
+
+            std::vector<std::thread> threads;
+            for (int w = 1; w < n_workers; w++) threads.emplace_back(work, w);
+            work(0);
+            for (auto &t : threads) t.join();
+        }
+
+    private:
+        int workers;
+
+        struct TaskQueue {
+            std::mutex mutex;
+            std::deque<size_t> tasks;
+        };
+
+        static bool pop(std::vector<TaskQueue> &queues, int worker, size_t &index) {
+            auto &q = queues[worker];
+            std::lock_guard<std::mutex> lock(q.mutex);
+            if (q.tasks.empty()) return false;
+            index = q.tasks.front();
+            q.tasks.pop_front();
+            return true;
+        }
+
+        static bool steal(std::vector<TaskQueue> &queues, int thief, size_t &index) {
+            int n = int(queues.size());
+            for (int k = 1; k < n; k++) {
+                auto &q = queues[(thief + k) % n];
+                std::lock_guard<std::mutex> lock(q.mutex);
+                if (q.tasks.empty()) continue;
+                index = q.tasks.back();
+                q.tasks.pop_back();
+                return true;
+            }
+            return false;
+        }
+};
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef VECTOR3_SIMD_H
+#define VECTOR3_SIMD_H
+
+// vectorized overloads of the Vector3 operators for the padded (RT_SIMD_VECTOR) layout, included by
+// Vector3d.h. being non-templates, they're picked over the generic versions for float & double vectors.
+// float vectors fill one SSE register; double vectors fill one AVX register, or two SSE2 ones without AVX.
+// the padding lane is 0 in every input and each operation keeps it 0 (only dividing by 0, which already
+// spoils x, y & z, spoils it too).
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+#include <emmintrin.h>
+#ifdef __AVX__
+    #include <immintrin.h>
+#endif
+
+// ---- float: one __m128 (x, y, z, 0).
+
+inline __m128 simd_load(const Vector3<float> &v) { return _mm_load_ps(v.e); }
+
+inline Vector3<float> simd_store(__m128 r) {
+    Vector3<float> v;
+    _mm_store_ps(v.e, r);
+    return v;
+}
+
+// sums the 4 lanes into every lane.
+inline __m128 simd_hsum(__m128 r) {
+    __m128 s = _mm_add_ps(r, _mm_shuffle_ps(r, r, _MM_SHUFFLE(2,3,0,1))); // (x+y, x+y, z+w, z+w)
+    return _mm_add_ps(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1,0,3,2)));
+}
+
+inline Vector3<float> operator+(const Vector3<float> &u, const Vector3<float> &v) {
+    return simd_store(_mm_add_ps(simd_load(u), simd_load(v)));
+}
+
+inline Vector3<float> operator-(const Vector3<float> &u, const Vector3<float> &v) {
+    return simd_store(_mm_sub_ps(simd_load(u), simd_load(v)));
+}
+
+inline Vector3<float> operator*(const Vector3<float> &u, const Vector3<float> &v) {
+    return simd_store(_mm_mul_ps(simd_load(u), simd_load(v)));
+}
+
+inline Vector3<float> operator*(float t, const Vector3<float> &v) {
+    return simd_store(_mm_mul_ps(_mm_set1_ps(t), simd_load(v)));
+}
+
+inline Vector3<float> operator*(const Vector3<float> &v, float t) { return t * v; }
+
+inline Vector3<float> operator/(const Vector3<float> &v, float t) {
+    return simd_store(_mm_div_ps(simd_load(v), _mm_set1_ps(t)));
+}
+
+inline float dotProduct(const Vector3<float> &u, const Vector3<float> &v) {
+    return _mm_cvtss_f32(simd_hsum(_mm_mul_ps(simd_load(u), simd_load(v))));
+}
+
+inline Vector3<float> componentMin(const Vector3<float> &u, const Vector3<float> &v) {
+    return simd_store(_mm_min_ps(simd_load(u), simd_load(v)));
+}
+
+inline Vector3<float> componentMax(const Vector3<float> &u, const Vector3<float> &v) {
+    return simd_store(_mm_max_ps(simd_load(u), simd_load(v)));
+}
+
+// u x v = (u * v.yzx - u.yzx * v).yzx; the padding lane stays 0 * 0 - 0 * 0.
+inline Vector3<float> crossProduct(const Vector3<float> &u, const Vector3<float> &v) {
+    __m128 a = simd_load(u), b = simd_load(v);
+    __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3,0,2,1));
+    __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3,0,2,1));
+    __m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+    return simd_store(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3,0,2,1)));
+}
+
+inline Vector3<float> normalize(const Vector3<float> &v) {
+    __m128 a = simd_load(v);
+    return simd_store(_mm_div_ps(a, _mm_sqrt_ps(simd_hsum(_mm_mul_ps(a, a)))));
+}
+
+// ---- double: one __m256d (x, y, z, 0) with AVX, else two __m128d (x, y) & (z, 0).
+
+#ifdef __AVX__
+
+inline __m256d simd_load(const Vector3<double> &v) { return _mm256_loadu_pd(v.e); }
+
+inline Vector3<double> simd_store(__m256d r) {
+    Vector3<double> v;
+    _mm256_storeu_pd(v.e, r);
+    return v;
+}
+
+inline double simd_hsum(__m256d r) {
+    __m128d s = _mm_add_pd(_mm256_castpd256_pd128(r), _mm256_extractf128_pd(r, 1)); // (x+z, y+w)
+    return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+#define RT_SIMD_DOUBLE_OP(intrinsic_256, intrinsic_128) \
+    simd_store(intrinsic_256(simd_load(u), simd_load(v)))
+
+inline Vector3<double> simd_scale(const Vector3<double> &v, double t) {
+    return simd_store(_mm256_mul_pd(simd_load(v), _mm256_set1_pd(t)));
+}
+
+inline Vector3<double> simd_divide(const Vector3<double> &v, double t) {
+    return simd_store(_mm256_div_pd(simd_load(v), _mm256_set1_pd(t)));
+}
+
+inline double simd_dot(const Vector3<double> &u, const Vector3<double> &v) {
+    return simd_hsum(_mm256_mul_pd(simd_load(u), simd_load(v)));
+}
+
+#else
+
+struct SimdDouble { __m128d lo, hi; }; // (x, y), (z, 0).
+
+inline SimdDouble simd_load(const Vector3<double> &v) {
+    SimdDouble r = { _mm_load_pd(v.e), _mm_load_pd(v.e + 2) };
+    return r;
+}
+
+inline Vector3<double> simd_store(const SimdDouble &r) {
+    Vector3<double> v;
+    _mm_store_pd(v.e, r.lo);
+    _mm_store_pd(v.e + 2, r.hi);
+    return v;
+}
+
+#define RT_SIMD_DOUBLE_OP(intrinsic_256, intrinsic_128) \
+    simd_store(SimdDouble{ intrinsic_128(simd_load(u).lo, simd_load(v).lo), \
+                           intrinsic_128(simd_load(u).hi, simd_load(v).hi) })
+
+inline Vector3<double> simd_scale(const Vector3<double> &v, double t) {
+    __m128d s = _mm_set1_pd(t);
+    SimdDouble a = simd_load(v);
+    return simd_store(SimdDouble{ _mm_mul_pd(a.lo, s), _mm_mul_pd(a.hi, s) });
+}
+
+inline Vector3<double> simd_divide(const Vector3<double> &v, double t) {
+    __m128d s = _mm_set1_pd(t);
+    SimdDouble a = simd_load(v);
+    return simd_store(SimdDouble{ _mm_div_pd(a.lo, s), _mm_div_pd(a.hi, s) });
+}
+
+inline double simd_dot(const Vector3<double> &u, const Vector3<double> &v) {
+    SimdDouble a = simd_load(u), b = simd_load(v);
+    __m128d s = _mm_add_pd(_mm_mul_pd(a.lo, b.lo), _mm_mul_pd(a.hi, b.hi)); // (x+z, y+0)
+    return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+#endif
+
+inline Vector3<double> operator+(const Vector3<double> &u, const Vector3<double> &v) {
+    return RT_SIMD_DOUBLE_OP(_mm256_add_pd, _mm_add_pd);
+}
+
+inline Vector3<double> operator-(const Vector3<double> &u, const Vector3<double> &v) {
+    return RT_SIMD_DOUBLE_OP(_mm256_sub_pd, _mm_sub_pd);
+}
+
+inline Vector3<double> operator*(const Vector3<double> &u, const Vector3<double> &v) {
+    return RT_SIMD_DOUBLE_OP(_mm256_mul_pd, _mm_mul_pd);
+}
+
+inline Vector3<double> componentMin(const Vector3<double> &u, const Vector3<double> &v) {
+    return RT_SIMD_DOUBLE_OP(_mm256_min_pd, _mm_min_pd);
+}
+
+inline Vector3<double> componentMax(const Vector3<double> &u, const Vector3<double> &v) {
+    return RT_SIMD_DOUBLE_OP(_mm256_max_pd, _mm_max_pd);
+}
+
+#undef RT_SIMD_DOUBLE_OP
+
+inline Vector3<double> operator*(double t, const Vector3<double> &v) { return simd_scale(v, t); }
+inline Vector3<double> operator*(const Vector3<double> &v, double t) { return simd_scale(v, t); }
+inline Vector3<double> operator/(const Vector3<double> &v, double t) { return simd_divide(v, t); }
+
+inline double dotProduct(const Vector3<double> &u, const Vector3<double> &v) { return simd_dot(u, v); }
+
+inline Vector3<double> normalize(const Vector3<double> &v) { return simd_divide(v, std::sqrt(simd_dot(v, v))); }
+
+// works on (x, y) & (z, 0) halves even with AVX, since shuffling across the halves of a __m256d needs AVX2.
+// same scheme as the float version: c = u * v.yzx - u.yzx * v = (z', x', y', 0), then rotated back.
+inline Vector3<double> crossProduct(const Vector3<double> &u, const Vector3<double> &v) {
+    const __m128d zero = _mm_setzero_pd();
+    __m128d a_xy = _mm_load_pd(u.e), a_z0 = _mm_load_pd(u.e + 2);
+    __m128d b_xy = _mm_load_pd(v.e), b_z0 = _mm_load_pd(v.e + 2);
+    __m128d a_yz = _mm_shuffle_pd(a_xy, a_z0, 1), a_x0 = _mm_unpacklo_pd(a_xy, zero);
+    __m128d b_yz = _mm_shuffle_pd(b_xy, b_z0, 1), b_x0 = _mm_unpacklo_pd(b_xy, zero);
+
+    __m128d c_lo = _mm_sub_pd(_mm_mul_pd(a_xy, b_yz), _mm_mul_pd(a_yz, b_xy)); // (z', x')
+    __m128d c_hi = _mm_sub_pd(_mm_mul_pd(a_z0, b_x0), _mm_mul_pd(a_x0, b_z0)); // (y', 0)
+
+    Vector3<double> r;
+    _mm_store_pd(r.e, _mm_shuffle_pd(c_lo, c_hi, 1));
+    _mm_store_pd(r.e + 2, _mm_unpacklo_pd(c_lo, zero));
+    return r;
+}
+
+#endif
+
+#endif
@@ -1,22 +1,46 @@
 #ifndef VECTOR3D_H
 #define VECTOR3D_H
 
-class Vector3d {
+// with RT_SIMD_VECTOR, vectors are padded to 4 aligned lanes (the 4th always 0), so the operators in
+// Vector3Simd.h can work on whole SSE/AVX registers; the API stays the same either way.
+#ifdef RT_SIMD_VECTOR
+    #define RT_VECTOR_LANES 4
+    #define RT_VECTOR_ALIGN alignas(16)
+#else
+    #define RT_VECTOR_LANES 3
+    #define RT_VECTOR_ALIGN
+#endif
+
+// a 3D vector over scalar type T; Vector3d is the one over the build's Real (see global.h).
+template <typename T>
+class RT_VECTOR_ALIGN Vector3 {
     public:
-        double e[3];
+        using scalar = T;
 
-        Vector3d() : e{.0,.0,.0} {}
-        Vector3d(double e0, double e1, double e2) : e{e0,e1,e2} {}
+        T e[RT_VECTOR_LANES];
 
-        double x() const { return e[0]; }
-        double y() const { return e[1]; }
-        double z() const { return e[2]; }
+        Vector3() : e{} {}
+        Vector3(T e0, T e1, T e2) : e{e0,e1,e2} {}
 
-        Vector3d operator-() const { return Vector3d(-e[0],-e[1],-e[2]); }
-        double operator[](int i) const { return e[i]; } // guarantees const objects(' member variables) unchanged.
-        double& operator[](int i) { return e[i]; } // allows mutable objects to be changed.
+        // converts between precisions, e.g. to accumulate float samples in double.
+        template <typename U>
+        explicit Vector3(const Vector3<U> &v) : e{T(v.e[0]), T(v.e[1]), T(v.e[2])} {}
 
-        Vector3d& operator+=(const Vector3d &v) {
+        T x() const { return e[0]; }
+        T y() const { return e[1]; }
+        T z() const { return e[2]; }
+
+        Vector3 operator-() const { return Vector3(-e[0],-e[1],-e[2]); }
+        T operator[](int i) const { return e[i]; } // guarantees const objects(' member variables) unchanged.
+        T& operator[](int i) { return e[i]; } // allows mutable objects to be changed.
+
+#ifdef RT_SIMD_VECTOR
+        // the compound operators go through the vectorized free operators.
+        Vector3& operator+=(const Vector3 &v) { return *this = *this + v; }
+        Vector3& operator-=(const Vector3 &v) { return *this = *this - v; }
+        Vector3& operator*=(T t) { return *this = *this * t; }
+#else
+        Vector3& operator+=(const Vector3 &v) {
             e[0] += v.e[0];
             e[1] += v.e[1];
             e[2] += v.e[2];
@@ -24,7 +48,7 @@ class Vector3d {
             return *this;
         }
 
-        Vector3d& operator-=(const Vector3d &v) {
+        Vector3& operator-=(const Vector3 &v) {
             e[0] -= v.e[0];
             e[1] -= v.e[1];
             e[2] -= v.e[2];
@@ -32,23 +56,24 @@ class Vector3d {
             return *this;
         }
 
-        Vector3d& operator*=(double t) {
+        Vector3& operator*=(T t) {
             e[0] *= t;
             e[1] *= t;
             e[2] *= t;
 
             return *this;
         }
+#endif
 
-        Vector3d& operator/=(double t) {
+        Vector3& operator/=(T t) {
             return *this *= 1/t;
         }
 
-        double norm_squared() const {
-            return e[0]*e[0] + e[1]*e[1] + e[2]*e[2];
+        T norm_squared() const {
+            return dotProduct(*this, *this);
         }
 
-        double norm() const {
+        T norm() const {
             return std::sqrt(norm_squared());
         }
 
@@ -57,58 +82,84 @@ class Vector3d {
             return (std::fabs(e[0]) < s) && (std::fabs(e[1]) < s) && (std::fabs(e[2]) < s); 
         }
 
-        static Vector3d sample() { 
-            return Vector3d(sample_double(), sample_double(), sample_double()); 
+        static Vector3 sample() { 
+            return Vector3(sample_double(), sample_double(), sample_double()); 
         }
 
-        static Vector3d sample(double min, double max) {
-             return Vector3d(sample_double(min, max), sample_double(min, max), sample_double(min, max));
+        static Vector3 sample(double min, double max) {
+             return Vector3(sample_double(min, max), sample_double(min, max), sample_double(min, max));
         }
 };
 
+using Vector3d = Vector3<Real>;
+
 // alias makes codes more readable.
 using Point3d = Vector3d;
 
-// functions that utilize Vector3d objects.
+// functions that utilize Vector3 objects.
 
-inline std::ostream& operator<<(std::ostream &out, const Vector3d &v) {
+template <typename T>
+inline std::ostream& operator<<(std::ostream &out, const Vector3<T> &v) {
     return out << v.e[0] << " " << v.e[1] << " " << v.e[2];
 }
 
-inline Vector3d operator+(const Vector3d &u, const Vector3d &v) {
-    return Vector3d(u.e[0]+v.e[0], u.e[1]+v.e[1], u.e[2]+v.e[2]);
+template <typename T>
+inline Vector3<T> operator+(const Vector3<T> &u, const Vector3<T> &v) {
+    return Vector3<T>(u.e[0]+v.e[0], u.e[1]+v.e[1], u.e[2]+v.e[2]);
 }
 
-inline Vector3d operator-(const Vector3d &u, const Vector3d &v) {
-    return Vector3d(u.e[0]-v.e[0], u.e[1]-v.e[1], u.e[2]-v.e[2]);
+template <typename T>
+inline Vector3<T> operator-(const Vector3<T> &u, const Vector3<T> &v) {
+    return Vector3<T>(u.e[0]-v.e[0], u.e[1]-v.e[1], u.e[2]-v.e[2]);
 }
 
-inline Vector3d operator*(const Vector3d &u, const Vector3d &v) {
-    return Vector3d(u.e[0]*v.e[0], u.e[1]*v.e[1], u.e[2]*v.e[2]);
+template <typename T>
+inline Vector3<T> operator*(const Vector3<T> &u, const Vector3<T> &v) {
+    return Vector3<T>(u.e[0]*v.e[0], u.e[1]*v.e[1], u.e[2]*v.e[2]);
 }
 
-inline Vector3d operator*(double t, const Vector3d &v) {
-    return Vector3d(t*v.e[0], t*v.e[1], t*v.e[2]);
+template <typename T>
+inline Vector3<T> operator*(typename Vector3<T>::scalar t, const Vector3<T> &v) {
+    return Vector3<T>(t*v.e[0], t*v.e[1], t*v.e[2]);
 }
 
-inline Vector3d operator*(const Vector3d &v, double t) {
-    return Vector3d(v.e[0]*t, v.e[1]*t, v.e[2]*t);
+template <typename T>
+inline Vector3<T> operator*(const Vector3<T> &v, typename Vector3<T>::scalar t) {
+    return Vector3<T>(v.e[0]*t, v.e[1]*t, v.e[2]*t);
 }
 
-inline Vector3d operator/(const Vector3d &v, double t) {
-    return Vector3d(v.e[0]/t, v.e[1]/t, v.e[2]/t);
+template <typename T>
+inline Vector3<T> operator/(const Vector3<T> &v, typename Vector3<T>::scalar t) {
+    return Vector3<T>(v.e[0]/t, v.e[1]/t, v.e[2]/t);
 }
 
-inline double dotProduct(const Vector3d &u, const Vector3d &v) {
+template <typename T>
+inline T dotProduct(const Vector3<T> &u, const Vector3<T> &v) {
     return u.e[0]*v.e[0] + u.e[1]*v.e[1] + u.e[2]*v.e[2];
 }
 
-inline Vector3d crossProduct(const Vector3d &u, const Vector3d &v) {
-    return Vector3d(u.e[1]*v.e[2] - v.e[1]*u.e[2], 
+// component-wise minimum & maximum.
+template <typename T>
+inline Vector3<T> componentMin(const Vector3<T> &u, const Vector3<T> &v) {
+    return Vector3<T>(std::fmin(u.e[0], v.e[0]), std::fmin(u.e[1], v.e[1]), std::fmin(u.e[2], v.e[2]));
+}
+
+template <typename T>
+inline Vector3<T> componentMax(const Vector3<T> &u, const Vector3<T> &v) {
+    return Vector3<T>(std::fmax(u.e[0], v.e[0]), std::fmax(u.e[1], v.e[1]), std::fmax(u.e[2], v.e[2]));
+}
+
+template <typename T>
+inline Vector3<T> crossProduct(const Vector3<T> &u, const Vector3<T> &v) {
+    return Vector3<T>(u.e[1]*v.e[2] - v.e[1]*u.e[2], 
                  u.e[2]*v.e[0] - v.e[2]*u.e[0], 
                  u.e[0]*v.e[1] - v.e[0]*u.e[1]);
 }
 
+#ifdef RT_SIMD_VECTOR
+    #include "Vector3Simd.h"
+#endif
+
 inline Vector3d sample_in_unit_disk() {
     while (true) {
         auto p = Vector3d(sample_double(-1,1), sample_double(-1,1), 0);
@@ -117,7 +168,8 @@ inline Vector3d sample_in_unit_disk() {
     }
 }
 
-inline Vector3d normalize(const Vector3d &v) {
+template <typename T>
+inline Vector3<T> normalize(const Vector3<T> &v) {
     return v / v.norm();
 }
 
@@ -0,0 +1,252 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "AABB.h"
+#include "BVH.h"
+#include "Object.h"
+#include "SharedArray.h"
+
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define RT_BVH4_SSE 1
+    #include <emmintrin.h>
+#else
+    #define RT_BVH4_SSE 0
+#endif
+
+// one node of a 4-wide BVH. the children's bounds are stored SoA ([min/max][axis][child]), so one SSE
+// instruction sequence tests a ray against all 4 of them. unused slots hold an inverted (empty) box.
+struct alignas(16) BVH4Node {
+    float    bounds[2][3][4];
+    uint32_t child[4]; // leaf: first object in the leaf order, interior: index of the child node.
+    uint16_t count[4]; // objects in a leaf child, 0 for interior & unused slots.
+    uint32_t pad[2];
+};
+
+static_assert(sizeof(BVH4Node) == 128, "BVH4Node should span two cache lines");
+
+// a 4-wide BVH built by collapsing the binary build tree: every node adopts the children of its
+// largest interior children until it has 4.
+class BVH4 : public BVHAccel {
+    public:
+        BVH4(const std::vector<shared_ptr<Object>> &objects, const BVHBuildOptions &opts = BVHBuildOptions()) {
+            if (objects.empty()) return;
+            auto tree = build_tree(objects, opts);
+            const BVHBuildNode *root = tree.root;
+
+            std::vector<BVH4Node> built;
+            if (root->is_leaf()) {
+                // a single leaf still gets a root node, so traversal always starts at a node.
+                built.push_back(empty_node());
+                set_child(built[0], 0, *root, 0);
+            } else {
+                collapse(*root, built);
+            }
+            nodes = SharedArray<BVH4Node>(std::move(built));
+        }
+
+        bool intersect(const Ray &ri, Interval t_interval, Intersection &isect) const override {
+            if (nodes.empty()) return false;
+            RT_STAT(BVHTraversals);
+
+            RayData rd(ri);
+            bool hit_anything = false;
+
+            StackEntry stack[3 * bvh_max_depth + 1];
+            int stack_size = 0;
+            stack[stack_size++] = StackEntry{ 0, 0, float(t_interval.min) };
+
+            while (stack_size > 0) {
+                StackEntry entry = stack[--stack_size];
+                if (entry.t_near > t_interval.max) continue; // a closer hit was found since it was pushed.
+
+                if (entry.count > 0) {
+                    if (intersect_leaf(entry.index, entry.count, ri, t_interval, isect))
+                        hit_anything = true;
+                    continue;
+                }
+
+                const BVH4Node &node = nodes[entry.index];
+                RT_STAT(BVHNodes);
+                RT_STAT_ADD(BoxTests, 4);
+                float t_near[4];
+                int hits = intersect_children(node, rd, t_interval, t_near);
+
+                // push hit children farthest first, so the nearest is popped next.
+                int order[4], n = 0;
+                for (int c = 0; c < 4; c++) {
+                    if (!(hits & (1 << c))) continue;
+                    int k = n++;
+                    while (k > 0 && t_near[order[k-1]] < t_near[c]) { order[k] = order[k-1]; k--; }
+                    order[k] = c;
+                }
+                for (int k = 0; k < n; k++) {
+                    int c = order[k];
+                    stack[stack_size++] = StackEntry{ node.child[c], node.count[c], t_near[c] };
+                }
+            }
+
+            return hit_anything;
+        }
+
+        size_t node_count() const override { return nodes.size(); }
+
+        double sah_cost(const BVHBuildOptions &opts) const override {
+            if (nodes.empty()) return 0.0;
+            return node_cost(0, opts);
+        }
+
+    private:
+        friend class SceneSnapshot;
+        BVH4() {}
+
+        SharedArray<BVH4Node> nodes;
+
+        struct StackEntry {
+            uint32_t index;
+            uint32_t count;  // > 0 for a leaf.
+            float    t_near; // entry distance into the child's box.
+        };
+
+        // per-ray values for the node tests, computed once per traversal. the origin is rounded towards
+        // whichever side keeps each slab test conservative in float.
+        struct RayData {
+            float inv_dir[3];
+            int   dir_is_neg[3];
+            float orig_near[3], orig_far[3];
+
+            explicit RayData(const Ray &ri) {
+                for (int a = 0; a < 3; a++) {
+                    double inv = 1 / ri.direction()[a];
+                    inv_dir[a] = float(inv);
+                    dir_is_neg[a] = inv < 0;
+                    float lo = round_down_to_float(ri.origin()[a]), hi = round_up_to_float(ri.origin()[a]);
+                    orig_near[a] = dir_is_neg[a] ? lo : hi;
+                    orig_far[a]  = dir_is_neg[a] ? hi : lo;
+                }
+            }
+        };
+
+        // returns a bitmask of the children whose box the ray enters within t, with their entry distances.
+        static int intersect_children(const BVH4Node &node, const RayData &rd, const Interval &t, float t_near_out[4]) {
+            // widens t_far by a few float ulps to absorb the rounding of the products.
+            const float far_scale = 1 + 4 * std::numeric_limits<float>::epsilon();
+#if RT_BVH4_SSE
+            __m128 t_near = _mm_set1_ps(round_down_to_float(t.min));
+            __m128 t_far  = _mm_set1_ps(round_up_to_float(t.max));
+            for (int a = 0; a < 3; a++) {
+                __m128 inv = _mm_set1_ps(rd.inv_dir[a]);
+                __m128 lo = _mm_loadu_ps(node.bounds[rd.dir_is_neg[a]][a]);
+                __m128 hi = _mm_loadu_ps(node.bounds[1 - rd.dir_is_neg[a]][a]);
+                __m128 t0 = _mm_mul_ps(_mm_sub_ps(lo, _mm_set1_ps(rd.orig_near[a])), inv);
+                __m128 t1 = _mm_mul_ps(_mm_sub_ps(hi, _mm_set1_ps(rd.orig_far[a])), inv);
+                // note: max/min return their second operand for NaN (0 * inf), so NaN lanes are ignored.
+                t_near = _mm_max_ps(t0, t_near);
+                t_far  = _mm_min_ps(t1, t_far);
+            }
+            t_far = _mm_mul_ps(t_far, _mm_set1_ps(far_scale));
+            _mm_storeu_ps(t_near_out, t_near);
+            return _mm_movemask_ps(_mm_cmple_ps(t_near, t_far));
+#else
+            int mask = 0;
+            for (int c = 0; c < 4; c++) {
+                float t_near = round_down_to_float(t.min), t_far = round_up_to_float(t.max);
+                for (int a = 0; a < 3; a++) {
+                    float t0 = (node.bounds[rd.dir_is_neg[a]][a][c] - rd.orig_near[a]) * rd.inv_dir[a];
+                    float t1 = (node.bounds[1 - rd.dir_is_neg[a]][a][c] - rd.orig_far[a]) * rd.inv_dir[a];
+                    t_near = (t0 > t_near) ? t0 : t_near;
+                    t_far  = (t1 < t_far)  ? t1 : t_far;
+                }
+                t_near_out[c] = t_near;
+                if (t_near <= t_far * far_scale) mask |= 1 << c;
+            }
+            return mask;
+#endif
+        }
+
+        static BVH4Node empty_node() {
+            BVH4Node node;
+            for (int c = 0; c < 4; c++) {
+                for (int a = 0; a < 3; a++) {
+                    node.bounds[0][a][c] = +std::numeric_limits<float>::infinity();
+                    node.bounds[1][a][c] = -std::numeric_limits<float>::infinity();
+                }
+                node.child[c] = 0;
+                node.count[c] = 0;
+            }
+            node.pad[0] = node.pad[1] = 0;
+            return node;
+        }
+
+        static void set_child(BVH4Node &node, int slot, const BVHBuildNode &child, uint32_t node_index) {
+            for (int a = 0; a < 3; a++) {
+                node.bounds[0][a][slot] = round_down_to_float(child.aabb.axis_interval(a).min);
+                node.bounds[1][a][slot] = round_up_to_float(child.aabb.axis_interval(a).max);
+            }
+            node.child[slot] = child.is_leaf() ? uint32_t(child.first) : node_index;
+            node.count[slot] = child.is_leaf() ? uint16_t(child.count) : 0;
+        }
+
+        static uint32_t collapse(const BVHBuildNode &build_node, std::vector<BVH4Node> &nodes) {
+            // gather up to 4 children by repeatedly opening the interior child with the largest area.
+            const BVHBuildNode *children[4] = { build_node.children[0], build_node.children[1] };
+            int n = 2;
+            while (n < 4) {
+                int best = -1;
+                double best_area = -1;
+                for (int c = 0; c < n; c++) {
+                    if (children[c]->is_leaf()) continue;
+                    double area = children[c]->aabb.surface_area();
+                    if (area > best_area) { best_area = area; best = c; }
+                }
+                if (best < 0) break;
+                const BVHBuildNode *opened = children[best];
+                children[best] = opened->children[0];
+                children[n++] = opened->children[1];
+            }
+
+            uint32_t index = uint32_t(nodes.size());
+            nodes.push_back(empty_node());
+
+            for (int c = 0; c < n; c++) {
+                uint32_t child_index = children[c]->is_leaf() ? 0 : collapse(*children[c], nodes);
+                set_child(nodes[index], c, *children[c], child_index);
+            }
+            return index;
+        }
+
+        double node_cost(uint32_t index, const BVHBuildOptions &opts) const {
+            const BVH4Node &node = nodes[index];
+
+            // the node's own box is the union of its children's.
+            double lo[3], hi[3], child_area[4];
+            for (int a = 0; a < 3; a++) { lo[a] = infinity; hi[a] = -infinity; }
+            for (int c = 0; c < 4; c++) {
+                child_area[c] = 0.0;
+                if (node.bounds[0][0][c] > node.bounds[1][0][c]) continue;
+                double d[3];
+                for (int a = 0; a < 3; a++) {
+                    lo[a] = std::fmin(lo[a], node.bounds[0][a][c]);
+                    hi[a] = std::fmax(hi[a], node.bounds[1][a][c]);
+                    d[a] = double(node.bounds[1][a][c]) - node.bounds[0][a][c];
+                }
+                child_area[c] = 2 * (d[0]*d[1] + d[1]*d[2] + d[2]*d[0]);
+            }
+            double d[3] = { hi[0]-lo[0], hi[1]-lo[1], hi[2]-lo[2] };
+            double area = 2 * (d[0]*d[1] + d[1]*d[2] + d[2]*d[0]);
+
+            double cost = opts.traversal_cost;
+            for (int c = 0; c < 4; c++) {
+                if (node.bounds[0][0][c] > node.bounds[1][0][c]) continue;
+                double ratio = (area > 0) ? child_area[c] / area : 1.0;
+                double child_cost = (node.count[c] > 0) ? opts.intersection_cost * node.count[c]
+                                                        : node_cost(node.child[c], opts);
+                cost += ratio * child_cost;
+            }
+            return cost;
+        }
+};
+
+#endif
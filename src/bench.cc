@@ -0,0 +1,375 @@
+// microbenchmarks of the renderer's inner kernels: primitive & box intersection, BVH traversal & building,
+// medium, texture & material sampling. every kernel runs over an input set drawn with a fixed seed, so the numbers
+// of two commits (or two build options) compare like for like, & each result carries a checksum of the
+// kernel's outputs (hits, colors) that only changes when the kernel's results do.
+//
+// usage: bench [-json <file>] [-filter <substring>] [-time <seconds per benchmark>]
+
+#include "global.h"
+
+#include "Object.h"
+#include "Sphere.h"
+#include "Quad.h"
+#include "ConstantMedium.h"
+#include "BVH.h"
+#include "LinearBVH.h"
+#include "WideBVH.h"
+#include "Texture.h"
+#include "Material.h"
+#include "Framebuffer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// keeps the compiler from optimizing value away, & (a memory clobber) from moving work across the call.
+template <typename T>
+inline void keep(const T &value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile T sink;
+    sink = value;
+#endif
+}
+
+// one benchmark's timing. an op is one ray for the intersection kernels, one lookup, draw or scatter
+// for the others.
+struct BenchResult {
+    std::string name, op;
+    double ns_per_op;        // fastest repetition.
+    double ns_per_op_median; // median repetition, shows how noisy the machine was.
+    double check;            // sum of the kernel's outputs over one pass of its inputs.
+
+    bool per_ray() const { return op == "ray"; }
+};
+
+class Bench {
+    public:
+        double min_time = 0.25; // seconds each benchmark runs for, split over `repetitions`.
+        std::string filter;     // runs only the benchmarks whose name contains it.
+        std::vector<BenchResult> results;
+
+        // times pass(), which runs the kernel once over its n_ops inputs & returns their checksum: passes are
+        // repeated until a repetition takes min_time / repetitions, & the fastest of the repetitions counts.
+        // returns whether the benchmark called name runs, e.g. to skip building its inputs.
+        bool selected(const std::string &name) const { return filter.empty() || name.find(filter) != std::string::npos; }
+
+        template <typename Pass>
+        void run(const std::string &name, const char *op, size_t n_ops, Pass pass) {
+            if (!selected(name)) return;
+
+            BenchResult result;
+            result.name = name, result.op = op;
+            result.check = pass(); // warms the caches up, too.
+
+            long passes = 1;
+            while (time(pass, passes) < min_time / repetitions && passes < (1L << 30)) passes *= 2;
+
+            std::vector<double> ns(repetitions);
+            for (auto &x : ns) x = time(pass, passes) * 1e9 / (double(passes) * n_ops);
+            std::sort(ns.begin(), ns.end());
+            result.ns_per_op = ns.front();
+            result.ns_per_op_median = ns[ns.size() / 2];
+
+            std::printf("%-28s %8.2f ns/%-8s %9.2f %-8s %16.6g\n", name.c_str(), result.ns_per_op, op,
+                        1e3 / result.ns_per_op, result.per_ray() ? "Mrays/s" : "Mops/s", result.check);
+            results.push_back(result);
+        }
+
+        // returns the result of the benchmark called name, nullptr if it didn't run.
+        const BenchResult *find(const std::string &name) const {
+            for (const auto &r : results) if (r.name == name) return &r;
+            return nullptr;
+        }
+
+        // writes the results as JSON, one benchmark per line, so two runs diff line by line.
+        bool write_json(const std::string &filename) const {
+            BufferedWriter out(filename);
+#ifdef RT_SINGLE_PRECISION
+            const char *precision = "float";
+#else
+            const char *precision = "double";
+#endif
+#ifdef RT_SIMD_VECTOR
+            const char *simd = "true";
+#else
+            const char *simd = "false";
+#endif
+            char line[512];
+            std::snprintf(line, sizeof(line), "{\n  \"precision\": \"%s\",\n  \"simd_vector\": %s,\n  \"hardware_threads\": %u,\n  \"results\": [\n",
+                          precision, simd, std::thread::hardware_concurrency());
+            out.write(line);
+            for (size_t i = 0; i < results.size(); i++) {
+                const BenchResult &r = results[i];
+                std::snprintf(line, sizeof(line),
+                    "    {\"name\": \"%s\", \"op\": \"%s\", \"ns_per_op\": %.3f, \"ns_per_op_median\": %.3f, \"%s\": %.3f, \"check\": %.17g}%s\n",
+                    r.name.c_str(), r.op.c_str(), r.ns_per_op, r.ns_per_op_median, r.per_ray() ? "mrays_per_s" : "mops_per_s",
+                    1e3 / r.ns_per_op, r.check, i + 1 < results.size() ? "," : "");
+                out.write(line);
+            }
+            out.write("  ]\n}\n");
+            return out.close();
+        }
+
+    private:
+        static const int repetitions = 5;
+
+        template <typename Pass>
+        static double time(Pass &pass, long passes) {
+            auto start = std::chrono::steady_clock::now();
+            for (long i = 0; i < passes; i++) keep(pass());
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+};
+
+static const uint64_t bench_seed = 2024;
+uint64_t stream_seed = bench_seed; // read from memory by every pass of the random stream benchmarks, so the
+                                   // compiler can't compute a pass once & hoist it out of the timing loop.
+static const size_t n_rays = 1 << 14; // the rays of a set stay in L2, so the kernels are what's timed.
+
+// returns a point drawn uniformly from box, from the thread's sample stream.
+Point3d sample_in(const AABB &box) {
+    auto x = sample_double(box.x.min, box.x.max);
+    auto y = sample_double(box.y.min, box.y.max);
+    auto z = sample_double(box.z.min, box.z.max);
+    return Point3d(x, y, z);
+}
+
+// returns n rays starting on a sphere of radius `distance` around the origin & aimed at points of target,
+// so a kernel whose primitive fills target is hit by a fair share of them. the set is the same every run.
+std::vector<Ray> make_rays(size_t n, double distance, const AABB &target, uint64_t stream) {
+    std::vector<Ray> rays;
+    rays.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        thread_sampler().start(i, stream, bench_seed);
+        Point3d origin = distance * normalize(Vector3d::sample(-1, 1));
+        rays.push_back(Ray(origin, normalize(sample_in(target) - origin)));
+    }
+    return rays;
+}
+
+// intersects every ray with obj, returns the count of hits.
+double intersect_all(const Object &obj, const std::vector<Ray> &rays) {
+    double hits = 0;
+    Intersection isect;
+    for (const auto &r : rays) hits += obj.intersect(r, Interval(0, infinity), isect);
+    return hits;
+}
+
+void bench_primitives(Bench &bench, const shared_ptr<Material> &white) {
+    Sphere sphere(Point3d(0, 0, 0), 1, white);
+    auto sphere_rays = make_rays(n_rays, 4, AABB(Point3d(-1.5, -1.5, -1.5), Point3d(1.5, 1.5, 1.5)), 1);
+    bench.run("sphere.intersect", "ray", sphere_rays.size(), [&] { return intersect_all(sphere, sphere_rays); });
+
+    Quad quad(Point3d(-1, -1, 0), Vector3d(2, 0, 0), Vector3d(0, 2, 0), white);
+    auto quad_rays = make_rays(n_rays, 4, AABB(Point3d(-1.5, -1.5, 0), Point3d(1.5, 1.5, 0)), 2);
+    bench.run("quad.intersect", "ray", quad_rays.size(), [&] { return intersect_all(quad, quad_rays); });
+
+    AABB box(Point3d(-1, -1, -1), Point3d(1, 1, 1));
+    auto box_rays = make_rays(n_rays, 4, AABB(Point3d(-1.5, -1.5, -1.5), Point3d(1.5, 1.5, 1.5)), 3);
+    bench.run("aabb.intersectP", "ray", box_rays.size(), [&] {
+        double hits = 0;
+        for (const auto &r : box_rays) hits += box.intersectP(r, Interval(0, infinity));
+        return hits;
+    });
+
+    // the medium draws its scatter distances from the thread's stream, restarted every pass.
+    ConstantMedium medium(make_shared<Sphere>(Point3d(0, 0, 0), 1, white), 0.5, Color(1, 1, 1));
+    bench.run("medium.intersect", "ray", sphere_rays.size(), [&] {
+        thread_sampler().start(0, 0, bench_seed);
+        return intersect_all(medium, sphere_rays);
+    });
+}
+
+// returns n spheres scattered in a box sized so they're as dense as bench_traversal's 10k.
+std::vector<shared_ptr<Object>> random_spheres(size_t n, const shared_ptr<Material> &white) {
+    double half = 10 * std::cbrt(n / 10000.0);
+    AABB bounds(Point3d(-half, -half, -half), Point3d(half, half, half));
+    std::vector<shared_ptr<Object>> spheres;
+    spheres.reserve(n);
+    thread_sampler().start(0, 0, bench_seed);
+    for (size_t i = 0; i < n; i++)
+        spheres.push_back(make_shared<Sphere>(sample_in(bounds), 0.1 + 0.3 * sample_double(), white));
+    return spheres;
+}
+
+// times SAH builds of a LinearBVH over 1K, 100K & 1M spheres with 1, 2, 4 & every hardware thread
+// (an op is one primitive). the checksum is the tree's SAH cost, the same at every thread count. each
+// size ends with the speedups over 1 thread, which only mean something with as many hardware threads.
+void bench_build(Bench &bench, const shared_ptr<Material> &white) {
+    std::vector<int> threads = { 1, 2, 4 };
+    int hardware = int(std::thread::hardware_concurrency());
+    if (hardware > 4) threads.push_back(hardware);
+
+    struct Size { size_t n; const char *label; };
+    const Size sizes[] = { { 1000, "1K" }, { 100000, "100K" }, { 1000000, "1M" } };
+    for (const Size &size : sizes) {
+        auto name = [&](int t) { return std::string("bvh.build.sah.") + size.label + ".t" + std::to_string(t); };
+        bool any = false;
+        for (int t : threads) any = any || bench.selected(name(t));
+        if (!any) continue;
+
+        auto spheres = random_spheres(size.n, white);
+        for (int t : threads) {
+            BVHBuildOptions opts;
+            opts.split = BVHSplit::SAH;
+            opts.build_threads = t;
+            bench.run(name(t), "prim", size.n, [&] { return LinearBVH(spheres, opts).sah_cost(opts); });
+        }
+
+        const BenchResult *serial = bench.find(name(1));
+        if (!serial) continue;
+        std::printf("%-28s", (std::string("bvh.build.sah.") + size.label + " speedup").c_str());
+        for (int t : threads) {
+            const BenchResult *r = bench.find(name(t));
+            if (r && t > 1) std::printf(" t%d %.2fx", t, serial->ns_per_op / r->ns_per_op);
+        }
+        std::printf("  (%d hardware threads)\n", hardware);
+    }
+}
+
+// traverses 10k spheres scattered in a box with every BVH layout, over the same rays.
+void bench_traversal(Bench &bench, const shared_ptr<Material> &white) {
+    auto spheres = random_spheres(10000, white);
+    AABB bounds(Point3d(-10, -10, -10), Point3d(10, 10, 10));
+    auto rays = make_rays(n_rays, 30, bounds, 4);
+
+    BVHBuildOptions opts;
+    BVHNode binary(spheres, opts);
+    bench.run("bvh.binary_node", "ray", rays.size(), [&] { return intersect_all(binary, rays); });
+    LinearBVH linear(spheres, opts);
+    bench.run("bvh.linear", "ray", rays.size(), [&] { return intersect_all(linear, rays); });
+    BVH4 wide(spheres, opts);
+    bench.run("bvh.wide4", "ray", rays.size(), [&] { return intersect_all(wide, rays); });
+}
+
+void bench_textures(Bench &bench) {
+    const size_t n = 1 << 14;
+    std::vector<Point3d> points;
+    std::vector<double> us, vs;
+    AABB box(Point3d(-10, -10, -10), Point3d(10, 10, 10));
+    for (size_t i = 0; i < n; i++) {
+        thread_sampler().start(i, 5, bench_seed);
+        points.push_back(sample_in(box));
+        us.push_back(sample_double());
+        vs.push_back(sample_double());
+    }
+
+    auto lookup_all = [&](const Texture &tex) {
+        double sum = 0;
+        for (size_t i = 0; i < n; i++) sum += tex.get_texColor(us[i], vs[i], points[i]).x();
+        return sum;
+    };
+
+    thread_sampler().start(0, 6, bench_seed); // the lattice's random vectors & permutations.
+    Perlin perlin;
+    bench.run("perlin.turb", "lookup", n, [&] {
+        double sum = 0;
+        for (const auto &p : points) sum += perlin.turb(p, 7);
+        return sum;
+    });
+
+    thread_sampler().start(0, 6, bench_seed);
+    NoiseTexture noise(4);
+    bench.run("noise_texture.lookup", "lookup", n, [&] { return lookup_all(noise); });
+
+    if (Image("earthmap.jpg").width() > 0) {
+        ImageTexture image("earthmap.jpg");
+        bench.run("image_texture.lookup", "lookup", n, [&] { return lookup_all(image); });
+    } else {
+        std::printf("%-28s skipped, images/earthmap.jpg not found\n", "image_texture.lookup");
+    }
+}
+
+// scatters rays hitting a unit sphere (from outside & inside) off every material.
+void bench_materials(Bench &bench) {
+    const size_t n = 1 << 14;
+    std::vector<Ray> rays;
+    std::vector<Intersection> hits;
+    for (size_t i = 0; i < n; i++) {
+        thread_sampler().start(i, 7, bench_seed);
+        Vector3d outward = normalize(Vector3d::sample(-1, 1));
+        Point3d origin = (i % 4 == 0) ? Point3d(0, 0, 0) : 3 * normalize(Vector3d::sample(-1, 1));
+        Ray r(origin, normalize(outward - origin));
+
+        Intersection isect;
+        isect.p = outward;
+        isect.distance = (outward - origin).norm();
+        isect.set_normal(r, outward);
+        isect.tex_u = sample_double(), isect.tex_v = sample_double();
+        rays.push_back(r);
+        hits.push_back(isect);
+    }
+
+    struct Case { const char *name; shared_ptr<Material> material; };
+    Case cases[] = {
+        { "material.diffuse.scatter",    make_shared<Diffuse>(Color(.7, .6, .5)) },
+        { "material.metal.scatter",      make_shared<Metal>(Color(.8, .8, .9), 0.3) },
+        { "material.dielectric.scatter", make_shared<Dielectric>(1.5) },
+        { "material.light.scatter",      make_shared<DiffuseLight>(Color(4, 4, 4)) },
+        { "material.isotropic.scatter",  make_shared<Isotropic>(Color(.7, .7, .7)) },
+    };
+    for (const auto &c : cases) {
+        const Material &m = *c.material;
+        bench.run(c.name, "scatter", n, [&] {
+            thread_sampler().start(0, 8, bench_seed);
+            double sum = 0;
+            Color attenuation;
+            Ray ro;
+            for (size_t i = 0; i < n; i++)
+                if (m.scatter(rays[i], hits[i], attenuation, ro)) sum += attenuation.x() + ro.direction().x();
+            return sum;
+        });
+    }
+}
+
+// the renderer's random stream against the standard library's usual choice.
+void bench_sampler(Bench &bench) {
+    const size_t n = 1 << 16;
+    bench.run("sampler.next_double", "draw", n, [&] {
+        Sampler s;
+        s.start(0, 0, stream_seed);
+        double sum = 0;
+        for (size_t i = 0; i < n; i++) sum += s.next_double();
+        return sum;
+    });
+    bench.run("std.mt19937_uniform", "draw", n, [&] {
+        std::mt19937 engine(static_cast<uint32_t>(stream_seed));
+        std::uniform_real_distribution<double> uniform(0, 1);
+        double sum = 0;
+        for (size_t i = 0; i < n; i++) sum += uniform(engine);
+        return sum;
+    });
+}
+
+int main(int argc, char **argv) {
+    Bench bench;
+    std::string json;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "-json" && has_value) json = argv[++i];
+        else if (arg == "-filter" && has_value) bench.filter = argv[++i];
+        else if (arg == "-time" && has_value) bench.min_time = std::atof(argv[++i]);
+        else {
+            std::fprintf(stderr, "usage: bench [-json <file>] [-filter <substring>] [-time <seconds per benchmark>]\n");
+            return 1;
+        }
+    }
+
+    auto white = make_shared<Diffuse>(Color(.73, .73, .73));
+    bench_primitives(bench, white);
+    bench_traversal(bench, white);
+    bench_build(bench, white);
+    bench_textures(bench);
+    bench_materials(bench);
+    bench_sampler(bench);
+
+    if (!json.empty() && !bench.write_json(json)) return 1;
+    return 0;
+}
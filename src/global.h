@@ -5,14 +5,26 @@
 #include <iostream>
 #include <limits>
 #include <memory>
-#include <random>
 #include <chrono>
 
+#include "Sampler.h"
+#include "Stats.h"
+
 // C++ Standard Usings.
 
 using std::make_shared;
 using std::shared_ptr;
 
+// Precision.
+
+// scalar type of the geometry types (Vector3d, Ray, Interval, AABB), set per build target:
+// define RT_SINGLE_PRECISION for float (half the memory per vector, box & hit record), else double.
+#ifdef RT_SINGLE_PRECISION
+using Real = float;
+#else
+using Real = double;
+#endif
+
 // Constants.
 
 const double infinity = std::numeric_limits<double>::infinity();
@@ -22,12 +34,8 @@ const double pi = 3.1415926535897932385;
 
 inline double degrees_to_radians(double degrees) { return (degrees * pi) / 180.0; }
 
-// returns a random double number in [0,1).
-inline double sample_double() {
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937 generator;
-    return distribution(generator);
-}
+// returns a random double number in [0,1), drawn from the calling thread's sample stream.
+inline double sample_double() { return thread_sampler().next_double(); }
 
 // returns a random double number in [min,max).
 inline double sample_double(double min, double max) { return min + (max-min) * sample_double(); }
@@ -5,22 +5,58 @@
 #include "Sphere.h"
 #include "Quad.h"
 #include "ConstantMedium.h"
+#include "Instance.h"
+#include "PrimitivePool.h"
+#include "MeshLoader.h"
+#include "Snapshot.h"
+#include "SceneFile.h"
+#include "Distributed.h"
 #include "BVH.h"
 #include "Texture.h"
 #include "Material.h"
 #include "Scene.h"
 #include "Renderer.h"
 
+#include <csignal>
+#include <functional>
+
 Color sky_color = Color(0.70, 0.80, 1.00);
 
-void bouncing_spheres() {
-    
-    // create the scene with image size params.
-    Scene scene(400, 16.0 / 9.0, sky_color);
+// the file built-in scenes are cached in (-snapshot); empty: they're built on every run.
+std::string scene_snapshot;
+
+// loads scene from scene_snapshot if it holds one made from key by this very build (a rebuild may change
+// what build() makes), otherwise builds it & saves it there. returns false if build() fails.
+bool load_or_build(Scene &scene, const std::string &key, const std::function<bool(Scene &)> &build) {
+    std::string build_key = key + " built " __DATE__ " " __TIME__;
+    auto load_start = std::chrono::steady_clock::now();
+    if (!scene_snapshot.empty() && SceneSnapshot::load(scene, scene_snapshot, build_key)) {
+        std::cout << "Scene snapshot loaded in "
+                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load_start).count() << " ms\n";
+        return true;
+    }
+    if (!build(scene)) return false;
+    if (!scene_snapshot.empty() && !SceneSnapshot::save(scene, scene_snapshot, build_key))
+        std::cerr << "WARNING: Could not save the scene snapshot to '" << scene_snapshot << "'.\n";
+    return true;
+}
+
+// prints what the scene's arena holds, to track the scene's memory footprint.
+void print_scene_memory(const Scene &scene) {
+    std::cout << "Scene arena: " << scene.arena->allocations() << " allocations, "
+              << scene.arena->bytes_used() / 1024 << " KB used, "
+              << scene.arena->bytes_in_blocks() / 1024 << " KB in " << scene.arena->block_count() << " blocks\n";
+}
+
+void bouncing_spheres(Scene &scene, Renderer &r) {
+
+    scene.image_w = 400;
+    scene.aspect_ratio = 16.0 / 9.0;
+    scene.bgColor = sky_color;
 
     // define materials.
     auto checker_texture = make_shared<CheckerTexture>(0.32, Color(.2, .3, .1), Color(.9, .9, .9));
-    scene.add(make_shared<Sphere>(Point3d(0,-1000,0), 1000, make_shared<Diffuse>(checker_texture)));
+    scene.add<Sphere>(Point3d(0,-1000,0), 1000, make_shared<Diffuse>(checker_texture));
 
     for (int a = -11; a < 11; a++) {
         for (int b = -11; b < 11; b++) {
@@ -35,33 +71,39 @@ void bouncing_spheres() {
                     auto albedo = Color::sample() * Color::sample();
                     sphere_material = make_shared<Diffuse>(albedo);
                     auto center2 = center + Vector3d(0, sample_double(0,.5), 0);
-                    scene.add(make_shared<Sphere>(center, center2, 0.2, sphere_material));
+                    scene.add<Sphere>(center, center2, 0.2, sphere_material);
                 } else if (choose_m < 0.95) {
                     // metal
                     auto albedo = Color::sample(0.5, 1);
                     auto fuzz = sample_double(0, 0.5);
                     sphere_material = make_shared<Metal>(albedo, fuzz);
-                    scene.add(make_shared<Sphere>(center, 0.2, sphere_material));
+                    scene.add<Sphere>(center, 0.2, sphere_material);
                 } else {
                     // glass
                     sphere_material = make_shared<Dielectric>(1.5);
-                    scene.add(make_shared<Sphere>(center, 0.2, sphere_material));
+                    scene.add<Sphere>(center, 0.2, sphere_material);
                 }
             }
         }
     }
 
     auto material1 = make_shared<Dielectric>(1.5);
-    scene.add(make_shared<Sphere>(Point3d(0, 1, 0), 1.0, material1));
+    scene.add<Sphere>(Point3d(0, 1, 0), 1.0, material1);
 
     auto material2 = make_shared<Diffuse>(Color(0.4, 0.2, 0.1));
-    scene.add(make_shared<Sphere>(Point3d(-4, 1, 0), 1.0, material2));
+    scene.add<Sphere>(Point3d(-4, 1, 0), 1.0, material2);
 
     auto material3 = make_shared<Metal>(Color(0.7, 0.6, 0.5), 0.0);
-    scene.add(make_shared<Sphere>(Point3d(4, 1, 0), 1.0, material3));
+    scene.add<Sphere>(Point3d(4, 1, 0), 1.0, material3);
 
     // build BVH for added objects.
-    scene.buildBVH();
+    // note: SAH splits keep the 1000-radius ground sphere from inflating the small spheres' nodes.
+    BVHBuildOptions sah;
+    sah.split = BVHSplit::SAH;
+    sah.build_threads = 0;
+    scene.buildBVH(sah);
+    std::cout << "BVH build: " << scene.bvh_build_time * 1000 << " ms, SAH cost: " << scene.bvh->sah_cost(sah) << "\n";
+    print_scene_memory(scene);
 
     // define camera params.
     scene.vfov     = 20;
@@ -72,260 +114,58 @@ void bouncing_spheres() {
     scene.defocus_angle = 0.6;
     scene.focal_dist    = 10.0;
 
-    // define renderer and image size.
-    Renderer r;
     r.spp = 100;
-
-    // render the image.
-    auto start = std::chrono::system_clock::now();
-    r.render(scene);
-    auto stop = std::chrono::system_clock::now();
-
-    std::cout << "\nDone!\n";
-    std::cout << "Time taken: " << std::chrono::duration_cast<std::chrono::hours>(stop - start).count() << "h";
-    std::cout << " : " << std::chrono::duration_cast<std::chrono::minutes>(stop - start).count() % 60 << "min";
-    std::cout << " : " << std::chrono::duration_cast<std::chrono::seconds>(stop - start).count() % 60 << "s\n";
 }
 
-void checkered_spheres() {
-
-    Scene scene(400, 16.0 / 9.0, sky_color);
-
-    auto checker_texture = make_shared<CheckerTexture>(0.32, Color(.2, .3, .1), Color(.9, .9, .9));
-
-    scene.add(make_shared<Sphere>(Point3d(0,-10, 0), 10, make_shared<Diffuse>(checker_texture)));
-    scene.add(make_shared<Sphere>(Point3d(0, 10, 0), 10, make_shared<Diffuse>(checker_texture)));
-
-    scene.buildBVH();
-
-    scene.vfov      = 20;
-    scene.eye_pos   = Point3d(13,2,3);
-    scene.gaze_pos  = Point3d(0,0,0);
-    scene.up_dir    = Vector3d(0,1,0);
-
-    scene.defocus_angle = 0;
-
-    Renderer r;
-    r.spp = 256;
-
-    auto start = std::chrono::system_clock::now();
-    r.render(scene);
-    auto stop = std::chrono::system_clock::now();
-
-    std::cout << "\nDone!\n";
-    std::cout << "Time taken: " << std::chrono::duration_cast<std::chrono::hours>(stop - start).count() << "h";
-    std::cout << " : " << std::chrono::duration_cast<std::chrono::minutes>(stop - start).count() % 60 << "min";
-    std::cout << " : " << std::chrono::duration_cast<std::chrono::seconds>(stop - start).count() % 60 << "s\n";
-}
-
-void earth() {
-
-    Scene scene(400, 16.0 / 9.0, sky_color);
-
-    auto earth_texture = make_shared<ImageTexture>("earthmap.jpg");
-    auto earth_material = make_shared<Diffuse>(earth_texture);
-    scene.add(make_shared<Sphere>(Point3d(0,0,0), 2, earth_material));
-
-    scene.buildBVH();
-
-    scene.vfov      = 20;
-    scene.eye_pos   = Point3d(0,0,12);
-    scene.gaze_pos  = Point3d(0,0,0);
-    scene.up_dir    = Vector3d(0,1,0);
-
-    scene.defocus_angle = 0;
-
-    Renderer r;
-    r.spp = 100;
-
-    auto start = std::chrono::system_clock::now();
-    r.render(scene);
-    auto stop = std::chrono::system_clock::now();
-
-    std::cout << "\nDone!\n";
-    std::cout << "Time taken: " << std::chrono::duration_cast<std::chrono::hours>(stop - start).count() << "h";
-    std::cout << " : " << std::chrono::duration_cast<std::chrono::minutes>(stop - start).count() % 60 << "min";
-    std::cout << " : " << std::chrono::duration_cast<std::chrono::seconds>(stop - start).count() % 60 << "s\n";
-}
-
-void perlin_spheres() {
-
-    Scene scene(400, 16.0 / 9.0, sky_color);
-
-    auto perlin_texture = make_shared<NoiseTexture>(4);
-    scene.add(make_shared<Sphere>(Point3d(0,-1000,0), 1000, make_shared<Diffuse>(perlin_texture)));
-    scene.add(make_shared<Sphere>(Point3d(0,2,0), 2, make_shared<Diffuse>(perlin_texture)));
-
-    scene.buildBVH();
-
-    scene.vfov      = 20;
-    scene.eye_pos   = Point3d(13,2,3);
-    scene.gaze_pos  = Point3d(0,0,0);
-    scene.up_dir    = Vector3d(0,1,0);
-
-    scene.defocus_angle = 0;
-
-    Renderer r;
-    r.spp = 100;
-
-    auto start = std::chrono::system_clock::now();
-    r.render(scene);
-    auto stop = std::chrono::system_clock::now();
-
-    std::cout << "\nDone!\n";
-    std::cout << "Time taken: " << std::chrono::duration_cast<std::chrono::hours>(stop - start).count() << "h";
-    std::cout << " : " << std::chrono::duration_cast<std::chrono::minutes>(stop - start).count() % 60 << "min";
-    std::cout << " : " << std::chrono::duration_cast<std::chrono::seconds>(stop - start).count() % 60 << "s\n";
-}
-
-void Quads() {
-
-    Scene scene(400, 16.0 / 9.0, sky_color);
-
-    // Materials
-    auto left_red     = make_shared<Diffuse>(Color(1.0, 0.2, 0.2));
-    auto back_green   = make_shared<Diffuse>(Color(0.2, 1.0, 0.2));
-    auto right_blue   = make_shared<Diffuse>(Color(0.2, 0.2, 1.0));
-    auto upper_orange = make_shared<Diffuse>(Color(1.0, 0.5, 0.0));
-    auto lower_teal   = make_shared<Diffuse>(Color(0.2, 0.8, 0.8));
-
-    // Quads
-    scene.add(make_shared<Quad>(Point3d(-3,-2, 5), Vector3d(0, 0,-4), Vector3d(0, 4, 0), left_red));
-    scene.add(make_shared<Quad>(Point3d(-2,-2, 0), Vector3d(4, 0, 0), Vector3d(0, 4, 0), back_green));
-    scene.add(make_shared<Quad>(Point3d( 3,-2, 1), Vector3d(0, 0, 4), Vector3d(0, 4, 0), right_blue));
-    scene.add(make_shared<Quad>(Point3d(-2, 3, 1), Vector3d(4, 0, 0), Vector3d(0, 0, 4), upper_orange));
-    scene.add(make_shared<Quad>(Point3d(-2,-3, 5), Vector3d(4, 0, 0), Vector3d(0, 0,-4), lower_teal));
-
-    scene.buildBVH();
-
-    scene.vfov      = 80;
-    scene.eye_pos   = Point3d(0,0,9);
-    scene.gaze_pos  = Point3d(0,0,0);
-    scene.up_dir    = Vector3d(0,1,0);
-
-    scene.defocus_angle = 0;
-
-    Renderer r;
-    r.spp = 100;
-
-    auto start = std::chrono::system_clock::now();
-    r.render(scene);
-    auto stop = std::chrono::system_clock::now();
-
-    std::cout << "\nDone!\n";
-    std::cout << "Time taken: " << std::chrono::duration_cast<std::chrono::hours>(stop - start).count() << "h";
-    std::cout << " : " << std::chrono::duration_cast<std::chrono::minutes>(stop - start).count() % 60 << "min";
-    std::cout << " : " << std::chrono::duration_cast<std::chrono::seconds>(stop - start).count() % 60 << "s\n";
-}
-
-void simple_light() {
-
-    Scene scene(400, 16.0 / 9.0, Color());
-
-    auto perlin_texture = make_shared<NoiseTexture>(4);
-    scene.add(make_shared<Sphere>(Point3d(0,-1000,0), 1000, make_shared<Diffuse>(perlin_texture)));
-    scene.add(make_shared<Sphere>(Point3d(0,2,0), 2, make_shared<Diffuse>(perlin_texture)));
-
-    auto diffuse_light = make_shared<DiffuseLight>(Color(4,4,4));
-    scene.add(make_shared<Sphere>(Point3d(0,7,0), 2, diffuse_light));
-    scene.add(make_shared<Quad>(Point3d(3,1,-2), Vector3d(2,0,0), Vector3d(0,2,0), diffuse_light));
-
-    scene.buildBVH();
-
-    scene.vfov      = 20;
-    scene.eye_pos   = Point3d(26,3,6);
-    scene.gaze_pos  = Point3d(0,2,0);
-    scene.up_dir    = Vector3d(0,1,0);
-
-    scene.defocus_angle = 0;
-
-    Renderer r;
-    r.spp = 100;
-
-    auto start = std::chrono::system_clock::now();
-    r.render(scene);
-    auto stop = std::chrono::system_clock::now();
-
-    std::cout << "\nDone!\n";
-    std::cout << "Time taken: " << std::chrono::duration_cast<std::chrono::hours>(stop - start).count() << "h";
-    std::cout << " : " << std::chrono::duration_cast<std::chrono::minutes>(stop - start).count() % 60 << "min";
-    std::cout << " : " << std::chrono::duration_cast<std::chrono::seconds>(stop - start).count() % 60 << "s\n";
-}
-
-void cornell_box() {
-    Scene scene(600, 1.0, Color());
-
+// adds the cornell box around the mesh in filename (OBJ or PLY), scaled to 330 units high & stood on the
+// floor, & builds the BVH. returns false if the mesh can't be loaded.
+bool build_cornell_mesh(Scene &scene, const std::string &filename) {
     auto red   = make_shared<Diffuse>(Color(.65, .05, .05));
     auto white = make_shared<Diffuse>(Color(.73, .73, .73));
     auto green = make_shared<Diffuse>(Color(.12, .45, .15));
     auto light = make_shared<DiffuseLight>(Color(15, 15, 15));
 
-    scene.add(make_shared<Quad>(Point3d(555,0,0), Vector3d(0,555,0), Vector3d(0,0,555), green));
-    scene.add(make_shared<Quad>(Point3d(0,0,0), Vector3d(0,555,0), Vector3d(0,0,555), red));
-    scene.add(make_shared<Quad>(Point3d(343, 554, 332), Vector3d(-130,0,0), Vector3d(0,0,-105), light));
-    scene.add(make_shared<Quad>(Point3d(0,0,0), Vector3d(555,0,0), Vector3d(0,0,555), white));
-    scene.add(make_shared<Quad>(Point3d(555,555,555), Vector3d(-555,0,0), Vector3d(0,0,-555), white));
-    scene.add(make_shared<Quad>(Point3d(0,0,555), Vector3d(555,0,0), Vector3d(0,555,0), white));
-
-    shared_ptr<Object> box1 = box(Point3d(0,0,0), Point3d(165,330,165), white);
-    box1 = make_shared<RotateY>(box1, 15);
-    box1 = make_shared<Translate>(box1, Vector3d(265,0,295));
-    scene.add(box1);
-
-    shared_ptr<Object> box2 = box(Point3d(0,0,0), Point3d(165,165,165), white);
-    box2 = make_shared<RotateY>(box2, -18);
-    box2 = make_shared<Translate>(box2, Vector3d(130,0,65));
-    scene.add(box2);
+    scene.add<Quad>(Point3d(555,0,0), Vector3d(0,555,0), Vector3d(0,0,555), green);
+    scene.add<Quad>(Point3d(0,0,0), Vector3d(0,555,0), Vector3d(0,0,555), red);
+    scene.add<Quad>(Point3d(343, 554, 332), Vector3d(-130,0,0), Vector3d(0,0,-105), light);
+    scene.add<Quad>(Point3d(0,0,0), Vector3d(555,0,0), Vector3d(0,0,555), white);
+    scene.add<Quad>(Point3d(555,555,555), Vector3d(-555,0,0), Vector3d(0,0,-555), white);
+    scene.add<Quad>(Point3d(0,0,555), Vector3d(555,0,0), Vector3d(0,555,0), white);
+
+    auto load_start = std::chrono::steady_clock::now();
+    MeshData data = load_mesh(filename);
+    auto load_stop = std::chrono::steady_clock::now();
+    if (data.empty()) return false;
+
+    auto mesh = scene.make<TriangleMesh>(data, white);
+    auto build_stop = std::chrono::steady_clock::now();
+    std::cout << "Mesh: " << mesh->size() << " triangles, loaded in "
+              << std::chrono::duration<double, std::milli>(load_stop - load_start).count() << " ms, BVH built in "
+              << std::chrono::duration<double, std::milli>(build_stop - load_stop).count() << " ms\n";
+
+    AABB bounds = mesh->get_AABB();
+    double scale = 330 / bounds.y.size();
+    Point3d center = bounds.Centriod();
+    scene.add<Instance>(mesh,
+        Transform::translate(Vector3d(278, 0, 278)) * Transform::scale(Vector3d(scale, scale, scale)) *
+        Transform::translate(Vector3d(-center.x(), -bounds.y.min, -center.z()))
+    );
 
     scene.buildBVH();
-
-    scene.vfov      = 40;
-    scene.eye_pos   = Point3d(278, 278, -800);
-    scene.gaze_pos  = Point3d(278, 278, 0);
-    scene.up_dir    = Vector3d(0,1,0);
-
-    scene.defocus_angle = 0;
-
-    Renderer r;
-    r.spp = 200;
-
-    auto start = std::chrono::system_clock::now();
-    r.render(scene);
-    auto stop = std::chrono::system_clock::now();
-
-    std::cout << "\nDone!\n";
-    std::cout << "Time taken: " << std::chrono::duration_cast<std::chrono::hours>(stop - start).count() << "h";
-    std::cout << " : " << std::chrono::duration_cast<std::chrono::minutes>(stop - start).count() % 60 << "min";
-    std::cout << " : " << std::chrono::duration_cast<std::chrono::seconds>(stop - start).count() % 60 << "s\n";
+    return true;
 }
 
-void cornell_smoke() {
-    Scene scene(600, 1.0, Color());
-
-    auto red   = make_shared<Diffuse>(Color(.65, .05, .05));
-    auto white = make_shared<Diffuse>(Color(.73, .73, .73));
-    auto green = make_shared<Diffuse>(Color(.12, .45, .15));
-    auto light = make_shared<DiffuseLight>(Color(7, 7, 7));
-
-    scene.add(make_shared<Quad>(Point3d(555,0,0), Vector3d(0,555,0), Vector3d(0,0,555), green));
-    scene.add(make_shared<Quad>(Point3d(0,0,0), Vector3d(0,555,0), Vector3d(0,0,555), red));
-    scene.add(make_shared<Quad>(Point3d(113,554,127), Vector3d(330,0,0), Vector3d(0,0,305), light));
-    scene.add(make_shared<Quad>(Point3d(0,555,0), Vector3d(555,0,0), Vector3d(0,0,555), white));
-    scene.add(make_shared<Quad>(Point3d(0,0,0), Vector3d(555,0,0), Vector3d(0,0,555), white));
-    scene.add(make_shared<Quad>(Point3d(0,0,555), Vector3d(555,0,0), Vector3d(0,555,0), white));
-
-    shared_ptr<Object> box1 = box(Point3d(0,0,0), Point3d(165,330,165), white);
-    box1 = make_shared<RotateY>(box1, 15);
-    box1 = make_shared<Translate>(box1, Vector3d(265,0,295));
-
-    shared_ptr<Object> box2 = box(Point3d(0,0,0), Point3d(165,165,165), white);
-    box2 = make_shared<RotateY>(box2, -18);
-    box2 = make_shared<Translate>(box2, Vector3d(130,0,65));
-
-    scene.add(make_shared<ConstantMedium>(box1, 0.01, Color(0,0,0)));
-    scene.add(make_shared<ConstantMedium>(box2, 0.01, Color(1,1,1)));
+bool cornell_mesh(Scene &scene, Renderer &r, const std::string &filename) {
+    scene.image_w = 600;
+    scene.aspect_ratio = 1.0;
+    scene.bgColor = Color();
 
-    scene.buildBVH();
+    // a snapshot is keyed by the mesh file's size & modification time too, so editing the mesh rebuilds it.
+    uint64_t mesh_size = 0;
+    int64_t mesh_mtime = 0;
+    file_stamp(filename, mesh_size, mesh_mtime);
+    std::string key = "cornell_mesh " + filename + " " + std::to_string(mesh_size) + " " + std::to_string(mesh_mtime);
+    if (!load_or_build(scene, key, [&](Scene &s) { return build_cornell_mesh(s, filename); })) return false;
 
     scene.vfov      = 40;
     scene.eye_pos   = Point3d(278, 278, -800);
@@ -334,23 +174,16 @@ void cornell_smoke() {
 
     scene.defocus_angle = 0;
 
-    Renderer r;
     r.spp = 200;
-
-    auto start = std::chrono::system_clock::now();
-    r.render(scene);
-    auto stop = std::chrono::system_clock::now();
-
-    std::cout << "\nDone!\n";
-    std::cout << "Time taken: " << std::chrono::duration_cast<std::chrono::hours>(stop - start).count() << "h";
-    std::cout << " : " << std::chrono::duration_cast<std::chrono::minutes>(stop - start).count() % 60 << "min";
-    std::cout << " : " << std::chrono::duration_cast<std::chrono::seconds>(stop - start).count() % 60 << "s\n";
+    r.packet_size = 8; // pinhole camera: primary rays are coherent.
+    return true;
 }
 
-void RTNW(int image_width, int spp) {
+// adds the objects of the RTNW final scene to scene & builds its BVH.
+void build_RTNW(Scene &scene) {
 
-    // test quad & box.
-    Scene boxes1;
+    // test quad & box: the boxes' sides go into one quad pool, tested 4 at a time.
+    auto boxes1 = scene.make<QuadPool>();
     auto ground = make_shared<Diffuse>(Color(0.48, 0.83, 0.53));
 
     int boxes_per_side = 20;
@@ -364,67 +197,78 @@ void RTNW(int image_width, int spp) {
             auto y1 = sample_double(1,101);
             auto z1 = z0 + w;
 
-            boxes1.add(box(Point3d(x0,y0,z0), Point3d(x1,y1,z1), ground));
+            for_each_box_side(Point3d(x0,y0,z0), Point3d(x1,y1,z1),
+                [&](const Point3d &Q, const Vector3d &u, const Vector3d &v) { boxes1->add(Q, u, v, ground); });
         }
     }
 
-    boxes1.buildBVH();
-
-    Scene scene(image_width, 1.0, Color());
+    BVHBuildOptions sah;
+    sah.split = BVHSplit::SAH;
+    sah.build_threads = 0;
+    boxes1->build(sah);
 
-    scene.add(make_shared<Scene>(boxes1));
+    scene.add(boxes1);
 
     // test light.
     auto light = make_shared<DiffuseLight>(Color(7, 7, 7));
-    scene.add(make_shared<Quad>(Point3d(123,554,147), Vector3d(300,0,0), Vector3d(0,0,265), light));
+    scene.add<Quad>(Point3d(123,554,147), Vector3d(300,0,0), Vector3d(0,0,265), light);
 
     // test motion blur.
     auto center1 = Point3d(400, 400, 200);
     auto center2 = center1 + Vector3d(30,0,0);
     auto sphere_material = make_shared<Diffuse>(Color(0.7, 0.3, 0.1));
-    scene.add(make_shared<Sphere>(center1, center2, 50, sphere_material));
+    scene.add<Sphere>(center1, center2, 50, sphere_material);
 
     // test dielectric & metal.
-    scene.add(make_shared<Sphere>(Point3d(260, 150, 45), 50, make_shared<Dielectric>(1.5)));
-    scene.add(make_shared<Sphere>(
+    scene.add<Sphere>(Point3d(260, 150, 45), 50, make_shared<Dielectric>(1.5));
+    scene.add<Sphere>(
         Point3d(0, 150, 145), 50, make_shared<Metal>(Color(0.8, 0.8, 0.9), 1.0)
-    ));
+    );
 
     // test volume.
-    auto boundary = make_shared<Sphere>(Point3d(360,150,145), 70, make_shared<Dielectric>(1.5));
+    auto boundary = scene.make<Sphere>(Point3d(360,150,145), 70, make_shared<Dielectric>(1.5));
     scene.add(boundary);
-    scene.add(make_shared<ConstantMedium>(boundary, 0.2, Color(0.2, 0.4, 0.9)));
+    scene.add<ConstantMedium>(boundary, 0.2, Color(0.2, 0.4, 0.9));
     
-    boundary = make_shared<Sphere>(Point3d(0,0,0), 5000, make_shared<Dielectric>(1.5));
-    scene.add(make_shared<ConstantMedium>(boundary, .0001, Color(1,1,1)));
+    boundary = scene.make<Sphere>(Point3d(0,0,0), 5000, make_shared<Dielectric>(1.5));
+    scene.add<ConstantMedium>(boundary, .0001, Color(1,1,1));
 
     // test image texture.
     auto image_texture = make_shared<ImageTexture>("earthmap.jpg");
-    scene.add(make_shared<Sphere>(Point3d(400,200,400), 100, make_shared<Diffuse>(image_texture)));
+    scene.add<Sphere>(Point3d(400,200,400), 100, make_shared<Diffuse>(image_texture));
 
     // test perlin.
     auto perlin_texture = make_shared<NoiseTexture>(0.2);
-    scene.add(make_shared<Sphere>(Point3d(220,280,300), 80, make_shared<Diffuse>(perlin_texture)));
+    scene.add<Sphere>(Point3d(220,280,300), 80, make_shared<Diffuse>(perlin_texture));
 
-    // test diffuse.
-    Scene boxes2;
+    // test diffuse & primitive pool: the spheres are stored SoA and tested 4 at a time.
+    auto boxes2 = scene.make<SpherePool>();
     auto white = make_shared<Diffuse>(Color(.73, .73, .73));
     int ns = 1000;
     for (int j = 0; j < ns; j++) {
-        boxes2.add(make_shared<Sphere>(Point3d::sample(0,165), 10, white));
+        boxes2->add(Point3d::sample(0,165), 10, white);
     }
 
-    boxes2.buildBVH();
+    boxes2->build(sah);
 
     // test instance.
-    scene.add(make_shared<Translate>(
-        make_shared<RotateY>(
-            make_shared<Scene>(boxes2), 15),
-            Vector3d(-100,270,395)
-        )
+    scene.add<Instance>(
+        boxes2,
+        Transform::translate(Vector3d(-100,270,395)) * Transform::rotate_y(15)
     );
 
-    scene.buildBVH();
+    sah.layout = BVHLayout::Wide4; // the scene's own BVH only, pools always build binary ones.
+    scene.buildBVH(sah);
+    std::cout << "BVH build: " << scene.bvh_build_time * 1000 << " ms, SAH cost: " << scene.bvh->sah_cost(sah) << "\n";
+    print_scene_memory(scene);
+}
+
+void RTNW(Scene &scene, Renderer &r, int image_width, int spp) {
+    scene.image_w = image_width;
+    scene.aspect_ratio = 1.0;
+    scene.bgColor = Color();
+
+    load_or_build(scene, "RTNW " + std::to_string(image_width), [](Scene &s) { build_RTNW(s); return true; });
 
     scene.vfov      = 40;
     scene.eye_pos   = Point3d(478, 278, -600);
@@ -433,11 +277,129 @@ void RTNW(int image_width, int spp) {
 
     scene.defocus_angle = 0;
 
-    Renderer r;
     r.spp = spp;
+}
+
+// sets up one of the scenes that can't be written as a scene file (random placement, a mesh fitted into
+// the box); the others live in scenes/. returns false for an unknown name or a scene that failed to load.
+bool builtin_scene(const std::string &name, Scene &scene, Renderer &r) {
+    if (name == "bouncing_spheres")  { bouncing_spheres(scene, r); return true; }
+    if (name == "rtnw")              { RTNW(scene, r, 400, 128); return true; }
+    if (name == "rtnw_final")        { RTNW(scene, r, 800, 10240); return true; }
+    if (name == "cornell_mesh")      return cornell_mesh(scene, r, "models/bunny.obj");
+    std::cerr << "ERROR: Unknown built-in scene '" << name << "'.\n";
+    return false;
+}
+
+// builds the scene of a job & applies the job's overrides; every process of a distributed render does
+// exactly this, see Distributed.h.
+bool load_job(const RenderJob &job, Scene &scene, Renderer &r) {
+    if (!job.scene_file.empty()) {
+        auto load_start = std::chrono::steady_clock::now();
+        if (!SceneFile::load(job.scene_file, scene, r)) return false;
+        double load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load_start).count();
+        std::cout << "Scene file: " << scene.objects.size() << " objects, parsed in " << load_ms - scene.bvh_build_time * 1000
+                  << " ms, BVH built in " << scene.bvh_build_time * 1000 << " ms\n";
+    } else if (!builtin_scene(job.builtin, scene, r)) {
+        return false;
+    }
+
+    if (job.spp > 0) r.spp = job.spp;
+    if (job.width > 0) scene.image_w = job.width;
+    return true;
+}
+
+void print_usage() {
+    std::cerr << "usage: main [options] [scene file]\n"
+              << "  -o <file>           image file to write: .ppm (8-bit), .pfm or .exr (float radiance);\n"
+              << "                      default binary.ppm\n"
+              << "  -spp <n>            samples per pixel\n"
+              << "  -threads <n>        render threads (0: every hardware thread)\n"
+              << "  -width <n>          image width (the height follows the aspect ratio)\n"
+              << "  -budget <s>         render progressive passes for s seconds instead of a fixed spp\n"
+              << "  -noise <target>     with -budget, stop early once the image's noise is below target\n"
+              << "                      (mean relative standard error of the pixels, e.g. 0.02)\n"
+              << "  -heatmap <file>     write the BVH nodes visited & primitives tested per sample of every\n"
+              << "                      pixel to <file>.nodes & <file>.tests images (.ppm: false color;\n"
+              << "                      .pfm / .exr: the counts); needs a build with RT_STATS\n"
+              << "  -builtin <name>     render a built-in scene instead of a file: bouncing_spheres,\n"
+              << "                      rtnw (the default), rtnw_final or cornell_mesh\n"
+              << "  -snapshot <file>    load the built-in scene from file if it was saved there by this\n"
+              << "                      build, otherwise build it & save it there\n"
+              << "  -checkpoint <file>  save the render's progress to file every few minutes & when\n"
+              << "                      interrupted (SIGINT / SIGTERM)\n"
+              << "  -interval <s>       seconds between checkpoints (default 300)\n"
+              << "  -resume             continue the render saved in the checkpoint file\n"
+              << "  -coordinator <port> hand the render out to the workers that connect on port\n"
+              << "  -worker <host:port> trace tasks for the coordinator at host:port; the scene & options\n"
+              << "                      are the coordinator's, its scene file must exist here too\n"
+              << "options override the scene's own settings.\n";
+}
+
+// stops the render at its next pixel row, so it can save a checkpoint before the process exits.
+extern "C" void stop_render(int) { Renderer::request_stop(); }
+
+int main(int argc, char **argv) {
+    RenderJob job;
+    job.builtin = "rtnw";
+    std::string output = "binary.ppm", checkpoint, coordinator, heatmap;
+    int threads = -1, port = 0;
+    double interval = 0, budget = 0, noise = 0;
+    bool resume = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "-o" && has_value) output = argv[++i];
+        else if (arg == "-spp" && has_value) job.spp = std::atoi(argv[++i]);
+        else if (arg == "-threads" && has_value) threads = std::atoi(argv[++i]);
+        else if (arg == "-width" && has_value) job.width = std::atoi(argv[++i]);
+        else if (arg == "-budget" && has_value) budget = std::atof(argv[++i]);
+        else if (arg == "-noise" && has_value) noise = std::atof(argv[++i]);
+        else if (arg == "-heatmap" && has_value) heatmap = argv[++i];
+        else if (arg == "-builtin" && has_value) job.builtin = argv[++i];
+        else if (arg == "-snapshot" && has_value) scene_snapshot = argv[++i];
+        else if (arg == "-checkpoint" && has_value) checkpoint = argv[++i];
+        else if (arg == "-interval" && has_value) interval = std::atof(argv[++i]);
+        else if (arg == "-resume") resume = true;
+        else if (arg == "-coordinator" && has_value) port = std::atoi(argv[++i]);
+        else if (arg == "-worker" && has_value) coordinator = argv[++i];
+        else if (arg[0] != '-' && job.scene_file.empty()) job.scene_file = arg;
+        else { print_usage(); return 1; }
+    }
+
+    if (!checkpoint.empty()) {
+        std::signal(SIGINT, stop_render);
+        std::signal(SIGTERM, stop_render);
+    }
+
+    if (!coordinator.empty())
+        return RenderWorker::serve(coordinator, std::max(0, threads), load_job) ? 0 : 1;
+
+    Scene scene;
+    Renderer r;
+    job.scene_hash = job.hash_scene();
+    if (!load_job(job, scene, r)) return 1;
+
+    if (threads >= 0) r.n_threads = threads;
+    if (budget > 0) r.time_budget = budget;
+    if (noise > 0) r.noise_target = noise;
+    r.output = output;
+#ifdef RT_STATS
+    r.heatmap_file = heatmap;
+#else
+    if (!heatmap.empty()) std::cerr << "WARNING: Heatmaps need a build with RT_STATS, -heatmap is ignored.\n";
+#endif
+    r.checkpoint_file = checkpoint;
+    if (interval > 0) r.checkpoint_interval = interval;
+    r.resume = resume;
 
     auto start = std::chrono::system_clock::now();
-    r.render(scene);
+    if (port > 0) {
+        if (!RenderCoordinator(r, scene, job).render(port)) return 2;
+    } else if (!r.render(scene)) {
+        return 2;
+    }
     auto stop = std::chrono::system_clock::now();
 
     std::cout << "\nDone!\n";
@@ -445,19 +407,3 @@ void RTNW(int image_width, int spp) {
     std::cout << " : " << std::chrono::duration_cast<std::chrono::minutes>(stop - start).count() % 60 << "min";
     std::cout << " : " << std::chrono::duration_cast<std::chrono::seconds>(stop - start).count() % 60 << "s\n";
 }
-
-int main() {
-    int scene_index = 9;
-    switch(scene_index) {
-        case 0: bouncing_spheres();  break;
-        case 1: checkered_spheres(); break;
-        case 2: earth();             break;
-        case 3: perlin_spheres();    break;
-        case 4: Quads();             break;
-        case 5: simple_light();      break;
-        case 6: cornell_box();       break;
-        case 7: cornell_smoke();     break;
-        case 8: RTNW(800, 10240);    break;
-        case 9: RTNW(400,   128);     break;
-    }
-}
\ No newline at end of file
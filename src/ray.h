@@ -3,27 +3,34 @@
 
 #include "Vector3d.h"
 
-class Ray {
+// a ray over scalar type T; Ray is the one over the build's Real (see global.h).
+template <typename T>
+class RayT {
     public:
-        Ray() {}
-        Ray(const Point3d& origin, const Vector3d& direction) : Ray(origin, direction, 0) {}
+        using Point3d = Vector3<T>;
+        using Vector3d = Vector3<T>;
+
+        RayT() {}
+        RayT(const Point3d& origin, const Vector3d& direction) : RayT(origin, direction, 0) {}
         
-        Ray(const Point3d& origin, const Vector3d& direction, double tm) : orig(origin), dir(direction), tm(tm) {}
+        RayT(const Point3d& origin, const Vector3d& direction, T tm) : orig(origin), dir(direction), tm(tm) {}
 
         // pass const member values defaultly, but caller can copy them into mutable ones.
         const Point3d& origin() const { return orig; }
         const Vector3d& direction() const { return dir; }
 
-        double time() const { return tm; }
+        T time() const { return tm; }
 
-        Point3d at(double t) const {
+        Point3d at(T t) const {
             return orig + t*dir;
         }
 
     private:
         Point3d orig;
         Vector3d dir;
-        double tm; // the time of ray emitting while shutter opens.
+        T tm; // the time of ray emitting while shutter opens.
 };
 
+using Ray = RayT<Real>;
+
 #endif
\ No newline at end of file
@@ -0,0 +1,15 @@
+# renders two scene files with the renderer RENDERER & fails unless both images are byte-identical.
+# usage: cmake -DRENDERER=<main> -DSCENE_A=<file> -DSCENE_B=<file> -DOUTPUT=<prefix> -P compare_renders.cmake
+
+foreach(side A B)
+    execute_process(COMMAND ${RENDERER} -threads 1 -o ${OUTPUT}.${side}.ppm ${SCENE_${side}}
+                    RESULT_VARIABLE result OUTPUT_QUIET)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "rendering ${SCENE_${side}} failed (${result})")
+    endif()
+endforeach()
+
+execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${OUTPUT}.A.ppm ${OUTPUT}.B.ppm RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${SCENE_A} & ${SCENE_B} render different images")
+endif()